@@ -161,6 +161,14 @@ enum MessageIds {
     GetBlockHeaderReply,
     GetBlockCount,
     GetBlockCountReply,
+    /// Request takes a BlockHash (in the byte order GetBlock uses) or a Height.
+    /// The reply body is the serialized block without any tags, large blocks
+    /// arrive as a sequence of chunks.
+    GetRawBlock,
+    GetRawBlockReply,
+    /// Statistics of the UTXO set, answered from the running commitment.
+    GetTxOutSetInfo,
+    GetTxOutSetInfoReply,
 //   getblockhash index // maybe not needed as we add a height to GetBlock and GetBlockHeader?
 //   getchaintips
 //   getdifficulty
@@ -168,7 +176,6 @@ enum MessageIds {
 //   getrawmempool ( verbose )
 //   gettxout "txid" n ( includemempool )
 //   gettxoutproof ["txid",...] ( blockhash )
-//   gettxoutsetinfo
 //   verifychain ( checklevel numblocks )
 //   verifytxoutproof "proof"
 };
@@ -203,7 +210,14 @@ enum Tags {
     Nonce,      //int
     Bits,       // integer
     PrevBlockHash,
-    NextBlockHash
+    NextBlockHash,
+
+    // GetTxOutSetInfo-tags
+    Transactions = 60,  // int
+    TxOuts,             // int
+    BytesSerialized,    // int
+    HashSerialized,     // a sha256
+    TotalAmount         // value in satoshis
 };
 
 }
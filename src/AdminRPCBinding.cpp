@@ -15,162 +15,203 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include "AdminRPCBinding.h"
 #include "AdminProtocol.h"
 
 #include "streaming/MessageBuilder.h"
 #include "BlocksDB.h"
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "checkpoints.h"
+#include "consensus/validation.h"
 #include "main.h"
+#include "net.h"
 #include "rpcserver.h"
+#include "streams.h"
+#include "txmempool.h"
 #include "base58.h"
+#include "blockchain/Block.h"
 #include <univalue.h>
 
+#ifdef ENABLE_WALLET
+#include "init.h"
+#include "wallet/wallet.h"
+#endif
+
 #include <boost/algorithm/hex.hpp>
 
 #include <streaming/MessageParser.h>
 
 #include <list>
+#include <set>
 
 namespace {
 
+/*
+ * The calls below used to be answered by the JSON-RPC code, which sends hashes as the bytes of
+ * their hex string. That is the reverse of the uint256 internal order, clients depend on it.
+ */
+uint256 hashFromHexBytes(const std::vector<char> &bytes)
+{
+    std::string hex;
+    boost::algorithm::hex(bytes, back_inserter(hex));
+    uint256 hash;
+    hash.SetHex(hex);
+    return hash;
+}
+
+std::vector<char> hexBytesFromHash(const uint256 &hash)
+{
+    std::vector<char> answer;
+    boost::algorithm::unhex(hash.GetHex(), back_inserter(answer));
+    return answer;
+}
+
 // blockchain
 
-class GetBlockChainInfo : public AdminRPCBinding::RpcParser
+class GetBlockChainInfo : public AdminRPCBinding::DirectParser
 {
 public:
-    GetBlockChainInfo() : RpcParser("getblockchaininfo", Admin::BlockChain::GetBlockChainInfoReply, 500) {}
-    virtual void buildReply(Streaming::MessageBuilder &builder, const UniValue &result) {
-        const UniValue &chain = find_value(result, "chain");
-        builder.add(Admin::BlockChain::Chain, chain.get_str());
-        const UniValue &blocks = find_value(result, "blocks");
-        builder.add(Admin::BlockChain::Blocks, blocks.get_int());
-        const UniValue &headers = find_value(result, "headers");
-        builder.add(Admin::BlockChain::Headers, headers.get_int());
-        const UniValue &best = find_value(result, "bestblockhash");
-        uint256 sha256;
-        sha256.SetHex(best.get_str());
-        builder.add(Admin::BlockChain::BestBlockHash, sha256);
-        const UniValue &difficulty = find_value(result, "difficulty");
-        builder.add(Admin::BlockChain::Difficulty, difficulty.get_real());
-        const UniValue &time = find_value(result, "mediantime");
-        builder.add(Admin::BlockChain::MedianTime, (uint64_t) time.get_int64());
-        const UniValue &progress = find_value(result, "verificationprogress");
-        builder.add(Admin::BlockChain::VerificationProgress, progress.get_real());
-        const UniValue &chainwork = find_value(result, "chainwork");
-        sha256.SetHex(chainwork.get_str());
-        builder.add(Admin::BlockChain::ChainWork, sha256);
-        const UniValue &pruned = find_value(result, "pruned");
-        if (pruned.get_bool())
+    GetBlockChainInfo() : DirectParser(Admin::BlockChain::GetBlockChainInfoReply, 500) {}
+
+    void buildReply(const Message&, Streaming::MessageBuilder &builder) {
+        LOCK(cs_main);
+        CBlockIndex *tip = chainActive.Tip();
+        builder.add(Admin::BlockChain::Chain, Params().NetworkIDString());
+        builder.add(Admin::BlockChain::Blocks, chainActive.Height());
+        builder.add(Admin::BlockChain::Headers, pindexBestHeader ? pindexBestHeader->nHeight : -1);
+        builder.add(Admin::BlockChain::BestBlockHash, tip->GetBlockHash());
+        builder.add(Admin::BlockChain::Difficulty, GetDifficulty(tip));
+        builder.add(Admin::BlockChain::MedianTime, (uint64_t) tip->GetMedianTimePast());
+        builder.add(Admin::BlockChain::VerificationProgress,
+                    Checkpoints::GuessVerificationProgress(Params().Checkpoints(), tip));
+        builder.add(Admin::BlockChain::ChainWork, ArithToUint256(tip->nChainWork));
+        if (fPruneMode)
             builder.add(Admin::BlockChain::Pruned, true);
 
-        const UniValue &bip9 = find_value(result, "bip9_softforks");
         bool first = true;
-        for (auto fork : bip9.getValues()) {
+        for (auto fork : BIP9SoftForkStatuses()) {
             if (first) first = false;
-            else builder.add(Admin::Wallet::Separator, true);
-            const UniValue &id = find_value(fork, "id");
-            builder.add(Admin::BlockChain::Bip9ForkId, id.get_str());
-            const UniValue &status = find_value(fork, "status");
-            // TODO change status to an enum?
-            builder.add(Admin::BlockChain::Bip9ForkStatus, status.get_str());
+            else builder.add(Admin::BlockChain::Separator, true);
+            builder.add(Admin::BlockChain::Bip9ForkId, fork.first);
+            builder.add(Admin::BlockChain::Bip9ForkStatus, fork.second);
         }
     }
 };
 
-class GetBestBlockHash : public AdminRPCBinding::RpcParser
+class GetBestBlockHash : public AdminRPCBinding::DirectParser
 {
 public:
-    GetBestBlockHash() : RpcParser("getbestblockhash", Admin::BlockChain::GetBestBlockHashReply, 50) {}
+    GetBestBlockHash() : DirectParser(Admin::BlockChain::GetBestBlockHashReply, 40) {}
+
+    void buildReply(const Message&, Streaming::MessageBuilder &builder) {
+        LOCK(cs_main);
+        builder.add(Admin::BlockChain::GenericByteData, hexBytesFromHash(chainActive.Tip()->GetBlockHash()));
+    }
 };
 
-class GetBlock : public AdminRPCBinding::RpcParser
+class GetBlock : public AdminRPCBinding::DirectParser
 {
 public:
-    GetBlock() : RpcParser("getblock", Admin::BlockChain::GetBlockReply), m_verbose(false) {}
-    virtual void createRequest(const Message &message, UniValue &output) {
-        std::string txid;
+    GetBlock(int replyMessageId = Admin::BlockChain::GetBlockReply)
+        : DirectParser(replyMessageId), m_verbose(false), m_index(nullptr) {}
+
+    void createRequest(const Message &message) {
         Streaming::MessageParser parser(message.body());
+        LOCK(cs_main);
         while (parser.next() == Streaming::FoundTag) {
             if (parser.tag() == Admin::BlockChain::BlockHash
-                    || parser.tag() == Admin::RawTransactions::GenericByteData)
-                boost::algorithm::hex(parser.bytesData(), back_inserter(txid));
-            else if (parser.tag() == Admin::BlockChain::Verbose)
+                    || parser.tag() == Admin::BlockChain::GenericByteData) {
+                auto mi = Blocks::indexMap.find(hashFromHexBytes(parser.bytesData()));
+                if (mi != Blocks::indexMap.end())
+                    m_index = mi->second;
+            }
+            else if (parser.tag() == Admin::BlockChain::Height) {
+                m_index = chainActive[parser.intData()];
+            }
+            else if (parser.tag() == Admin::BlockChain::Verbose) {
                 m_verbose = parser.boolData();
+            }
         }
-        output.push_back(std::make_pair("block", UniValue(UniValue::VSTR, txid)));
-        output.push_back(std::make_pair("verbose", UniValue(UniValue::VBOOL, m_verbose ? "1": "0")));
+        if (m_index == nullptr)
+            throw std::runtime_error("Block not found");
+        if (fHavePruned && !(m_index->nStatus & BLOCK_HAVE_DATA) && m_index->nTx > 0)
+            throw std::runtime_error("Block not available (pruned data)");
+
+        m_block = Blocks::DB::instance()->loadBlock(m_index->GetBlockPos());
+        if (m_verbose)
+            m_block.findTransactions();
     }
 
-    virtual int calculateMessageSize(const UniValue &result) const {
-        if (m_verbose) {
-            const UniValue &tx = find_value(result, "tx");
-            return tx.size() * 70 + 200;
-        }
-        return result.get_str().size() / 2 + 20;
+    int calculateMessageSize() const {
+        if (m_verbose)
+            return m_block.transactions().size() * 40 + 300; // separator (1) + TxId (2 + 1 + 32) each
+        return m_block.size() + 10;
     }
 
-    virtual void buildReply(Streaming::MessageBuilder &builder, const UniValue &result) {
+    void buildReply(const Message&, Streaming::MessageBuilder &builder) {
+        assert(m_index);
         if (!m_verbose) {
-            std::vector<char> answer;
-            boost::algorithm::unhex(result.get_str(), back_inserter(answer));
-            builder.add(1, answer);
+            builder.add(Admin::BlockChain::GenericByteData, m_block.data());
             return;
         }
 
-        const UniValue &hash = find_value(result, "hash");
-        std::vector<char> bytearray;
-        boost::algorithm::unhex(hash.get_str(), back_inserter(bytearray));
-        builder.add(Admin::BlockChain::BlockHash, bytearray);
-        bytearray.clear();
-        const UniValue &confirmations = find_value(result, "confirmations");
-        builder.add(Admin::BlockChain::Confirmations, confirmations.get_int());
-        const UniValue &size = find_value(result, "size");
-        builder.add(Admin::BlockChain::Size, size.get_int());
-        const UniValue &height = find_value(result, "height");
-        builder.add(Admin::BlockChain::Height, height.get_int());
-        const UniValue &version = find_value(result, "version");
-        builder.add(Admin::BlockChain::Version, version.get_int());
-        const UniValue &merkleroot = find_value(result, "merkleroot");
-        boost::algorithm::unhex(merkleroot.get_str(), back_inserter(bytearray));
-        builder.add(Admin::BlockChain::MerkleRoot, bytearray);
-        bytearray.clear();
-        const UniValue &tx = find_value(result, "tx");
+        LOCK(cs_main);
+        builder.add(Admin::BlockChain::BlockHash, hexBytesFromHash(m_index->GetBlockHash()));
+        builder.add(Admin::BlockChain::Confirmations, chainActive.Contains(m_index)
+                    ? chainActive.Height() - m_index->nHeight + 1 : -1);
+        builder.add(Admin::BlockChain::Size, m_block.size());
+        builder.add(Admin::BlockChain::Height, m_index->nHeight);
+        builder.add(Admin::BlockChain::Version, m_index->nVersion);
+        builder.add(Admin::BlockChain::MerkleRoot, hexBytesFromHash(m_index->hashMerkleRoot));
         bool first = true;
-        for (const UniValue &transaction: tx.getValues()) {
+        for (const Tx &tx : m_block.transactions()) {
             if (first) first = false;
-            else builder.add(Admin::Wallet::Separator, true);
-            boost::algorithm::unhex(transaction.get_str(), back_inserter(bytearray));
-            builder.add(Admin::BlockChain::TxId, bytearray);
-            bytearray.clear();
-        }
-        const UniValue &time = find_value(result, "time");
-        builder.add(Admin::BlockChain::Time, (uint64_t) time.get_int64());
-        const UniValue &mediantime = find_value(result, "mediantime");
-        builder.add(Admin::BlockChain::MedianTime, (uint64_t) mediantime.get_int64());
-        const UniValue &nonce = find_value(result, "nonce");
-        builder.add(Admin::BlockChain::Nonce, (uint64_t) nonce.get_int64());
-        const UniValue &bits = find_value(result, "bits");
-        boost::algorithm::unhex(bits.get_str(), back_inserter(bytearray));
-        builder.add(Admin::BlockChain::Bits, bytearray);
-        bytearray.clear();
-        const UniValue &difficulty = find_value(result, "difficulty");
-        builder.add(Admin::BlockChain::Difficulty, difficulty.get_real());
-        const UniValue &chainwork = find_value(result, "chainwork");
-        boost::algorithm::unhex(chainwork.get_str(), back_inserter(bytearray));
-        builder.add(Admin::BlockChain::ChainWork, bytearray);
-        bytearray.clear();
-        const UniValue &prevhash = find_value(result, "previousblockhash");
-        boost::algorithm::unhex(prevhash.get_str(), back_inserter(bytearray));
-        builder.add(Admin::BlockChain::PrevBlockHash, bytearray);
-        const UniValue &nextblock = find_value(result, "nextblockhash");
-        if (nextblock.isStr()) {
-            boost::algorithm::unhex(nextblock.get_str(), back_inserter(bytearray));
-            builder.add(Admin::BlockChain::NextBlockHash, bytearray);
+            else builder.add(Admin::BlockChain::Separator, true);
+            builder.add(Admin::BlockChain::TxId, hexBytesFromHash(tx.createHash()));
         }
+        builder.add(Admin::BlockChain::Time, (uint64_t) m_index->nTime);
+        builder.add(Admin::BlockChain::MedianTime, (uint64_t) m_index->GetMedianTimePast());
+        builder.add(Admin::BlockChain::Nonce, (uint64_t) m_index->nNonce);
+        std::vector<char> bits; // the 4 bytes of the hex string, most significant first
+        boost::algorithm::unhex(strprintf("%08x", m_index->nBits), back_inserter(bits));
+        builder.add(Admin::BlockChain::Bits, bits);
+        builder.add(Admin::BlockChain::Difficulty, GetDifficulty(m_index));
+        builder.add(Admin::BlockChain::ChainWork, hexBytesFromHash(ArithToUint256(m_index->nChainWork)));
+        if (m_index->pprev)
+            builder.add(Admin::BlockChain::PrevBlockHash, hexBytesFromHash(m_index->pprev->GetBlockHash()));
+        auto next = chainActive.Next(m_index);
+        if (next)
+            builder.add(Admin::BlockChain::NextBlockHash, hexBytesFromHash(next->GetBlockHash()));
     }
 
-private:
+protected:
     bool m_verbose;
+    CBlockIndex *m_index;
+    FastBlock m_block;
+};
+
+class GetRawBlock : public GetBlock
+{
+public:
+    GetRawBlock() : GetBlock(Admin::BlockChain::GetRawBlockReply) {}
+
+    // the reply normally is rawReply(), these are only used should that ever be empty.
+    int calculateMessageSize() const {
+        return m_block.size() + 10;
+    }
+
+    void buildReply(const Message&, Streaming::MessageBuilder &builder) {
+        builder.add(Admin::BlockChain::GenericByteData, m_block.data());
+    }
+
+    Streaming::ConstBuffer rawReply() const {
+        return m_block.data();
+    }
 };
 
 class GetBlockHeader : public AdminRPCBinding::DirectParser
@@ -190,7 +231,8 @@ public:
         builder.add(Admin::BlockChain::Nonce, (uint64_t) index->nNonce);
         builder.add(Admin::BlockChain::Bits, (uint64_t) index->nBits);
         builder.add(Admin::BlockChain::Difficulty, GetDifficulty(index));
-        builder.add(Admin::BlockChain::PrevBlockHash, index->phashBlock);
+        if (index->pprev)
+            builder.add(Admin::BlockChain::PrevBlockHash, index->pprev->GetBlockHash());
         auto next = chainActive.Next(index);
         if (next)
             builder.add(Admin::BlockChain::NextBlockHash, next->GetBlockHash());
@@ -199,6 +241,7 @@ public:
     void buildReply(const Message &request, Streaming::MessageBuilder &builder) {
         Streaming::MessageParser parser(request.body());
 
+        LOCK(cs_main);
         Streaming::ParsedType type = parser.next();
         while (type == Streaming::FoundTag) {
             if (parser.tag() == Admin::BlockChain::BlockHash) {
@@ -225,48 +268,127 @@ public:
     GetBlockCount() : DirectParser(Admin::BlockChain::GetBlockCountReply, 20) {}
 
     void buildReply(const Message&, Streaming::MessageBuilder &builder) {
+        LOCK(cs_main);
         builder.add(Admin::BlockChain::Height, chainActive.Height());
     }
 };
 
+class GetTxOutSetInfo : public AdminRPCBinding::DirectParser
+{
+public:
+    GetTxOutSetInfo() : DirectParser(Admin::BlockChain::GetTxOutSetInfoReply, 150) {}
+
+    void createRequest(const Message&) {
+        LOCK(cs_main);
+        CUtxoCommitment commitment;
+        if (!pcoinsTip->GetCommitment(commitment))
+            FlushStateToDisk(); // without a commitment the database walks the whole set
+        if (!pcoinsTip->GetStats(m_stats))
+            throw std::runtime_error("Failed to read the UTXO set");
+        auto iter = Blocks::indexMap.find(m_stats.hashBlock);
+        m_stats.nHeight = iter == Blocks::indexMap.end() ? -1 : iter->second->nHeight;
+    }
+
+    void buildReply(const Message&, Streaming::MessageBuilder &builder) {
+        builder.add(Admin::BlockChain::Height, m_stats.nHeight);
+        builder.add(Admin::BlockChain::BestBlockHash, m_stats.hashBlock);
+        builder.add(Admin::BlockChain::Transactions, (uint64_t) m_stats.nTransactions);
+        builder.add(Admin::BlockChain::TxOuts, (uint64_t) m_stats.nTransactionOutputs);
+        builder.add(Admin::BlockChain::BytesSerialized, (uint64_t) m_stats.nSerializedSize);
+        builder.add(Admin::BlockChain::HashSerialized, m_stats.hashSerialized);
+        builder.add(Admin::BlockChain::TotalAmount, (uint64_t) m_stats.nTotalAmount);
+    }
+
+private:
+    CCoinsStats m_stats;
+};
+
 // raw transactions
 
-class GetRawTransaction : public AdminRPCBinding::RpcParser
+class GetRawTransaction : public AdminRPCBinding::DirectParser
 {
 public:
-    GetRawTransaction() : RpcParser("getrawtransaction", Admin::RawTransactions::GetRawTransactionReply) {}
+    GetRawTransaction() : DirectParser(Admin::RawTransactions::GetRawTransactionReply) {}
 
-    virtual void createRequest(const Message &message, UniValue &output) {
-        std::string txid;
+    void createRequest(const Message &message) {
+        uint256 txid;
         Streaming::MessageParser parser(message.body());
         while (parser.next() == Streaming::FoundTag) {
             if (parser.tag() == Admin::RawTransactions::TransactionId
                     || parser.tag() == Admin::RawTransactions::GenericByteData)
-                boost::algorithm::hex(parser.bytesData(), back_inserter(txid));
+                txid = hashFromHexBytes(parser.bytesData());
         }
-        output.push_back(std::make_pair("parameter 1", UniValue(UniValue::VSTR, txid)));
+        CTransaction tx;
+        uint256 hashBlock;
+        {
+            LOCK(cs_main);
+            if (!GetTransaction(txid, tx, Params().GetConsensus(), hashBlock, true))
+                throw std::runtime_error("No information available about transaction");
+        }
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << tx;
+        m_rawTx.assign(stream.begin(), stream.end());
     }
 
-    virtual int calculateMessageSize(const UniValue &result) const {
-        return result.get_str().size() / 2 + 20;
+    int calculateMessageSize() const {
+        return m_rawTx.size() + 20;
     }
+
+    void buildReply(const Message&, Streaming::MessageBuilder &builder) {
+        builder.add(Admin::RawTransactions::GenericByteData, m_rawTx);
+    }
+
+private:
+    std::vector<char> m_rawTx;
 };
 
-class SendRawTransaction : public AdminRPCBinding::RpcParser
+class SendRawTransaction : public AdminRPCBinding::DirectParser
 {
 public:
-    SendRawTransaction() : RpcParser("sendrawtransaction", Admin::RawTransactions::SendRawTransactionReply, 10) {}
+    SendRawTransaction() : DirectParser(Admin::RawTransactions::SendRawTransactionReply, 40) {}
 
-    virtual void createRequest(const Message &message, UniValue &output) {
-        std::string tx;
+    void createRequest(const Message &message) {
+        std::vector<char> rawTx;
         Streaming::MessageParser parser(message.body());
         while (parser.next() == Streaming::FoundTag) {
             if (parser.tag() == Admin::RawTransactions::RawTransaction
                     || parser.tag() == Admin::RawTransactions::GenericByteData)
-                boost::algorithm::hex(parser.bytesData(), back_inserter(tx));
+                rawTx = parser.bytesData();
+        }
+        CTransaction tx;
+        try {
+            CDataStream stream(rawTx, SER_NETWORK, PROTOCOL_VERSION);
+            stream >> tx;
+        } catch (const std::exception &) {
+            throw std::runtime_error("TX decode failed");
         }
-        output.push_back(std::make_pair("", UniValue(UniValue::VSTR, tx)));
+        m_txid = tx.GetHash();
+
+        LOCK(cs_main);
+        const CCoins* existingCoins = pcoinsTip->AccessCoins(m_txid);
+        const bool haveChain = existingCoins && existingCoins->nHeight < 1000000000;
+        if (haveChain)
+            throw std::runtime_error("transaction already in block chain");
+        if (!mempool.exists(m_txid)) {
+            CValidationState state;
+            bool missingInputs;
+            if (!AcceptToMemoryPool(mempool, state, tx, false, &missingInputs, false, true)) {
+                if (state.IsInvalid())
+                    throw std::runtime_error(strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason()));
+                if (missingInputs)
+                    throw std::runtime_error("Missing inputs");
+                throw std::runtime_error(state.GetRejectReason());
+            }
+        }
+        RelayTransaction(tx);
+    }
+
+    void buildReply(const Message&, Streaming::MessageBuilder &builder) {
+        builder.add(Admin::RawTransactions::GenericByteData, hexBytesFromHash(m_txid));
     }
+
+private:
+    uint256 m_txid;
 };
 
 struct PrevTransaction {
@@ -400,86 +522,130 @@ public:
 
 // wallet
 
-class ListUnspent : public AdminRPCBinding::RpcParser
+class ListUnspent : public AdminRPCBinding::DirectParser
 {
 public:
-    ListUnspent() : RpcParser("listunspent", Admin::Wallet::ListUnspentReply) {}
-
-    virtual int calculateMessageSize(const UniValue &result) const {
-        return result.size() * 300;
-    }
+    ListUnspent() : DirectParser(Admin::Wallet::ListUnspentReply) {}
 
-    virtual void createRequest(const Message &message, UniValue &output) {
-        std::string txid;
+    void createRequest(const Message &message) {
+#ifdef ENABLE_WALLET
+        if (pwalletMain == nullptr)
+            throw std::runtime_error("Wallet disabled");
         int minConf = -1;
         int maxConf = -1;
-        std::list<std::vector<char>> addresses;
+        std::set<CTxDestination> addresses;
         Streaming::MessageParser parser(message.body());
         while (parser.next() == Streaming::FoundTag) {
             if (parser.tag() == Admin::Wallet::TransactionId
                     || parser.tag() == Admin::Wallet::GenericByteData) {
-                addresses.push_back(parser.bytesData());
+                const std::vector<char> bytes = parser.bytesData();
+                CBitcoinAddress address(std::string(bytes.begin(), bytes.end()));
+                if (!address.IsValid())
+                    throw std::runtime_error("Invalid Bitcoin address");
+                addresses.insert(address.Get());
             }
             else if (parser.tag() == Admin::Wallet::MinimalConfirmations)
-                minConf = boost::get<int>(parser.data());
+                minConf = parser.intData();
             else if (parser.tag() == Admin::Wallet::MaximumConfirmations)
-                maxConf = boost::get<int>(parser.data());
+                maxConf = parser.intData();
         }
-
-        if (!addresses.empty()) { // ensure we have useful min/max conf
-            minConf = std::max(minConf, 0);
-            if (maxConf == -1)
-                maxConf = 1E6;
+        // the defaults the RPC based version used
+        if (minConf == -1)
+            minConf = addresses.empty() ? 1 : 0;
+        if (maxConf == -1)
+            maxConf = addresses.empty() ? 9999999 : 1000000;
+
+        std::vector<COutput> outputs;
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        pwalletMain->AvailableCoins(outputs, false, NULL, true);
+        for (const COutput &out : outputs) {
+            if (out.nDepth < minConf || out.nDepth > maxConf)
+                continue;
+            const CTxOut &txOut = out.tx->vout[out.i];
+            CTxDestination destination;
+            const bool hasDestination = ExtractDestination(txOut.scriptPubKey, destination);
+            if (!addresses.empty() && (!hasDestination || addresses.count(destination) == 0))
+                continue;
+            Unspent item;
+            item.txid = out.tx->GetHash();
+            item.index = out.i;
+            if (hasDestination)
+                item.address = CBitcoinAddress(destination).ToString();
+            item.scriptPubKey.assign(txOut.scriptPubKey.begin(), txOut.scriptPubKey.end());
+            item.amount = txOut.nValue;
+            item.confirmations = out.nDepth;
+            m_unspent.push_back(item);
         }
+#else
+        throw std::runtime_error("Wallet disabled");
+#endif
+    }
 
-        if (minConf != -1)
-            output.push_back(std::make_pair("parameter 1", UniValue(minConf)));
-        if (maxConf != -1)
-            output.push_back(std::make_pair("parameter 2", UniValue(maxConf)));
-
-        UniValue list(UniValue::VOBJ);
-        for (const std::vector<char> &address : addresses) {
-            std::string addressString;
-            boost::algorithm::hex(address, back_inserter(addressString));
-            list.push_back(UniValue(UniValue::VSTR, addressString));
+    int calculateMessageSize() const {
+        int size = 0;
+        for (const Unspent &item : m_unspent) {
+            size += item.address.size() + item.scriptPubKey.size() + 80;
         }
-        if (list.size() > 0)
-            output.push_back(std::make_pair("addresses", list));
+        return size + 10;
     }
 
-    virtual void buildReply(Streaming::MessageBuilder &builder, const UniValue &result) {
+    void buildReply(const Message&, Streaming::MessageBuilder &builder) {
         bool first = true;
-        for (const UniValue &item : result.getValues()) {
+        for (const Unspent &item : m_unspent) {
             if (first) first = false;
             else builder.add(Admin::Wallet::Separator, true);
-            const UniValue &txid = find_value(item, "txid");
-            std::vector<char> bytearray;
-            boost::algorithm::unhex(txid.get_str(), back_inserter(bytearray));
-            builder.add(Admin::Wallet::TransactionId, bytearray);
-            bytearray.clear();
-            const UniValue &vout = find_value(item, "vout");
-            builder.add(Admin::Wallet::TXOutputIndex, vout.get_int());
-            const UniValue &address = find_value(item, "address");
-            builder.add(Admin::Wallet::BitcoinAddress, address.get_str());
-            const UniValue &scriptPubKey = find_value(item, "scriptPubKey");
-            boost::algorithm::unhex(scriptPubKey.get_str(), back_inserter(bytearray));
-            builder.add(Admin::Wallet::ScriptPubKey, bytearray);
-            bytearray.clear();
-            const UniValue &amount = find_value(item, "amount");
-            builder.add(Admin::Wallet::Amount, (uint64_t) AmountFromValue(amount));
-            const UniValue &confirmations = find_value(item, "confirmations");
-            builder.add(Admin::Wallet::ConfirmationCount, confirmations.get_int());
+            builder.add(Admin::Wallet::TransactionId, hexBytesFromHash(item.txid));
+            builder.add(Admin::Wallet::TXOutputIndex, item.index);
+            if (!item.address.empty())
+                builder.add(Admin::Wallet::BitcoinAddress, item.address);
+            builder.add(Admin::Wallet::ScriptPubKey, item.scriptPubKey);
+            builder.add(Admin::Wallet::Amount, (uint64_t) item.amount);
+            builder.add(Admin::Wallet::ConfirmationCount, item.confirmations);
         }
     }
+
+private:
+    struct Unspent {
+        uint256 txid;
+        int index;
+        std::string address;
+        std::vector<char> scriptPubKey;
+        CAmount amount;
+        int confirmations;
+    };
+    std::vector<Unspent> m_unspent;
 };
 
-class GetNewAddress : public AdminRPCBinding::RpcParser
+class GetNewAddress : public AdminRPCBinding::DirectParser
 {
 public:
-    GetNewAddress() : RpcParser("getnewaddress", Admin::Wallet::GetNewAddressReply, 50) {}
-    virtual void buildReply(Streaming::MessageBuilder &builder, const UniValue &result) {
-        builder.add(Admin::Wallet::BitcoinAddress, result.get_str());
+    GetNewAddress() : DirectParser(Admin::Wallet::GetNewAddressReply, 50) {}
+
+    void createRequest(const Message&) {
+#ifdef ENABLE_WALLET
+        if (pwalletMain == nullptr)
+            throw std::runtime_error("Wallet disabled");
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        if (!pwalletMain->IsLocked())
+            pwalletMain->TopUpKeyPool();
+
+        CPubKey newKey;
+        if (!pwalletMain->GetKeyFromPool(newKey))
+            throw std::runtime_error("Error: Keypool ran out, please call keypoolrefill first");
+        CKeyID keyID = newKey.GetID();
+        pwalletMain->SetAddressBook(keyID, std::string(), "receive");
+        m_address = CBitcoinAddress(keyID).ToString();
+#else
+        throw std::runtime_error("Wallet disabled");
+#endif
+    }
+
+    void buildReply(const Message&, Streaming::MessageBuilder &builder) {
+        builder.add(Admin::Wallet::BitcoinAddress, m_address);
     }
+
+private:
+    std::string m_address;
 };
 
 // Util
@@ -545,6 +711,10 @@ AdminRPCBinding::Parser *AdminRPCBinding::createParser(const Message &message)
             return new GetBlockHeader();
         case Admin::BlockChain::GetBlockCount:
             return new GetBlockCount();
+        case Admin::BlockChain::GetTxOutSetInfo:
+            return new GetTxOutSetInfo();
+        case Admin::BlockChain::GetRawBlock:
+            return new GetRawBlock();
         }
         break;
     case Admin::ControlService:
@@ -618,3 +788,12 @@ AdminRPCBinding::DirectParser::DirectParser(int replyMessageId, int messageSize)
     : Parser(IncludesHandler, replyMessageId, messageSize)
 {
 }
+
+void AdminRPCBinding::DirectParser::createRequest(const Message &)
+{
+}
+
+Streaming::ConstBuffer AdminRPCBinding::DirectParser::rawReply() const
+{
+    return Streaming::ConstBuffer();
+}
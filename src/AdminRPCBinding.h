@@ -24,6 +24,7 @@
 
 namespace Streaming {
     class MessageBuilder;
+    class ConstBuffer;
 }
 class UniValue;
 class Message;
@@ -113,13 +114,23 @@ namespace AdminRPCBinding
 
     /**
      * When a new request comes in from the network, the specific parser that can handle this
-     * is instantiated and then buildReply() is called with the message we received from the network,
-     * expecting a reply to be created to be send back to the caller.
+     * is instantiated and then createRequest() is called with the message we received from the network,
+     * followed by calculateMessageSize() and buildReply() which is expected to create the reply to be
+     * send back to the caller.
+     *
+     * Any of these methods may throw a std::exception to make the server reply with a CommandFailed message.
      */
     class DirectParser : public Parser {
     public:
         DirectParser(int replyMessageId, int messageSize = -1);
 
+        /**
+         * @brief createRequest parses the incoming \a message and fetches the data needed for the reply.
+         * Subclasses that have a variable sized reply can store their data here so calculateMessageSize()
+         * can base the size on it.
+         */
+        virtual void createRequest(const Message &message);
+
         /// Return the size we shall reserve for the message to be created in buildReply.
         /// This size CAN NOT be smaller than what is actually consumed in buildReply.
         virtual int calculateMessageSize() const { return m_messageSize; }
@@ -128,6 +139,12 @@ namespace AdminRPCBinding
          * @brief The buildReply method takes the request and builds the reply to be sent over the network.
          */
         virtual void buildReply(const Message &request, Streaming::MessageBuilder &builder) = 0;
+
+        /**
+         * Parsers that already hold the reply data in a buffer can return it here, it will then be
+         * sent as the body of the reply without copying and buildReply() will not be called.
+         */
+        virtual Streaming::ConstBuffer rawReply() const;
     };
 
     /// maps an input message to a Parser implementation.
@@ -252,14 +252,34 @@ void Admin::Server::Connection::incomingMessage(const Message &message)
     }
     auto *directParser = dynamic_cast<AdminRPCBinding::DirectParser*>(parser.get());
     if (directParser) {
-        m_bufferPool.reserve(directParser->calculateMessageSize());
-        Streaming::MessageBuilder builder(m_bufferPool);
-        directParser->buildReply(message, builder);
-        Message reply = builder.message(message.serviceId(), directParser->replyMessageId());
+        try {
+            directParser->createRequest(message);
+        } catch (const std::exception &e) {
+            sendFailedMessage(message, std::string(e.what()));
+            return;
+        }
         const int requestId = message.headerInt(Admin::RequestId);
-        if (requestId != -1)
-            reply.setHeaderInt(Admin::RequestId, requestId);
-        m_connection.send(reply);
+        Streaming::ConstBuffer rawReply = directParser->rawReply();
+        if (rawReply.isValid()) {
+            Message reply(rawReply, message.serviceId(), directParser->replyMessageId());
+            if (requestId != -1)
+                reply.setHeaderInt(Admin::RequestId, requestId);
+            m_connection.send(reply);
+            return;
+        }
+        try {
+            m_bufferPool.reserve(directParser->calculateMessageSize());
+            Streaming::MessageBuilder builder(m_bufferPool);
+            directParser->buildReply(message, builder);
+            Message reply = builder.message(message.serviceId(), directParser->replyMessageId());
+            if (requestId != -1)
+                reply.setHeaderInt(Admin::RequestId, requestId);
+            m_connection.send(reply);
+        } catch (const std::exception &e) {
+            LogPrintf("AdminServer internal error in building reply for %d/%d: %s\n", message.serviceId(), message.messageId(), e.what());
+            (void) m_bufferPool.commit(); // make sure the partial message is discarded
+            sendFailedMessage(message, std::string(e.what()));
+        }
     }
 }
 
@@ -30,6 +30,10 @@
 #include "main.h"
 #include "uint256.h"
 #include <boost/thread.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <blockchain/Block.h>
@@ -165,6 +169,219 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     return nLoaded > 0;
 }
 
+/**
+ * Runs \a job for each of the numbers 0 to count on the Application threadpool,
+ * returns only after all jobs are done.
+ * Keep the jobs short, other users of the threadpool wait for them.
+ * An interruption of the calling thread skips the jobs that didn't start yet and throws
+ * boost::thread_interrupted once the running ones are done.
+ */
+template<typename F>
+void runParallel(int count, F job)
+{
+    if (count <= 0)
+        return;
+    std::mutex mutex;
+    std::condition_variable waiter;
+    int jobsLeft = count;
+    std::atomic<bool> aborted(false);
+    for (int i = 0; i < count; ++i) {
+        Application::instance()->ioService().post([&, i]() {
+            if (!aborted)
+                job(i);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--jobsLeft == 0)
+                waiter.notify_all();
+        });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    while (jobsLeft > 0) {
+        waiter.wait_for(lock, std::chrono::milliseconds(100));
+        if (boost::this_thread::interruption_requested())
+            aborted = true;
+    }
+    lock.unlock();
+    boost::this_thread::interruption_point();
+}
+
+struct ReindexBlock {
+    ReindexBlock(int file, int pos) : pos(file, pos) {}
+    CDiskBlockPos pos;
+    uint256 hash;
+    FastBlock block;
+    std::string error;
+};
+
+/**
+ * The reindex of our own block files. Contrary to LoadExternalBlockFile this memory-maps the file
+ * and does all the parsing and hashing in parallel, only the validation is serial.
+ */
+class BlockFileReindexer
+{
+    /// the serialized size of the blocks parsed at a time
+    static const int BatchBytes = 32 * 1000 * 1000;
+    /// the number of bytes a single job on the threadpool scans or parses
+    static const int ScanChunkSize = 1000 * 1000;
+
+public:
+    BlockFileReindexer(const CChainParams& chainparams)
+        : m_chainparams(chainparams),
+          m_threadCount(std::max(1, GetNumCores())),
+          m_loaded(0)
+    {
+    }
+
+    void reindexFile(int fileIndex)
+    {
+        int64_t start = GetTimeMillis();
+        const Streaming::ConstBuffer file = Blocks::DB::instance()->loadBlockFile(fileIndex);
+        if (!file.isValid())
+            return;
+
+        // stage one, locate the magic and size of each block.
+        const int chunkCount = std::max(m_threadCount, file.size() / ScanChunkSize);
+        std::vector<std::vector<int> > chunkCandidates(chunkCount);
+        const int chunkSize = (file.size() + chunkCount - 1) / chunkCount;
+        runParallel(chunkCount, [&](int chunk) {
+            const char *magic = reinterpret_cast<const char*>(m_chainparams.MessageStart());
+            const int end = std::min(file.size(), (chunk + 1) * chunkSize);
+            for (int pos = chunk * chunkSize; pos < end; ++pos) {
+                pos = std::find(file.begin() + pos, file.begin() + end, magic[0]) - file.begin();
+                if (pos >= end || pos + 8 > file.size())
+                    break;
+                if (memcmp(file.begin() + pos, magic, MESSAGE_START_SIZE) != 0)
+                    continue;
+                const uint32_t blockSize = le32toh(*((uint32_t*)(file.begin() + pos + MESSAGE_START_SIZE)));
+                if (blockSize >= 80 && blockSize <= (uint32_t) file.size() - pos - 8)
+                    chunkCandidates[chunk].push_back(pos);
+            }
+        });
+        std::vector<int> candidates; // in file order
+        for (const auto &list : chunkCandidates) {
+            candidates.insert(candidates.end(), list.begin(), list.end());
+        }
+
+        // stage two, parse and hash batches of blocks in parallel and feed them to validation in order.
+        // A batch is limited in bytes, as the parsed blocks are all held in memory.
+        // A magic that is located inside of a block is just data, those are skipped. Only a block
+        // that parses claims its bytes though, after a false match we continue at the next magic.
+        size_t next = 0; // the first candidate not handled yet
+        int endOfPrevBlock = 0;
+        while (next < candidates.size()) {
+            boost::this_thread::interruption_point();
+            std::vector<ReindexBlock> batch;
+            std::vector<size_t> batchCandidates; // the index in candidates of each block in batch
+            std::vector<int> sizes;
+            int batchBytes = 0;
+            int batchEnd = endOfPrevBlock;
+            for (size_t i = next; i < candidates.size(); ++i) {
+                const int pos = candidates[i];
+                if (pos < batchEnd)
+                    continue;
+                const int blockSize = le32toh(*((uint32_t*)(file.begin() + pos + MESSAGE_START_SIZE)));
+                if (!batch.empty() && batchBytes + blockSize > BatchBytes)
+                    break;
+                batch.push_back(ReindexBlock(fileIndex, pos + 8));
+                batchCandidates.push_back(i);
+                sizes.push_back(blockSize);
+                batchBytes += blockSize;
+                batchEnd = pos + 8 + blockSize;
+            }
+            if (batch.empty())
+                break;
+            // jobs of about a ScanChunkSize worth of blocks each.
+            const int jobCount = std::min<int>(batch.size(), std::max(m_threadCount, batchBytes / ScanChunkSize));
+            runParallel(jobCount, [&](int job) {
+                for (size_t i = job; i < batch.size(); i += jobCount) {
+                    try {
+                        FastBlock fb(file.mid(batch[i].pos.nPos, sizes[i]));
+                        fb.findTransactions();
+                        batch[i].hash = fb.createHash();
+                        batch[i].block = fb;
+                    } catch (const std::exception &e) {
+                        batch[i].error = e.what();
+                    }
+                }
+            });
+            next = batchCandidates.back() + 1;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                ReindexBlock &item = batch[i];
+                if (!item.error.empty()) {
+                    LogPrintf("%s: Deserialize error - %s at %s\n", __func__, item.error, item.pos.ToString());
+                    // resync at the byte after this magic, the blocks after it in this batch may
+                    // have been wrongly skipped and get selected again.
+                    next = batchCandidates[i] + 1;
+                    break;
+                }
+                if (!process(item.block, item.hash, item.pos))
+                    return;
+                endOfPrevBlock = item.pos.nPos + sizes[i];
+            }
+        }
+        if (m_loaded > 0)
+            LogPrintf("Loaded %i blocks from blk%05u.dat in %dms\n", m_loaded, fileIndex, GetTimeMillis() - start);
+        m_loaded = 0;
+    }
+
+private:
+    // returns false on a fatal error
+    bool process(const FastBlock &block, const uint256 &hash, CDiskBlockPos pos)
+    {
+        // detect out of order blocks, and store them for later
+        const uint256 prevHash = block.previousBlockId();
+        if (hash != m_chainparams.GetConsensus().hashGenesisBlock && Blocks::indexMap.find(prevHash) == Blocks::indexMap.end()) {
+            LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                    prevHash.ToString());
+            m_blocksUnknownParent.insert(std::make_pair(prevHash, pos));
+            return true;
+        }
+
+        // process in case the block isn't known yet
+        if (Blocks::indexMap.count(hash) == 0 || (Blocks::indexMap[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+            CValidationState state;
+            if (ProcessNewBlock(state, m_chainparams, NULL, block, true, &pos))
+                m_loaded++;
+            if (state.IsError())
+                return false;
+        }
+
+        // Recursively process earlier encountered successors of this block
+        std::deque<uint256> queue;
+        queue.push_back(hash);
+        while (!queue.empty()) {
+            uint256 head = queue.front();
+            queue.pop_front();
+            auto range = m_blocksUnknownParent.equal_range(head);
+            while (range.first != range.second) {
+                auto it = range.first;
+                try {
+                    FastBlock child = Blocks::DB::instance()->loadBlock(it->second);
+                    child.findTransactions();
+                    const uint256 childHash = child.createHash();
+                    LogPrintf("%s: Processing out of order child %s of %s\n", __func__, childHash.ToString(),
+                            head.ToString());
+                    CValidationState dummy;
+                    if (ProcessNewBlock(dummy, m_chainparams, NULL, child, true, &it->second)) {
+                        m_loaded++;
+                        queue.push_back(childHash);
+                    }
+                } catch (const std::exception &e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                }
+                range.first++;
+                m_blocksUnknownParent.erase(it);
+            }
+        }
+        return true;
+    }
+
+    const CChainParams &m_chainparams;
+    const int m_threadCount;
+    int m_loaded;
+    // disk positions for blocks with unknown parent
+    std::multimap<uint256, CDiskBlockPos> m_blocksUnknownParent;
+};
+
 struct CImportingNow
 {
     CImportingNow() {
@@ -186,16 +403,13 @@ void reimportBlockFiles(std::vector<boost::filesystem::path> vImportFiles)
 
     if (fReindex) {
         CImportingNow imp;
+        BlockFileReindexer reindexer(chainparams);
         int nFile = 0;
         while (!ShutdownRequested()) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(Blocks::getFilepathForIndex(pos.nFile, "blk", true)))
+            if (!boost::filesystem::exists(Blocks::getFilepathForIndex(nFile, "blk", true)))
                 break; // No block files left to reindex
-            FILE *file = Blocks::openFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
             LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
+            reindexer.reindexFile(nFile);
             nFile++;
         }
         Blocks::DB::instance()->setIsReindexing(false);
@@ -463,7 +677,7 @@ Streaming::ConstBuffer Blocks::DB::loadBlockFile(int fileIndex)
         auto buf = d->mapFile(fileIndex, ForwardBlock, &fileSize);
         if (buf.get() == nullptr)
             return Streaming::ConstBuffer(); // got pruned
-        return Streaming::ConstBuffer(buf, buf.get(), buf.get() + fileSize - 1);
+        return Streaming::ConstBuffer(buf, buf.get(), buf.get() + fileSize);
     } catch (const std::ios_base::failure &ex) {
         return Streaming::ConstBuffer(); // file missing.
     }
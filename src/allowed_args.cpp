@@ -13,6 +13,7 @@
 #include "net.h"
 #include "policy/policy.h"
 #include "script/sigcache.h"
+#include "thinblock.h"
 #include "tinyformat.h"
 #include "torcontrol.h"
 #include "BlocksDB.h"
@@ -232,6 +233,7 @@ static void addGeneralOptions(AllowedArgs& allowedArgs, HelpMessageMode mode)
     allowedArgs
         .addArg("dbcache=<n>", requiredInt, strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache))
         .addArg("loadblock=<file>", requiredStr, _("Imports blocks from external blk000??.dat file on startup"))
+        .addArg("loadutxosnapshot=<file>", requiredStr, _("Fill an empty chain state from a snapshot made by dumputxosnapshot on startup. The block index needs to contain the block of the snapshot already, which means copying the blocks directory of the node that made it. Downloading the headers first is not supported"))
         .addArg("maxorphantx=<n>", requiredInt, strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS))
         .addArg("maxmempool=<n>", requiredInt, strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE))
         .addArg("mempoolexpiry=<n>", requiredInt, strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY))
@@ -406,9 +408,11 @@ static void addNodeRelayOptions(AllowedArgs& allowedArgs)
         .addArg("expeditedblock=<host>", requiredStr, _("Request expedited blocks from this host whenever we are connected to it"))
         .addArg("maxexpeditedblockrecipients=<n>", requiredInt, _("The maximum number of nodes this node will forward expedited blocks to"))
         .addArg("maxexpeditedtxrecipients=<n>", requiredInt, _("The maximum number of nodes this node will forward expedited transactions to"))
+        .addArg("parallelrelay", optionalBool, strprintf(_("Forward new blocks to expedited peers, and announce them to thin block peers, once their header, proof of work and merkle root are checked, while they are being connected (default: %u)"), DEFAULT_PARALLEL_RELAY))
         .addArg("minrelaytxfee=<amt>", requiredAmount, strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
             CURRENCY_UNIT, FormatMoney(DEFAULT_MIN_RELAY_TX_FEE)))
         .addArg("use-thinblocks", optionalBool, _("Enable thin blocks to speed up the relay of blocks (default: true)"))
+        .addArg("xthinshortidbytes=<n>", requiredInt, strprintf(_("The width in bytes, 6 or 8, of the salted short transaction ids in the thin blocks we send (default: %u)"), DEFAULT_XTHIN_SHORTID_BYTES))
         ;
 }
 
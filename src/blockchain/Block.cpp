@@ -53,29 +53,6 @@ uint64_t readCompactSize(const Streaming::ConstBuffer &buf, size_t &posInStream)
     posInStream += 9;
     return le64toh(*((uint64_t*)(buf.begin() + posInStream - 8)));
 }
-
-// from data, tell me how large a transaction is.
-int transactionSize(const Streaming::ConstBuffer &buf, const int pos) {
-    size_t positionInStream = pos + 4;
-    uint64_t inCount = readCompactSize(buf, positionInStream);
-    for (uint64_t i = 0; i < inCount; ++i) {
-        positionInStream += 32 + 4;
-        uint64_t scriptLength = readCompactSize(buf, positionInStream);
-        positionInStream += scriptLength + 4;
-        if (positionInStream > (size_t) buf.size() + pos)
-            throw std::runtime_error("transaction malformed error");
-    }
-    uint64_t outCount = readCompactSize(buf, positionInStream);
-    for (uint64_t i = 0; i < outCount; ++i) {
-        positionInStream += 8;
-        uint64_t scriptLength = readCompactSize(buf, positionInStream);
-        positionInStream += scriptLength;
-        if (positionInStream > (size_t) buf.size() + pos)
-            throw std::runtime_error("transaction malformed error");
-    }
-    positionInStream += 4;
-    return positionInStream - pos;
-}
 }
 
 FastBlock::FastBlock()
@@ -143,9 +120,9 @@ void FastBlock::findTransactions()
     std::vector<Tx> txs;
     txs.reserve(transactionCount);
     for (int i = 0; i < transactionCount; ++i) {
-        int txSize = transactionSize(m_data, pos);
-        if (txSize + pos > (uint64_t) m_data.size())
-            throw std::runtime_error("FastBlock::findTransactions: not enough bytes");
+        Tx::Iterator iter(*this, pos);
+        while (iter.next() != Tx::End);
+        const int txSize = iter.consumed();
         txs.push_back(Tx(m_data.mid(pos, txSize)));
         pos += txSize;
     }
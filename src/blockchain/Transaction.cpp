@@ -16,17 +16,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "Transaction.h"
+#include "Block.h"
 #include <primitives/transaction.h>
 
 #include <compat/endian.h>
 
+#include <cassert>
+
 #include <hash.h>
 #include <streams.h>
 
-namespace {
-
-}
-
 Tx::Tx(const Streaming::ConstBuffer &rawTransaction)
     : m_data(rawTransaction)
 {
@@ -55,3 +54,139 @@ CTransaction Tx::createOldTransaction() const
     answer.Unserialize(buf, 0, 0);
     return std::move(answer);
 }
+
+
+Tx::Iterator::Iterator(const Tx &tx)
+    : m_data(tx.m_data),
+    m_start(0),
+    m_position(0),
+    m_dataStart(0),
+    m_dataLength(0),
+    m_inputsLeft(0),
+    m_outputsLeft(0),
+    m_tag(static_cast<Component>(0))
+{
+}
+
+Tx::Iterator::Iterator(const FastBlock &block, int offsetInBlock)
+    : m_data(block.data()),
+    m_start(offsetInBlock),
+    m_position(offsetInBlock),
+    m_dataStart(offsetInBlock),
+    m_dataLength(0),
+    m_inputsLeft(0),
+    m_outputsLeft(0),
+    m_tag(static_cast<Component>(0))
+{
+}
+
+Tx::Component Tx::Iterator::next()
+{
+    switch (m_tag) {
+    case End:
+        return End;
+    case TxVersion:
+        m_inputsLeft = readCompactSize();
+        // fall through
+    case Sequence:
+        if (m_inputsLeft > 0) {
+            --m_inputsLeft;
+            setComponent(PrevTxHash, 32);
+            break;
+        }
+        m_outputsLeft = readCompactSize();
+        // fall through
+    case OutputScript:
+        if (m_outputsLeft > 0) {
+            --m_outputsLeft;
+            setComponent(OutputValue, 8);
+        } else {
+            setComponent(LockTime, 4);
+        }
+        break;
+    case PrevTxHash:
+        setComponent(PrevTxIndex, 4);
+        break;
+    case PrevTxIndex:
+        setComponent(TxInScript, readCompactSize());
+        break;
+    case TxInScript:
+        setComponent(Sequence, 4);
+        break;
+    case OutputValue:
+        setComponent(OutputScript, readCompactSize());
+        break;
+    case LockTime:
+        m_tag = End;
+        m_dataStart = m_position;
+        m_dataLength = 0;
+        break;
+    default: // not started yet
+        setComponent(TxVersion, 4);
+        break;
+    }
+    return m_tag;
+}
+
+Streaming::ConstBuffer Tx::Iterator::byteData() const
+{
+    return m_data.mid(m_dataStart, m_dataLength);
+}
+
+uint32_t Tx::Iterator::uintData() const
+{
+    assert(m_dataLength == 4);
+    return le32toh(*((uint32_t*)(m_data.begin() + m_dataStart)));
+}
+
+uint64_t Tx::Iterator::longData() const
+{
+    assert(m_dataLength == 8);
+    return le64toh(*((uint64_t*)(m_data.begin() + m_dataStart)));
+}
+
+uint256 Tx::Iterator::uint256Data() const
+{
+    assert(m_dataLength == 32);
+    return uint256(m_data.begin() + m_dataStart);
+}
+
+void Tx::Iterator::setComponent(Tx::Component tag, uint64_t length)
+{
+    if (length > static_cast<uint64_t>(m_data.size() - m_position))
+        throw std::runtime_error("transaction malformed error");
+    m_tag = tag;
+    m_dataStart = m_position;
+    m_dataLength = static_cast<int>(length);
+    m_position += m_dataLength;
+}
+
+uint64_t Tx::Iterator::readCompactSize()
+{
+    const int available = m_data.size() - m_position;
+    if (available < 1)
+        throw std::runtime_error("readCompactSize not enough bytes");
+    const char *data = m_data.begin() + m_position;
+    const unsigned char byte = static_cast<unsigned char>(data[0]);
+    if (byte < 253) {
+        ++m_position;
+        return byte;
+    }
+    if (byte == 253) { // next 2 bytes
+        if (available < 3)
+            throw std::runtime_error("readCompactSize not enough bytes");
+        m_position += 3;
+        return le16toh(*((uint16_t*)(data + 1)));
+    }
+    if (byte == 254) { // next 4 bytes
+        if (available < 5)
+            throw std::runtime_error("readCompactSize not enough bytes");
+        m_position += 5;
+        return le32toh(*((uint32_t*)(data + 1)));
+    }
+    // next 8 bytes
+    if (available < 9)
+        throw std::runtime_error("readCompactSize not enough bytes");
+    m_position += 9;
+    return le64toh(*((uint64_t*)(data + 1)));
+}
@@ -25,6 +25,7 @@
 #include <uint256.h>
 
 class CTransaction;
+class FastBlock;
 
 /**
  * @brief The Tx class is a Bitcoin transaction in canonical form.
@@ -35,6 +36,83 @@ class CTransaction;
 class Tx
 {
 public:
+    enum Component {
+        TxVersion = 1,
+        PrevTxHash = 2,
+        PrevTxIndex = 4,
+        TxInScript = 8,
+        Sequence = 0x10,
+        OutputValue = 0x20,
+        OutputScript = 0x40,
+        LockTime = 0x80,
+        End = 0x100
+    };
+
+    /**
+     * @brief The Iterator class allows one to walk over the parts of a transaction without copying.
+     * Each call to next() moves the iterator to the next part of the transaction and returns
+     * its type. The data of that part can then be read using one of the data methods, where
+     * byteData() returns a slice of the original buffer which keeps the underlying memory alive.
+     *
+     * Malformed transactions make next() throw a std::runtime_error.
+     *
+     * @code
+        Tx::Iterator iter(tx);
+        while (iter.next() != Tx::End) {
+            if (iter.tag() == Tx::OutputValue)
+                total += iter.longData();
+        }
+       @endcode
+     */
+    class Iterator {
+    public:
+        Iterator(const Tx &tx);
+        /// Iterate over a transaction that starts at byte \a offsetInBlock in the \a block.
+        Iterator(const FastBlock &block, int offsetInBlock);
+
+        /// move to the next component and return its type.
+        Component next();
+        /// return the type of the component we are pointing to.
+        inline Component tag() const {
+            return m_tag;
+        }
+
+        /// return the data of the current component as a slice of the transaction buffer.
+        Streaming::ConstBuffer byteData() const;
+        /// the amount of bytes the current component uses.
+        inline int dataLength() const {
+            return m_dataLength;
+        }
+        /// return the 32 bits integer value, valid for TxVersion, PrevTxIndex, Sequence and LockTime.
+        uint32_t uintData() const;
+        /// return the 32 bits signed integer value, valid for TxVersion.
+        inline int32_t intData() const {
+            return static_cast<int32_t>(uintData());
+        }
+        /// return the 64 bits value, valid for OutputValue.
+        uint64_t longData() const;
+        /// return the hash, valid for PrevTxHash.
+        uint256 uint256Data() const;
+
+        /// return the amount of bytes of the transaction parsed, up-including the current component.
+        inline int consumed() const {
+            return m_dataStart + m_dataLength - m_start;
+        }
+
+    private:
+        void setComponent(Component tag, uint64_t length);
+        uint64_t readCompactSize();
+
+        Streaming::ConstBuffer m_data;
+        const int m_start;
+        int m_position;
+        int m_dataStart;
+        int m_dataLength;
+        uint64_t m_inputsLeft;
+        uint64_t m_outputsLeft;
+        Component m_tag;
+    };
+
     /// creates invalid transaction.
     Tx();
 
@@ -1,4 +1,5 @@
 // Copyright (c) 2012-2015 The Bitcoin Core developers
+// Copyright (c) 2017 Tom Zander <tomz@freedommail.ch>
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -6,6 +7,9 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <deque>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -16,7 +20,7 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,13 +29,37 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker (and the master) owns a deque of checks. The master spreads
+  * new checks over those deques and each worker takes work from its own
+  * deque first. A worker that runs out steals half of the deque of another
+  * worker. Each deque has its own mutex which is only contended while
+  * stealing, the shared state is kept in atomics and the condition variables
+  * are only used to let threads sleep when there is no work at all.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
+    struct WorkerQueue {
+        WorkerQueue() : size(0) {}
+        boost::mutex mutex;
+        std::deque<T> checks;
+        //! Copy of checks.size(), allows thieves to skip empty queues without locking.
+        std::atomic<unsigned int> size;
+    };
+
+    //! One queue per worker, index zero is owned by the master.
+    std::vector<WorkerQueue> queues;
+
+    //! The number of queues that have an owner (including the master).
+    std::atomic<unsigned int> nQueues;
+
+    //! The queue the next call to Add() starts distributing at.
+    unsigned int nNextQueue;
+
+    //! Protects the sleeping of threads, not used while there is work.
+    boost::mutex sleepMutex;
 
     //! Worker threads block on this when out of work
     boost::condition_variable condWorker;
@@ -39,96 +67,128 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of workers that are sleeping on condWorker.
+    std::atomic<int> nIdle;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
      * worker's own batches.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! Number of verifications that are still in one of the queues.
+    std::atomic<unsigned int> nQueued;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! Move up to \a nMax checks from \a queue into \a vChecks, taking from the back for the owner, the front otherwise.
+    unsigned int Take(WorkerQueue &queue, std::vector<T> &vChecks, bool fOwner, unsigned int nMax)
+    {
+        if (queue.size.load(std::memory_order_relaxed) == 0)
+            return 0;
+        boost::unique_lock<boost::mutex> lock(queue.mutex);
+        const unsigned int nAvailable = queue.checks.size();
+        // Owners keep half for thieves, thieves take half of what is left.
+        const unsigned int nNow = std::min(nMax, std::max(1U, nAvailable / 2));
+        if (nAvailable == 0)
+            return 0;
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            if (fOwner) {
+                vChecks[i].swap(queue.checks.back());
+                queue.checks.pop_back();
+            } else {
+                vChecks[i].swap(queue.checks.front());
+                queue.checks.pop_front();
+            }
+        }
+        queue.size.store(queue.checks.size(), std::memory_order_relaxed);
+        nQueued -= nNow;
+        return nNow;
+    }
+
+    //! Find work, first in our own queue and then in the others.
+    unsigned int FindWork(unsigned int nSelf, std::vector<T> &vChecks)
+    {
+        unsigned int nNow = Take(queues[nSelf], vChecks, true, nBatchSize);
+        if (nNow)
+            return nNow;
+        const unsigned int nCount = nQueues;
+        for (unsigned int i = 1; i < nCount; ++i) {
+            nNow = Take(queues[(nSelf + i) % nCount], vChecks, false, nBatchSize);
+            if (nNow)
+                return nNow;
+        }
+        return 0;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        unsigned int nSelf = 0;
+        if (!fMaster) {
+            // register as a worker, threads above the amount of queues we have share the last one.
+            nSelf = nQueues;
+            while (nSelf < queues.size() && !nQueues.compare_exchange_weak(nSelf, nSelf + 1));
+            nSelf = std::min<unsigned int>(nSelf, queues.size() - 1);
+        }
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
+            const unsigned int nNow = FindWork(nSelf, vChecks);
+            if (nNow) {
+                // execute work, but skip it if someone already found a failure.
+                bool fOk = fAllOk;
+                BOOST_FOREACH (T& check, vChecks) {
+                    if (fOk)
+                        fOk = check();
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+                vChecks.clear();
+                if (!fOk)
+                    fAllOk = false;
+                if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(sleepMutex);
+                    condMaster.notify_one();
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(sleepMutex);
+            if (fMaster) {
+                while (nQueued == 0 && nTodo != 0)
+                    condMaster.wait(lock);
+                if (nTodo == 0) {
+                    // reset the status for new work later and return the current status
+                    return fAllOk.exchange(true);
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+            } else {
+                ++nIdle;
+                while (nQueued == 0)
+                    condWorker.wait(lock);
+                --nIdle;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn, unsigned int nMaxWorkers = 128)
+        : queues(std::max(2U, nMaxWorkers)),
+          nQueues(1),
+          nNextQueue(0),
+          nIdle(0),
+          fAllOk(true),
+          nTodo(0),
+          nQueued(0),
+          nBatchSize(nBatchSizeIn)
+    {
+    }
 
     //! Worker thread
     void Thread()
@@ -145,16 +205,34 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        nQueued += vChecks.size();
+
+        // Spread the checks in consecutive slices over the queues.
+        const unsigned int nCount = nQueues;
+        const unsigned int nSlices = std::min<unsigned int>(nCount, vChecks.size());
+        const unsigned int nSliceSize = (vChecks.size() + nSlices - 1) / nSlices;
+        typename std::vector<T>::iterator iter = vChecks.begin();
+        while (iter != vChecks.end()) {
+            WorkerQueue &queue = queues[nNextQueue++ % nCount];
+            const unsigned int nNow = std::min<unsigned int>(nSliceSize, vChecks.end() - iter);
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            for (unsigned int i = 0; i < nNow; ++i, ++iter) {
+                queue.checks.push_back(T());
+                iter->swap(queue.checks.back());
+            }
+            queue.size.store(queue.checks.size(), std::memory_order_relaxed);
+        }
+
+        if (nIdle > 0) {
+            boost::unique_lock<boost::mutex> lock(sleepMutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+        }
     }
 
     ~CCheckQueue()
@@ -163,13 +241,12 @@ public:
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return nTodo == 0 && fAllOk == true;
     }
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -1,11 +1,17 @@
 // Copyright (c) 2012-2015 The Bitcoin Core developers
+// Copyright (c) 2017 Tom Zander <tomz@freedommail.ch>
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
 
+#include "Logger.h"
 #include "memusage.h"
 #include "random.h"
+#include "streams.h"
+#include "utiltime.h"
+
+#include <boost/bind.hpp>
 
 /**
  * calculate number of bytes for the bitmask, and its number of non-zero bytes
@@ -39,11 +45,91 @@ bool CCoins::Spend(uint32_t nPos)
     return true;
 }
 
+void CUtxoCommitment::AddOutputs(const uint256 &txid, const CCoins &coins)
+{
+    for (uint32_t i = 0; i < coins.vout.size(); ++i) {
+        if (!coins.vout[i].IsNull())
+            AddOutput(txid, i, coins);
+    }
+    if (!coins.IsPruned())
+        AddTransaction();
+}
+
+void CUtxoCommitment::RemoveOutputs(const uint256 &txid, const CCoins &coins)
+{
+    for (uint32_t i = 0; i < coins.vout.size(); ++i) {
+        if (!coins.vout[i].IsNull())
+            RemoveOutput(txid, i, coins);
+    }
+    if (!coins.IsPruned())
+        RemoveTransaction();
+}
+
+void CUtxoCommitment::AddOutput(const uint256 &txid, uint32_t n, const CCoins &coins)
+{
+    updateOutput(txid, n, coins.vout[n], coins.nHeight, coins.fCoinBase, coins.nVersion, true);
+}
+
+void CUtxoCommitment::RemoveOutput(const uint256 &txid, uint32_t n, const CCoins &coins)
+{
+    updateOutput(txid, n, coins.vout[n], coins.nHeight, coins.fCoinBase, coins.nVersion, false);
+}
+
+void CUtxoCommitment::AddOutput(const uint256 &txid, uint32_t n, const CTxOut &out, int nHeight, bool fCoinBase, int nVersion)
+{
+    updateOutput(txid, n, out, nHeight, fCoinBase, nVersion, true);
+}
+
+void CUtxoCommitment::AddTransaction()
+{
+    ++nTransactions;
+    nSerializedSize += 32;
+}
+
+void CUtxoCommitment::RemoveTransaction()
+{
+    --nTransactions;
+    nSerializedSize -= 32;
+}
+
+void CUtxoCommitment::updateOutput(const uint256 &txid, uint32_t n, const CTxOut &out, int nHeight, bool fCoinBase, int nVersion, bool add)
+{
+    // the element is the txid and the VARINT output index, followed by the value as the database stores it, see CoinValue in txdb.cpp
+    CDataStream element(SER_DISK, 0);
+    element << txid << VARINT(n);
+    const size_t keySize = element.size();
+    uint32_t code = nHeight * 2 + (fCoinBase ? 1 : 0);
+    element << VARINT(code) << VARINT(nVersion) << CTxOutCompressor(REF(out));
+    const unsigned char *data = reinterpret_cast<const unsigned char*>(&element[0]);
+    if (add) {
+        muhash.Insert(data, element.size());
+        ++nTransactionOutputs;
+        nSerializedSize += element.size() - keySize;
+        nTotalAmount += out.nValue;
+    } else {
+        muhash.Remove(data, element.size());
+        --nTransactionOutputs;
+        nSerializedSize -= element.size() - keySize;
+        nTotalAmount -= out.nValue;
+    }
+}
+
+void CUtxoCommitment::GetStats(CCoinsStats &stats) const
+{
+    stats.nTransactions = nTransactions;
+    stats.nTransactionOutputs = nTransactionOutputs;
+    stats.nSerializedSize = nSerializedSize;
+    stats.nTotalAmount = nTotalAmount;
+    muhash.Finalize(stats.hashSerialized.begin());
+}
+
+
 bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
 bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUtxoCommitment *commitment) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
+bool CCoinsView::GetCommitment(CUtxoCommitment &commitment) const { return false; }
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
@@ -51,10 +137,20 @@ bool CCoinsViewBacked::GetCoins(const uint256 &txid, CCoins &coins) const { retu
 bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveCoins(txid); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUtxoCommitment *commitment) { return base->BatchWrite(mapCoins, hashBlock, commitment); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
+bool CCoinsViewBacked::GetCommitment(CUtxoCommitment &commitment) const { return base->GetCommitment(commitment); }
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn)
+    : CCoinsViewBacked(baseIn),
+      hasModifier(false),
+      commitmentFetched(false),
+      commitmentKnown(false),
+      cacheCoinsResource(new CCoinsMapAllocator::Resource()),
+      cacheCoins(0, Blocks::BlockHashShortener(), std::equal_to<uint256>(), CCoinsMapAllocator(cacheCoinsResource.get())),
+      cachedCoinsUsage(0)
+{
+}
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -74,15 +170,57 @@ CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
     tmp.swap(ret->second.coins);
+    ret->second.SetParentState();
     if (ret->second.coins.IsPruned()) {
         // The parent only has an empty entry for this txid; we can consider our
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
-    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
+    cachedCoinsUsage += ret->second.DynamicMemoryUsage();
     return ret;
 }
 
+void CCoinsViewCache::Prefetch(const std::vector<uint256> &txids, CCheckQueue<CCoinsLookup> *queue)
+{
+    if (queue == NULL)
+        return;
+    std::vector<uint256> missing;
+    missing.reserve(txids.size());
+    for (const uint256 &txid : txids) {
+        if (cacheCoins.find(txid) == cacheCoins.end())
+            missing.push_back(txid);
+    }
+    if (missing.empty())
+        return;
+
+    std::vector<CCoins> results(missing.size());
+    std::vector<char> found(missing.size(), 0);
+    std::vector<CCoinsLookup> lookups;
+    lookups.reserve(missing.size());
+    for (size_t i = 0; i < missing.size(); ++i)
+        lookups.push_back(CCoinsLookup(base, &missing[i], &results[i], &found[i]));
+    {
+        CCheckQueueControl<CCoinsLookup> control(queue);
+        control.Add(lookups);
+        control.Wait();
+    }
+
+    // same as FetchCoins() does for a single one.
+    for (size_t i = 0; i < missing.size(); ++i) {
+        if (!found[i])
+            continue;
+        std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(missing[i], CCoinsCacheEntry()));
+        if (!ret.second) // a duplicate txid
+            continue;
+        CCoinsCacheEntry &entry = ret.first->second;
+        entry.coins.swap(results[i]);
+        entry.SetParentState();
+        if (entry.coins.IsPruned())
+            entry.flags = CCoinsCacheEntry::FRESH;
+        cachedCoinsUsage += entry.DynamicMemoryUsage();
+    }
+}
+
 bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
     CCoinsMap::const_iterator it = FetchCoins(txid);
     if (it != cacheCoins.end()) {
@@ -104,9 +242,11 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
         } else if (ret.first->second.coins.IsPruned()) {
             // The parent view only has a pruned entry for this; mark it as fresh.
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
+        } else {
+            ret.first->second.SetParentState();
         }
     } else {
-        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
+        cachedCoinUsage = ret.first->second.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
@@ -155,7 +295,39 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+bool CCoinsViewCache::GetCommitment(CUtxoCommitment &commitmentOut) const {
+    if (!commitmentFetched) {
+        commitmentKnown = base->GetCommitment(commitment);
+        commitmentFetched = true;
+    }
+    if (commitmentKnown)
+        commitmentOut = commitment;
+    return commitmentKnown;
+}
+
+bool CCoinsViewCache::GetStats(CCoinsStats &stats) const {
+    CUtxoCommitment current;
+    if (!GetCommitment(current))
+        return base->GetStats(stats);
+    stats.hashBlock = GetBestBlock();
+    current.GetStats(stats);
+    return true;
+}
+
+CUtxoCommitment *CCoinsViewCache::ModifyCommitment() {
+    if (!commitmentFetched) {
+        commitmentKnown = base->GetCommitment(commitment);
+        commitmentFetched = true;
+    }
+    return commitmentKnown ? &commitment : NULL;
+}
+
+void CCoinsViewCache::DiscardCommitment() {
+    commitmentFetched = true;
+    commitmentKnown = false;
+}
+
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, const CUtxoCommitment *commitmentIn) {
     assert(!hasModifier);
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
@@ -168,7 +340,10 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     // and move the data up and mark it as dirty
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
                     entry.coins.swap(it->second.coins);
-                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
+                    // what the child saw as its parent is what our parent has.
+                    entry.parentUnspent.swap(it->second.parentUnspent);
+                    entry.parentHeight = it->second.parentHeight;
+                    cachedCoinsUsage += entry.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY;
                     // We can mark it FRESH in the parent if it was FRESH in the child
                     // Otherwise it might have just been flushed from the parent's cache
@@ -182,13 +357,13 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
-                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage += itUs->second.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 }
             }
@@ -196,13 +371,35 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
         it++;
     }
     hashBlock = hashBlockIn;
+    commitmentFetched = true;
+    commitmentKnown = commitmentIn != NULL;
+    if (commitmentIn)
+        commitment = *commitmentIn;
     return true;
 }
 
 bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, hashBlock);
-    cacheCoins.clear();
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, ModifyCommitment());
+    ReallocateCache();
+    return fOk;
+}
+
+void CCoinsViewCache::ReallocateCache()
+{
+    // Clearing the map leaves its memory in the pool, recreate both to give it back to the system.
+    assert(!hasModifier);
+    cacheCoins.~CCoinsMap();
+    cacheCoinsResource.reset(new CCoinsMapAllocator::Resource());
+    ::new (&cacheCoins) CCoinsMap(0, Blocks::BlockHashShortener(), std::equal_to<uint256>(), CCoinsMapAllocator(cacheCoinsResource.get()));
     cachedCoinsUsage = 0;
+}
+
+bool CCoinsViewCache::FlushInBackground(CCoinsViewBackgroundWriter &writer)
+{
+    assert(base == &writer);
+    assert(!hasModifier);
+    bool fOk = writer.BatchWriteInBackground(cacheCoins, std::move(cacheCoinsResource), hashBlock, ModifyCommitment(), DynamicMemoryUsage());
+    ReallocateCache();
     return fOk;
 }
 
@@ -210,7 +407,7 @@ void CCoinsViewCache::Uncache(const uint256& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
     if (it != cacheCoins.end() && it->second.flags == 0) {
-        cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+        cachedCoinsUsage -= it->second.DynamicMemoryUsage();
         cacheCoins.erase(it);
     }
 }
@@ -286,6 +483,183 @@ CCoinsModifier::~CCoinsModifier()
         cache.cacheCoins.erase(it);
     } else {
         // If the coin still exists after the modification, add the new usage
-        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+        cache.cachedCoinsUsage += it->second.DynamicMemoryUsage();
+    }
+}
+
+
+CCoinsViewBackgroundWriter::CCoinsViewBackgroundWriter(CCoinsView *viewIn)
+    : CCoinsViewBacked(viewIn),
+      snapshotHasCommitment(false),
+      snapshotUsage(0),
+      writing(false),
+      failed(false),
+      stop(false)
+{
+    thread = boost::thread(boost::bind(&CCoinsViewBackgroundWriter::run, this));
+}
+
+CCoinsViewBackgroundWriter::~CCoinsViewBackgroundWriter()
+{
+    {
+        boost::unique_lock<boost::mutex> lock_(lock);
+        while (writing)
+            waitCondition.wait(lock_);
+        stop = true;
+    }
+    waitCondition.notify_all();
+    thread.join();
+}
+
+bool CCoinsViewBackgroundWriter::GetCoins(const uint256 &txid, CCoins &coins) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock_(lock);
+        if (snapshot) {
+            CCoinsMap::const_iterator it = snapshot->find(txid);
+            if (it != snapshot->end()) {
+                coins = it->second.coins;
+                return true;
+            }
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewBackgroundWriter::HaveCoins(const uint256 &txid) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock_(lock);
+        if (snapshot) {
+            CCoinsMap::const_iterator it = snapshot->find(txid);
+            if (it != snapshot->end())
+                return !it->second.coins.IsPruned();
+        }
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewBackgroundWriter::GetBestBlock() const
+{
+    {
+        boost::unique_lock<boost::mutex> lock_(lock);
+        if (snapshot && !snapshotBestBlock.IsNull())
+            return snapshotBestBlock;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundWriter::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUtxoCommitment *commitment)
+{
+    if (!WaitForWrite())
+        return false;
+    return base->BatchWrite(mapCoins, hashBlock, commitment);
+}
+
+bool CCoinsViewBackgroundWriter::GetStats(CCoinsStats &stats) const
+{
+    if (!WaitForWrite())
+        return false;
+    return base->GetStats(stats);
+}
+
+bool CCoinsViewBackgroundWriter::GetCommitment(CUtxoCommitment &commitment) const
+{
+    {
+        boost::unique_lock<boost::mutex> lock_(lock);
+        if (snapshot) {
+            if (snapshotHasCommitment)
+                commitment = snapshotCommitment;
+            return snapshotHasCommitment;
+        }
+    }
+    return base->GetCommitment(commitment);
+}
+
+bool CCoinsViewBackgroundWriter::BatchWriteInBackground(CCoinsMap &mapCoins, std::unique_ptr<CCoinsMapAllocator::Resource> resource,
+                                                        const uint256 &hashBlock, const CUtxoCommitment *commitment, size_t usage)
+{
+    // the map keeps pointing to the resource, which we take over too.
+    std::unique_ptr<CCoinsMap> map(new CCoinsMap(std::move(mapCoins)));
+    {
+        boost::unique_lock<boost::mutex> lock_(lock);
+        while (writing)
+            waitCondition.wait(lock_);
+        if (failed)
+            return false;
+        // release the old one first, its map allocates from its resource.
+        snapshot.reset();
+        snapshotResource = std::move(resource);
+        snapshot = std::move(map);
+        snapshotBestBlock = hashBlock;
+        snapshotHasCommitment = commitment != NULL;
+        if (commitment)
+            snapshotCommitment = *commitment;
+        snapshotUsage = usage;
+        writing = true;
+    }
+    waitCondition.notify_all();
+    return true;
+}
+
+bool CCoinsViewBackgroundWriter::WaitForWrite() const
+{
+    boost::unique_lock<boost::mutex> lock_(lock);
+    while (writing)
+        waitCondition.wait(lock_);
+    return !failed;
+}
+
+size_t CCoinsViewBackgroundWriter::InFlightUsage() const
+{
+    boost::unique_lock<boost::mutex> lock_(lock);
+    return snapshot ? snapshotUsage : 0;
+}
+
+bool CCoinsViewBackgroundWriter::IsWriting() const
+{
+    boost::unique_lock<boost::mutex> lock_(lock);
+    return writing;
+}
+
+void CCoinsViewBackgroundWriter::run()
+{
+    while (true) {
+        CCoinsMap *map;
+        uint256 hashBlock;
+        const CUtxoCommitment *commitment;
+        {
+            boost::unique_lock<boost::mutex> lock_(lock);
+            while (!writing && !stop)
+                waitCondition.wait(lock_);
+            if (stop)
+                return;
+            map = snapshot.get();
+            hashBlock = snapshotBestBlock;
+            commitment = snapshotHasCommitment ? &snapshotCommitment : NULL;
+        }
+        // the snapshot is only replaced after we clear 'writing', we can use it without holding the lock.
+        bool ok = false;
+        try {
+            const int64_t start = GetTimeMillis();
+            ok = base->BatchWrite(*map, hashBlock, commitment);
+            logInfo(Log::Coindb) << "Background write of" << map->size() << "coins took" << (GetTimeMillis() - start) << "ms";
+        } catch (const std::exception &e) {
+            logCritical(Log::Coindb) << "Background write of the UTXO set failed:" << e;
+        }
+        {
+            boost::unique_lock<boost::mutex> lock_(lock);
+            if (ok) {
+                snapshot.reset();
+                snapshotResource.reset();
+                snapshotUsage = 0;
+            } else {
+                // keep the snapshot for lookups, the node is going to shut down.
+                logCritical(Log::Coindb) << "Failed to write the UTXO set to the database";
+                failed = true;
+            }
+            writing = false;
+        }
+        waitCondition.notify_all();
     }
 }
@@ -1,5 +1,6 @@
 // Copyright (c) 2009-2010 Satoshi Nakamoto
 // Copyright (c) 2009-2015 The Bitcoin Core developers
+// Copyright (c) 2017 Tom Zander <tomz@freedommail.ch>
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -12,11 +13,18 @@
 #include "serialize.h"
 #include "uint256.h"
 #include "BlocksDB.h"
+#include "checkqueue.h"
+#include "crypto/muhash.h"
 
 #include <cstdint>
 #include <cassert>
 
+#include <memory>
+
 #include <boost/foreach.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/unordered_map.hpp>
 
 /** 
@@ -275,10 +283,49 @@ struct CCoinsCacheEntry
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    /**
+     * The outputs that are unspent in the parent view and the height the parent has them at.
+     * An output is dirty when its availability in coins differs from this, which allows
+     * the database to write only the outputs that actually changed.
+     */
+    std::vector<bool> parentUnspent;
+    int parentHeight;
+
+    CCoinsCacheEntry() : coins(), flags(0), parentHeight(0) {}
+
+    //! Remember the current state of coins as the state of the parent view.
+    void SetParentState() {
+        parentUnspent.resize(coins.vout.size());
+        for (size_t i = 0; i < coins.vout.size(); ++i)
+            parentUnspent[i] = !coins.vout[i].IsNull();
+        parentHeight = coins.nHeight;
+    }
+
+    //! The memory allocated by this entry, not counting the entry itself.
+    size_t DynamicMemoryUsage() const {
+        return coins.DynamicMemoryUsage() + memusage::MallocUsage((parentUnspent.capacity() + 7) / 8);
+    }
+
+    //! Return true if output \a n is dirty, which means it needs to be written or erased in the parent.
+    bool IsOutputDirty(unsigned int n) const {
+        const bool unspent = coins.IsAvailable(n);
+        const bool parentHas = n < parentUnspent.size() && parentUnspent[n];
+        if (unspent != parentHas)
+            return true;
+        return unspent && coins.nHeight != parentHeight; // replaced by a duplicate transaction
+    }
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, Blocks::BlockHashShortener> CCoinsMap;
+/**
+ * The nodes of the coins map are allocated from a pool, which avoids a malloc per entry.
+ * The bucket array goes through the pool too, so the memory usage of the map itself is exact.
+ * The outputs of the CCoins in it are still allocated normally, their usage is an estimate
+ * kept in cachedCoinsUsage.
+ */
+typedef PoolAllocator<std::pair<const uint256, CCoinsCacheEntry>,
+        sizeof(std::pair<const uint256, CCoinsCacheEntry>) + sizeof(void*) * 4> CCoinsMapAllocator;
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, Blocks::BlockHashShortener,
+        std::equal_to<uint256>, CCoinsMapAllocator> CCoinsMap;
 
 struct CCoinsStats
 {
@@ -293,6 +340,58 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 };
 
+/**
+ * A running summary of the UTXO set: a hash that does not depend on the order outputs were added
+ * in, and the totals of CCoinsStats. It is updated for every output that is created or spent, so
+ * the statistics don't require a walk over the database.
+ */
+class CUtxoCommitment
+{
+public:
+    CUtxoCommitment() : nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    /// Add the unspent outputs of \a coins, and count the transaction if there are any.
+    void AddOutputs(const uint256 &txid, const CCoins &coins);
+    /// Remove the unspent outputs of \a coins, and the transaction if there were any.
+    void RemoveOutputs(const uint256 &txid, const CCoins &coins);
+
+    /// Add a single output, the metadata is taken from \a coins.
+    void AddOutput(const uint256 &txid, uint32_t n, const CCoins &coins);
+    /// Remove a single output, the caller calls RemoveTransaction() when this was the last one.
+    void RemoveOutput(const uint256 &txid, uint32_t n, const CCoins &coins);
+    void AddOutput(const uint256 &txid, uint32_t n, const CTxOut &out, int nHeight, bool fCoinBase, int nVersion);
+    void AddTransaction();
+    void RemoveTransaction();
+
+    /// Fill the totals and the hash of \a stats, leaves the height and block alone.
+    void GetStats(CCoinsStats &stats) const;
+
+    ADD_SERIALIZE_METHODS
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        unsigned char hash[MuHash3072::SERIALIZED_SIZE];
+        if (!ser_action.ForRead())
+            muhash.ToBytes(hash);
+        READWRITE(FLATDATA(hash));
+        if (ser_action.ForRead())
+            muhash.FromBytes(hash);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+    }
+
+private:
+    void updateOutput(const uint256 &txid, uint32_t n, const CTxOut &out, int nHeight, bool fCoinBase, int nVersion, bool add);
+
+    MuHash3072 muhash;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+};
+
 
 /** Abstract view on the open txout dataset. */
 class CCoinsView
@@ -309,12 +408,15 @@ public:
     virtual uint256 GetBestBlock() const;
 
     //! Do a bulk modification (multiple CCoins changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified. The commitment of the new state is NULL when unknown.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUtxoCommitment *commitment);
 
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
 
+    //! Retrieve the commitment to the set this view represents, returns false if it is not known
+    virtual bool GetCommitment(CUtxoCommitment &commitment) const;
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 };
@@ -332,12 +434,43 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUtxoCommitment *commitment);
     bool GetStats(CCoinsStats &stats) const;
+    bool GetCommitment(CUtxoCommitment &commitment) const;
 };
 
 
 class CCoinsViewCache;
+class CCoinsViewBackgroundWriter;
+
+/**
+ * A single lookup in a view, used by CCoinsViewCache::Prefetch() to do many lookups in parallel on a CCheckQueue.
+ */
+class CCoinsLookup
+{
+public:
+    CCoinsLookup() : view(0), txid(0), coins(0), found(0) {}
+    CCoinsLookup(const CCoinsView *view, const uint256 *txid, CCoins *coins, char *found)
+        : view(view), txid(txid), coins(coins), found(found) {}
+
+    bool operator()() {
+        *found = view->GetCoins(*txid, *coins);
+        return true;
+    }
+
+    void swap(CCoinsLookup &other) {
+        std::swap(view, other.view);
+        std::swap(txid, other.txid);
+        std::swap(coins, other.coins);
+        std::swap(found, other.found);
+    }
+
+private:
+    const CCoinsView *view;
+    const uint256 *txid;
+    CCoins *coins;
+    char *found;
+};
 
 /** 
  * A reference to a mutable cache entry. Encapsulating it allows us to run
@@ -372,6 +505,11 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    mutable CUtxoCommitment commitment;
+    mutable bool commitmentFetched;
+    mutable bool commitmentKnown;
+    // declared before cacheCoins, which allocates from it.
+    std::unique_ptr<CCoinsMapAllocator::Resource> cacheCoinsResource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner CCoins objects. */
@@ -386,7 +524,26 @@ public:
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUtxoCommitment *commitment);
+    bool GetCommitment(CUtxoCommitment &commitment) const;
+
+    /**
+     * Statistics from the commitment, which includes the changes in this cache.
+     * Falls back to the base when the commitment is not known.
+     */
+    bool GetStats(CCoinsStats &stats) const;
+
+    /**
+     * Return the commitment to update for changes made to this cache, or NULL if it is not known.
+     * It is up to the code spending and creating outputs to keep it in sync with the coins.
+     */
+    CUtxoCommitment *ModifyCommitment();
+
+    /**
+     * Stop keeping the commitment, for caches that are never flushed.
+     * Flushing afterwards makes the base forget its commitment.
+     */
+    void DiscardCommitment();
 
     /**
      * Check if we have the given tx already loaded in this cache.
@@ -420,6 +577,13 @@ public:
      */
     CCoinsModifier ModifyNewCoins(const uint256 &txid);
 
+    /**
+     * Load the coins of all \a txids that are not in this cache yet from the base view in one batch.
+     * The lookups are spread over the workers of \a queue, which requires the base to allow
+     * lookups from multiple threads. Does nothing if queue is NULL.
+     */
+    void Prefetch(const std::vector<uint256> &txids, CCheckQueue<CCoinsLookup> *queue);
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
@@ -427,6 +591,14 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to \a writer, which has to be our base,
+     * and return without waiting for them to be written.
+     * The cache is empty afterwards and reads go to the snapshot held by the writer until it is written.
+     * Returns false if an earlier background write failed.
+     */
+    bool FlushInBackground(CCoinsViewBackgroundWriter &writer);
+
     /**
      * Removes the transaction with the given hash from the cache, if it is
      * not modified.
@@ -464,6 +636,9 @@ public:
     friend class CCoinsModifier;
 
 private:
+    /// Replace the cache and its memory pool with empty ones.
+    void ReallocateCache();
+
     CCoinsMap::iterator FetchCoins(const uint256 &txid);
     CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
 
@@ -473,4 +648,62 @@ private:
     CCoinsViewCache(const CCoinsViewCache &);
 };
 
+/**
+ * CCoinsView that writes flushed caches to its base in a background thread.
+ *
+ * A cache handed over with CCoinsViewCache::FlushInBackground() becomes the in-flight snapshot,
+ * lookups check it first and then fall through to the base. One snapshot is in flight at a time,
+ * handing over the next one or a normal BatchWrite() waits for the previous one to be written.
+ *
+ * The snapshot is written in a single BatchWrite() call which includes the best block, so the
+ * base stays consistent even if we crash in the middle. The base has to leave the map it is
+ * passed intact, as lookups read it while it is being written; CCoinsViewDB does.
+ */
+class CCoinsViewBackgroundWriter : public CCoinsViewBacked
+{
+public:
+    CCoinsViewBackgroundWriter(CCoinsView *viewIn);
+    ~CCoinsViewBackgroundWriter();
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUtxoCommitment *commitment);
+    bool GetStats(CCoinsStats &stats) const;
+    bool GetCommitment(CUtxoCommitment &commitment) const;
+
+    /**
+     * Take ownership of \a mapCoins and the \a resource it allocates from and write them in the background.
+     * \a mapCoins is left empty. Returns false if an earlier background write failed.
+     */
+    bool BatchWriteInBackground(CCoinsMap &mapCoins, std::unique_ptr<CCoinsMapAllocator::Resource> resource,
+                                const uint256 &hashBlock, const CUtxoCommitment *commitment, size_t usage);
+
+    /// Wait until the in-flight snapshot is written, returns false if a background write failed.
+    bool WaitForWrite() const;
+
+    /// The memory used by the in-flight snapshot, zero if there is none.
+    size_t InFlightUsage() const;
+
+    /// Returns true while a snapshot is being written, handing over another one would wait for it.
+    bool IsWriting() const;
+
+private:
+    void run();
+
+    mutable boost::mutex lock;
+    mutable boost::condition_variable waitCondition;
+    // declared before snapshot, which allocates from it.
+    std::unique_ptr<CCoinsMapAllocator::Resource> snapshotResource;
+    std::unique_ptr<CCoinsMap> snapshot;
+    uint256 snapshotBestBlock;
+    CUtxoCommitment snapshotCommitment;
+    bool snapshotHasCommitment;
+    size_t snapshotUsage;
+    bool writing;
+    bool failed;
+    bool stop;
+    boost::thread thread;
+};
+
 #endif // BITCOIN_COINS_H
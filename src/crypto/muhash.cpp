@@ -0,0 +1,195 @@
+/*
+ * This file is part of the bitcoin-classic project
+ * Copyright (C) 2017 Tom Zander <tomz@freedommail.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+
+#include <cstring>
+#include <limits>
+
+namespace {
+// the prime is 2^3072 - MAX_PRIME_DIFF
+const Num3072::limb_t MAX_PRIME_DIFF = 1103717;
+const Num3072::limb_t MAX_LIMB = std::numeric_limits<Num3072::limb_t>::max();
+
+Num3072::limb_t readLimb(const unsigned char *data)
+{
+    return Num3072::LIMB_SIZE == 64 ? ReadLE64(data) : ReadLE32(data);
+}
+
+void writeLimb(unsigned char *out, Num3072::limb_t limb)
+{
+    if (Num3072::LIMB_SIZE == 64)
+        WriteLE64(out, limb);
+    else
+        WriteLE32(out, limb);
+}
+
+/// Hash arbitrary data to a number, the sha256 of the data is expanded to 3072 bits with sha512.
+Num3072 toNum3072(const unsigned char *data, size_t len)
+{
+    unsigned char key[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(key);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    static_assert(Num3072::BYTE_SIZE % CSHA512::OUTPUT_SIZE == 0, "expansion has to fill the number");
+    for (unsigned char i = 0; i < Num3072::BYTE_SIZE / CSHA512::OUTPUT_SIZE; ++i)
+        CSHA512().Write(key, sizeof(key)).Write(&i, 1).Finalize(expanded + i * CSHA512::OUTPUT_SIZE);
+    return Num3072(expanded);
+}
+}
+
+Num3072::Num3072()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i)
+        limbs[i] = 0;
+}
+
+Num3072::Num3072(const unsigned char data[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i)
+        limbs[i] = readLimb(data + i * LIMB_SIZE / 8);
+}
+
+void Num3072::ToBytes(unsigned char out[BYTE_SIZE]) const
+{
+    Num3072 copy(*this);
+    if (copy.IsOverflow())
+        copy.FullReduce();
+    for (int i = 0; i < LIMBS; ++i)
+        writeLimb(out + i * LIMB_SIZE / 8, copy.limbs[i]);
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= MAX_LIMB - MAX_PRIME_DIFF)
+        return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != MAX_LIMB)
+            return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // subtracting the prime is adding MAX_PRIME_DIFF and dropping the 2^3072 bit.
+    double_limb_t c = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += limbs[i];
+        limbs[i] = static_cast<limb_t>(c);
+        c >>= LIMB_SIZE;
+    }
+}
+
+void Num3072::Multiply(const Num3072 &other)
+{
+    limb_t tmp[2 * LIMBS];
+    memset(tmp, 0, sizeof(tmp));
+    for (int i = 0; i < LIMBS; ++i) {
+        limb_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            const double_limb_t cur = static_cast<double_limb_t>(limbs[i]) * other.limbs[j] + tmp[i + j] + carry;
+            tmp[i + j] = static_cast<limb_t>(cur);
+            carry = static_cast<limb_t>(cur >> LIMB_SIZE);
+        }
+        tmp[i + LIMBS] = carry;
+    }
+
+    // 2^3072 is congruent to MAX_PRIME_DIFF, fold the high half into the low half.
+    double_limb_t c = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += static_cast<double_limb_t>(tmp[LIMBS + i]) * MAX_PRIME_DIFF + tmp[i];
+        limbs[i] = static_cast<limb_t>(c);
+        c >>= LIMB_SIZE;
+    }
+    while (c) {
+        c *= MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && c; ++i) {
+            c += limbs[i];
+            limbs[i] = static_cast<limb_t>(c);
+            c >>= LIMB_SIZE;
+        }
+    }
+    if (IsOverflow())
+        FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Fermat's little theorem, raise to the power of the prime minus two.
+    Num3072 result;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        const limb_t exponent = i == 0 ? MAX_LIMB - MAX_PRIME_DIFF - 1 : MAX_LIMB;
+        for (int bit = LIMB_SIZE - 1; bit >= 0; --bit) {
+            result.Multiply(result);
+            if ((exponent >> bit) & 1)
+                result.Multiply(*this);
+        }
+    }
+    return result;
+}
+
+void Num3072::Divide(const Num3072 &other)
+{
+    Multiply(other.GetInverse());
+}
+
+
+MuHash3072 &MuHash3072::Insert(const unsigned char *data, size_t len)
+{
+    numerator.Multiply(toNum3072(data, len));
+    return *this;
+}
+
+MuHash3072 &MuHash3072::Remove(const unsigned char *data, size_t len)
+{
+    denominator.Multiply(toNum3072(data, len));
+    return *this;
+}
+
+MuHash3072 &MuHash3072::operator*=(const MuHash3072 &other)
+{
+    numerator.Multiply(other.numerator);
+    denominator.Multiply(other.denominator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char out[OUTPUT_SIZE]) const
+{
+    Num3072 result(numerator);
+    result.Divide(denominator);
+    unsigned char data[Num3072::BYTE_SIZE];
+    result.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(out);
+}
+
+void MuHash3072::ToBytes(unsigned char out[SERIALIZED_SIZE]) const
+{
+    numerator.ToBytes(out);
+    denominator.ToBytes(out + Num3072::BYTE_SIZE);
+}
+
+void MuHash3072::FromBytes(const unsigned char data[SERIALIZED_SIZE])
+{
+    numerator = Num3072(data);
+    denominator = Num3072(data + Num3072::BYTE_SIZE);
+}
@@ -0,0 +1,97 @@
+/*
+ * This file is part of the bitcoin-classic project
+ * Copyright (C) 2017 Tom Zander <tomz@freedommail.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <cstdint>
+#include <cstdlib>
+
+/** A number modulo the prime 2^3072 - 1103717. */
+class Num3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+
+#ifdef __SIZEOF_INT128__
+    typedef uint64_t limb_t;
+    typedef unsigned __int128 double_limb_t;
+    static const int LIMB_SIZE = 64;
+#else
+    typedef uint32_t limb_t;
+    typedef uint64_t double_limb_t;
+    static const int LIMB_SIZE = 32;
+#endif
+    static const int LIMBS = 3072 / LIMB_SIZE;
+
+    /// Creates the number one.
+    Num3072();
+    /// Creates a number from little-endian bytes.
+    explicit Num3072(const unsigned char data[BYTE_SIZE]);
+
+    /// Writes the fully reduced number as little-endian bytes.
+    void ToBytes(unsigned char out[BYTE_SIZE]) const;
+
+    void Multiply(const Num3072 &other);
+    /// Multiplies with the inverse of \a other.
+    void Divide(const Num3072 &other);
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+    Num3072 GetInverse() const;
+
+    limb_t limbs[LIMBS];
+};
+
+/**
+ * A hash of a set of byte strings that does not depend on the order they were added in, and
+ * allows removing them again.
+ *
+ * This is the MuHash construction: every element is hashed to a number modulo a 3072 bit prime,
+ * the set is the product of those numbers. Removals are collected as a separate product that
+ * is divided out only when the hash is finalized, which keeps Insert() and Remove() at a single
+ * multiplication each.
+ */
+class MuHash3072
+{
+public:
+    static const size_t SERIALIZED_SIZE = 2 * Num3072::BYTE_SIZE;
+    static const size_t OUTPUT_SIZE = 32;
+
+    /// Creates the hash of the empty set.
+    MuHash3072() {}
+
+    MuHash3072 &Insert(const unsigned char *data, size_t len);
+    MuHash3072 &Remove(const unsigned char *data, size_t len);
+
+    /// Combine with the hash of another set.
+    MuHash3072 &operator*=(const MuHash3072 &other);
+
+    /// Computes the 32 byte hash of the set, this is slow compared to Insert() and Remove().
+    void Finalize(unsigned char out[OUTPUT_SIZE]) const;
+
+    void ToBytes(unsigned char out[SERIALIZED_SIZE]) const;
+    void FromBytes(const unsigned char data[SERIALIZED_SIZE]);
+
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -1,4 +1,5 @@
 // Copyright (c) 2012-2015 The Bitcoin Core developers
+// Copyright (c) 2017 Tom Zander <tomz@freedommail.ch>
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -40,6 +41,11 @@ public:
      */
     CDBBatch(const std::vector<unsigned char> *obfuscate_key) : obfuscate_key(obfuscate_key) { };
 
+    void Clear()
+    {
+        batch.Clear();
+    }
+
     template <typename K, typename V>
     void Write(const K& key, const V& value)
     {
@@ -259,6 +265,15 @@ public:
         return new CDBIterator(pdb->NewIterator(iteroptions), &obfuscate_key);
     }
 
+    /**
+     * Return an iterator meant for short range lookups, unlike NewIterator() the
+     * blocks it reads end up in the block cache just like with Read().
+     */
+    CDBIterator *NewLookupIterator() const
+    {
+        return new CDBIterator(pdb->NewIterator(readoptions), &obfuscate_key);
+    }
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
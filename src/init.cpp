@@ -155,7 +155,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -218,6 +217,8 @@ void Shutdown()
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinsWriter; // waits for the last write
+        pcoinsWriter = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
@@ -776,8 +777,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     std::ostringstream strErrors;
 
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadCoinsPrefetch);
+        }
     }
 
     // Start the lightweight task scheduler thread
@@ -825,6 +828,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // ********************************************************* Step 6: load block chain
 
     bool fReindex = GetBoolArg("-reindex", false);
+    const std::string utxoSnapshot = GetArg("-loadutxosnapshot", "");
+    if (fReindex && !utxoSnapshot.empty())
+        return InitError(_("-loadutxosnapshot can not be combined with -reindex"));
 
     // cache size calculations
     int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
@@ -855,13 +861,34 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsWriter;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
 
                 Blocks::DB::createInstance(nBlockTreeDBCache, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                pcoinsWriter = new CCoinsViewBackgroundWriter(pcoinscatcher);
+                pcoinsTip = new CCoinsViewCache(pcoinsWriter);
+
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
+                // a snapshot is only loaded into an empty chain state, later starts ignore it.
+                const bool loadSnapshot = !utxoSnapshot.empty() && pcoinsdbview->GetBestBlock().IsNull();
+                if (loadSnapshot) {
+                    CAutoFile file(fopen(utxoSnapshot.c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+                    if (file.IsNull())
+                        return InitError(strprintf(_("Unable to open UTXO snapshot %s"), utxoSnapshot));
+                    if (!pcoinsdbview->LoadSnapshot(file))
+                        return InitError(strprintf(_("Failed to load UTXO snapshot %s"), utxoSnapshot));
+                }
+                if (!pcoinsdbview->InitCommitment()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
 
                 if (fReindex) {
                     Blocks::DB::instance()->setIsReindexing(true);
@@ -874,6 +901,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     strLoadError = _("Error loading block database");
                     break;
                 }
+                if (loadSnapshot && (chainActive.Tip() == NULL || chainActive.Tip()->GetBlockHash() != pcoinsTip->GetBestBlock()))
+                    return InitError(_("The block of the UTXO snapshot is not in the block index, the headers are not downloaded first. Copy the blocks directory of the node that made the snapshot, or restart with -reindex to discard the snapshot"));
                 // Check whether we need to continue reindexing
                 fReindex = fReindex || Blocks::DB::instance()->isReindexing();
 
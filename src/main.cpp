@@ -21,6 +21,7 @@
 #include "main.h"
 
 #include "addrman.h"
+#include "blockchain/Block.h"
 #include "Application.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -32,6 +33,7 @@
 #include "init.h"
 #include "merkleblock.h"
 #include "policy/policy.h"
+#include "pubkey.h"
 #include "script/sigcache.h"
 #include "thinblock.h"
 #include "txmempool.h"
@@ -45,6 +47,8 @@
 #include <boost/filesystem.hpp>
 #include <boost/math/distributions/poisson.hpp>
 
+#include <deque>
+
 /**
  * Global state
  */
@@ -78,6 +82,13 @@ CTxMemPool mempool(::minRelayTxFee);
  * in the last Consensus::Params::nMajorityWindow blocks, starting at pstart and going backwards.
  */
 static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned nRequired, const Consensus::Params& consensusParams);
+/**
+ * Returns the script verification flags that a block with version nVersion and
+ * time nTime on top of pindexPrev has to be validated with.
+ */
+static unsigned int GetBlockScriptFlags(const CBlockIndex *pindexPrev, int32_t nVersion, int64_t nTime, const Consensus::Params& consensusParams);
+/** Returns the script verification flags of a block we would mine on top of the current tip. */
+static unsigned int NextBlockScriptFlags();
 
 const std::string strMessageMagic = "Bitcoin Signed Message:\n";
 
@@ -147,6 +158,25 @@ namespace {
      */
     std::map<uint256, NodeId> mapBlockSource;
 
+    /**
+     * Blocks that were relayed to us ahead of validation, with the peer that relayed them.
+     * At most MAX_BLOCKS_RELAYED_UNVALIDATED entries, the oldest is forgotten first.
+     * Protected by cs_main.
+     */
+    std::map<uint256, NodeId> mapBlocksRelayedUnvalidated;
+    /** The keys of mapBlocksRelayedUnvalidated, oldest first. Protected by cs_main. */
+    std::deque<uint256> blocksRelayedUnvalidatedOrder;
+
+    void ForgetBlockRelayedUnvalidated(const uint256 &hash)
+    {
+        AssertLockHeld(cs_main);
+        if (mapBlocksRelayedUnvalidated.erase(hash) == 0)
+            return;
+        auto it = std::find(blocksRelayedUnvalidatedOrder.begin(), blocksRelayedUnvalidatedOrder.end(), hash);
+        assert(it != blocksRelayedUnvalidatedOrder.end());
+        blocksRelayedUnvalidatedOrder.erase(it);
+    }
+
     /**
      * Filter for transactions that were recently rejected by
      * AcceptToMemoryPool. These are not rerequested until the chain tip
@@ -569,6 +599,8 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewBackgroundWriter *pcoinsWriter = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 
 bool IsFinalTx(const CTransaction &tx, int nBlockHeight, int64_t nBlockTime)
 {
@@ -1105,11 +1137,12 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true))
+        PrecomputedTransactionData txdata(tx);
+        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata))
             return false;
 
-        // Check again against just the consensus-critical mandatory script
-        // verification flags, in case of bugs in the standard flags that cause
+        // Check again against just the consensus-critical script verification
+        // flags of the next block, in case of bugs in the standard flags that cause
         // transactions to pass as valid when they're actually invalid. For
         // instance the STRICTENC flag was incorrectly allowing certain
         // CHECKSIG NOT scripts to pass, even though they were invalid.
@@ -1117,15 +1150,17 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        scriptVerifyFlags = MANDATORY_SCRIPT_VERIFY_FLAGS;
-        if (Application::uahfChainState() >= Application::UAHFRulesActive)
-            scriptVerifyFlags |= SCRIPT_ENABLE_SIGHASH_FORKID;
-
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true))
+        // The signatures are in the cache by now, and passing this allows
+        // ConnectBlock to skip the scripts of this transaction.
+        const unsigned int blockScriptFlags = NextBlockScriptFlags();
+        if (!CheckInputs(tx, state, view, true, blockScriptFlags, true, txdata))
         {
+            if (blockScriptFlags & ~scriptVerifyFlags) // the next block enforces rules the standard flags don't
+                return false;
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
         }
+        AddValidatedTransaction(hash, blockScriptFlags);
         // Store transaction in memory
         pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
 
@@ -1353,6 +1388,23 @@ void Misbehaving(NodeId nodeId, int howmuch)
     }
 }
 
+void MarkBlockAsRelayedUnvalidated(const uint256 &hash, NodeId nodeid)
+{
+    LOCK(cs_main);
+    auto existing = mapBlocksRelayedUnvalidated.find(hash);
+    if (existing != mapBlocksRelayedUnvalidated.end()) {
+        existing->second = nodeid;
+        return;
+    }
+    // blocks that never get connected, like those on a side chain, are not erased otherwise.
+    if (mapBlocksRelayedUnvalidated.size() >= MAX_BLOCKS_RELAYED_UNVALIDATED) {
+        mapBlocksRelayedUnvalidated.erase(blocksRelayedUnvalidatedOrder.front());
+        blocksRelayedUnvalidatedOrder.pop_front();
+    }
+    mapBlocksRelayedUnvalidated.insert(std::make_pair(hash, nodeid));
+    blocksRelayedUnvalidatedOrder.push_back(hash);
+}
+
 void static InvalidChainFound(CBlockIndex* pindexNew)
 {
     if (!pindexBestInvalid || pindexNew->nChainWork > pindexBestInvalid->nChainWork)
@@ -1380,10 +1432,16 @@ void static InvalidBlockFound(CBlockIndex *pindex, const CValidationState &state
             assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
             CBlockReject reject = {(unsigned char)state.GetRejectCode(), state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), pindex->GetBlockHash()};
             State(it->second)->rejects.push_back(reject);
+            // A peer relaying ahead of validation checked the header, proof of work and merkle root but
+            // not the scripts, so it is not banned for the first such block, only for repeating it.
+            auto relayed = mapBlocksRelayedUnvalidated.find(pindex->GetBlockHash());
+            if (relayed != mapBlocksRelayedUnvalidated.end() && relayed->second == it->second)
+                nDoS = std::min(nDoS, UNVALIDATED_RELAY_INVALID_BLOCK_SCORE);
             if (nDoS > 0)
                 Misbehaving(it->second, nDoS);
         }
     }
+    ForgetBlockRelayedUnvalidated(pindex->GetBlockHash());
     if (!state.CorruptionPossible()) {
         pindex->nStatus |= BLOCK_FAILED_VALID;
         setDirtyBlockIndex.insert(pindex);
@@ -1394,6 +1452,7 @@ void static InvalidBlockFound(CBlockIndex *pindex, const CValidationState &state
 
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight)
 {
+    CUtxoCommitment *commitment = inputs.ModifyCommitment();
     // mark inputs spent
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
@@ -1403,10 +1462,14 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 
             if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
                 assert(false);
+            if (commitment)
+                commitment->RemoveOutput(txin.prevout.hash, nPos, *coins);
             // mark an outpoint spent, and construct undo information
             txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
             coins->Spend(nPos);
             if (coins->vout.size() == 0) {
+                if (commitment)
+                    commitment->RemoveTransaction();
                 CTxInUndo& undo = txundo.vprevout.back();
                 undo.nHeight = coins->nHeight;
                 undo.fCoinBase = coins->fCoinBase;
@@ -1414,7 +1477,10 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
             }
         }
         // add outputs
-        inputs.ModifyNewCoins(tx.GetHash())->FromTx(tx, nHeight);
+        CCoinsModifier coins = inputs.ModifyNewCoins(tx.GetHash());
+        coins->FromTx(tx, nHeight);
+        if (commitment)
+            commitment->AddOutputs(tx.GetHash(), *coins);
     }
     else {
         // add outputs for coinbase tx
@@ -1422,7 +1488,12 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
         // lookup to be sure the coins do not already exist otherwise we do not
         // know whether to mark them fresh or not.  We want the duplicate coinbases
         // before BIP30 to still be properly overwritten.
-        inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+        CCoinsModifier coins = inputs.ModifyCoins(tx.GetHash());
+        if (commitment)
+            commitment->RemoveOutputs(tx.GetHash(), *coins);
+        coins->FromTx(tx, nHeight);
+        if (commitment)
+            commitment->AddOutputs(tx.GetHash(), *coins);
     }
 }
 
@@ -1434,7 +1505,7 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore), &error)) {
+    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata, pubkeyCache), &error)) {
         return false;
     }
     return true;
@@ -1494,7 +1565,7 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, const PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks, CPubKeyParseCache *pubkeyCache)
 {
     if (!tx.IsCoinBase())
     {
@@ -1518,7 +1589,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata, pubkeyCache);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1531,7 +1602,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
                         CScriptCheck check2(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -1638,11 +1709,14 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
 {
     bool fClean = true;
 
+    CUtxoCommitment *commitment = view.ModifyCommitment();
     CCoinsModifier coins = view.ModifyCoins(out.hash);
     if (undo.nHeight != 0) {
         // undo data contains height: this is the last output of the prevout tx being spent
         if (!coins->IsPruned())
             fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
+        if (commitment)
+            commitment->RemoveOutputs(out.hash, *coins);
         coins->Clear();
         coins->fCoinBase = undo.fCoinBase;
         coins->nHeight = undo.nHeight;
@@ -1651,11 +1725,18 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
         if (coins->IsPruned())
             fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
     }
-    if (coins->IsAvailable(out.n))
+    if (coins->IsAvailable(out.n)) {
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
+        if (commitment)
+            commitment->RemoveOutput(out.hash, out.n, *coins);
+    }
+    if (commitment && coins->IsPruned())
+        commitment->AddTransaction();
     if (coins->vout.size() < out.n+1)
         coins->vout.resize(out.n+1);
     coins->vout[out.n] = undo.txout;
+    if (commitment)
+        commitment->AddOutput(out.hash, out.n, *coins);
 
     return fClean;
 }
@@ -1668,6 +1749,7 @@ bool DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewC
         *pfClean = false;
 
     bool fClean = true;
+    CUtxoCommitment *commitment = view.ModifyCommitment();
 
     CBlockUndo blockUndo;
     CDiskBlockPos pos = pindex->GetUndoPos();
@@ -1700,6 +1782,8 @@ bool DisconnectBlock(const CBlock& block, const CBlockIndex* pindex, CCoinsViewC
             fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
 
         // remove outputs
+        if (commitment)
+            commitment->RemoveOutputs(hash, *outs);
         outs->Clear();
         }
 
@@ -1760,6 +1844,13 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CCoinsLookup> coinsprefetchqueue(16);
+
+void ThreadCoinsPrefetch() {
+    RenameThread("bitcoin-prefetch");
+    coinsprefetchqueue.Thread();
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -1868,6 +1959,59 @@ public:
 // Protected by cs_main
 static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
+static unsigned int GetBlockScriptFlags(const CBlockIndex *pindexPrev, int32_t nVersion, int64_t nTime, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+    // BIP16 didn't become active until Apr 1 2012
+    int64_t nBIP16SwitchTime = 1333238400;
+    bool fStrictPayToScriptHash = (nTime >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
+    // when 75% of the network has upgraded:
+    if (nVersion >= 3 && IsSuperMajority(3, pindexPrev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams)) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
+    // blocks, when 75% of the network has upgraded:
+    if (nVersion >= 4 && IsSuperMajority(4, pindexPrev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams)) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindexPrev, consensusParams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    }
+
+    if ((Application::uahfChainState() == Application::UAHFWaiting
+         && pindexPrev->GetMedianTimePast() >= Application::uahfStartTime())
+            || Application::uahfChainState() >= Application::UAHFRulesActive) {
+        flags |= SCRIPT_VERIFY_STRICTENC;
+        flags |= SCRIPT_ENABLE_SIGHASH_FORKID;
+    }
+    return flags;
+}
+
+static unsigned int NextBlockScriptFlags()
+{
+    AssertLockHeld(cs_main);
+    // Protected by cs_main
+    static uint256 s_tip;
+    static Application::UAHFState s_uahfState;
+    static unsigned int s_flags = 0;
+
+    const CBlockIndex *tip = chainActive.Tip();
+    if (tip->GetBlockHash() != s_tip || Application::uahfChainState() != s_uahfState) {
+        const Consensus::Params &params = Params().GetConsensus();
+        s_flags = GetBlockScriptFlags(tip, ComputeBlockVersion(tip, params), GetAdjustedTime(), params);
+        s_tip = tip->GetBlockHash();
+        s_uahfState = Application::uahfChainState();
+    }
+    return s_flags;
+}
+
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
 static int64_t nTimeVerify = 0;
@@ -1890,6 +2034,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
     assert(hashPrevBlock == view.GetBestBlock());
+    if (fJustCheck) // the view is thrown away, skip hashing its changes.
+        view.DiscardCommitment();
 
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
@@ -1945,38 +2091,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    // BIP16 didn't become active until Apr 1 2012
-    int64_t nBIP16SwitchTime = 1333238400;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
-    // when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && IsSuperMajority(3, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
-
-    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
-    // blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 4 && IsSuperMajority(4, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
-
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    const unsigned int flags = GetBlockScriptFlags(pindex->pprev, block.nVersion, pindex->GetBlockTime(), chainparams.GetConsensus());
+    const bool fStrictPayToScriptHash = flags & SCRIPT_VERIFY_P2SH;
     int nLockTimeFlags = 0;
-    if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    if (flags & SCRIPT_VERIFY_CHECKSEQUENCEVERIFY)
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
-    }
-
-    if ((Application::uahfChainState() == Application::UAHFWaiting
-         && pindex->pprev->GetMedianTimePast() >= Application::uahfStartTime())
-            || Application::uahfChainState() >= Application::UAHFRulesActive) {
+    if (flags & SCRIPT_ENABLE_SIGHASH_FORKID)
         logInfo(8002) << "Connect block" << pindex->nHeight << "validating based on the idea that UAHF rules are active.";
-        flags |= SCRIPT_VERIFY_STRICTENC;
-        flags |= SCRIPT_ENABLE_SIGHASH_FORKID;
-    }
 
 
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
@@ -1984,6 +2105,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
+    // Shared by all script checks of this block, has to outlive 'control'.
+    CPubKeyParseCache pubkeyCache;
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     std::vector<int> prevheights;
@@ -1995,8 +2118,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
+    // The script checks queued in 'control' point into this, never grow it beyond its reserved size.
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(block.vtx.size());
     int nChecked = 0;
     int nOrphansChecked = 0;
+    std::vector<uint256> checkedTxs; // remembered when the block is only tested, like block templates are
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = block.vtx[i];
@@ -2046,6 +2173,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
+            // Scripts that passed with these flags before, typically at mempool acceptance, are not run again.
+            const bool fCheckScripts = fScriptChecks && !IsValidatedTransaction(tx.GetHash(), flags, !fJustCheck);
             // Only check inputs when the tx hash is not in the setPreVerifiedTxHash as would only
             // happen if this were a regular block or when a tx is found within the returning XThinblock.
             uint256 hash = tx.GetHash();
@@ -2054,10 +2183,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 nChecked++;
                 if (inOrphanCache)
                     nOrphansChecked++;
-                if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults,
-                            nScriptCheckThreads ? &vChecks : NULL))
+                txdata.emplace_back(tx);
+                if (!CheckInputs(tx, state, view, fCheckScripts, flags, fCacheResults, txdata.back(),
+                            nScriptCheckThreads ? &vChecks : NULL, &pubkeyCache))
                     return error("ConnectBlock(): CheckInputs on %s failed with %s",
                         tx.GetHash().ToString(), FormatStateMessage(state));
+                if (fJustCheck && fCheckScripts)
+                    checkedTxs.push_back(hash);
             }
             else {
                 setPreVerifiedTxHash.erase(hash);
@@ -2089,8 +2221,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (!control.Wait())
         return state.DoS(100, false);
+    BOOST_FOREACH(const uint256 &txid, checkedTxs)
+        AddValidatedTransaction(txid, flags);
     int64_t nTime4 = GetTimeMicros(); nTimeVerify += nTime4 - nTime2;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime4 - nTime2), nInputs <= 1 ? 0 : 0.001 * (nTime4 - nTime2) / (nInputs-1), nTimeVerify * 0.000001);
+    LogSignatureCacheStats();
 
     if (fJustCheck)
         return true;
@@ -2190,17 +2325,30 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     if (nLastSetChain == 0) {
         nLastSetChain = nNow;
     }
-    size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    // With a background writer the cache gets half of the budget, the other half is for the
+    // snapshot that is being written while the cache fills up again.
+    const size_t cacheBudget = pcoinsWriter ? nCoinCacheUsage / 2 : nCoinCacheUsage;
+    const size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
-    bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
+    bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > cacheBudget;
     // The cache is over the limit, we have to write now.
-    bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > nCoinCacheUsage;
+    bool fCacheCritical = mode == FLUSH_STATE_IF_NEEDED && cacheSize > cacheBudget;
     // It's been a while since we wrote the block index to disk. Do this frequently, so we don't need to redownload after a crash.
     bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && nNow > nLastWrite + (int64_t)DATABASE_WRITE_INTERVAL * 1000000;
     // It's been very long since we flushed the cache. Do this infrequently, to optimize cache usage.
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
     // Combine all conditions that result in a full cache flush.
     bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+    // Handing over the next snapshot would wait for the previous one under cs_main.
+    // While the cache and the snapshot in flight together fit in -dbcache, try again on a later block.
+    // Over that we wait after all and write synchronously, so the cache can't grow without limit.
+    bool fFlushSync = false;
+    if (fDoFullFlush && mode != FLUSH_STATE_ALWAYS && !fFlushForPrune && pcoinsWriter && pcoinsWriter->IsWriting()) {
+        if (fCacheCritical && cacheSize + pcoinsWriter->InFlightUsage() > nCoinCacheUsage)
+            fFlushSync = true;
+        else
+            fDoFullFlush = false;
+    }
     // Write blocks and block index to disk.
     if (fDoFullFlush || fPeriodicWrite) {
         // Depend on nMinDiskSpace to ensure we can write block index
@@ -2226,9 +2374,12 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
                 return AbortNode(state, "Files to write to block index database");
             }
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
+        // Finally remove any pruned files, the chainstate on disk may not need them anymore.
+        if (fFlushForPrune) {
+            if (pcoinsWriter && !pcoinsWriter->WaitForWrite())
+                return AbortNode(state, "Failed to write to coin database");
             UnlinkPrunedFiles(setFilesToPrune);
+        }
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2241,8 +2392,14 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Unless we are shutting down or pruning this is written in the background
+        // while we continue with an empty cache.
+        if (pcoinsWriter && mode != FLUSH_STATE_ALWAYS && !fFlushForPrune && !fFlushSync) {
+            if (!pcoinsTip->FlushInBackground(*pcoinsWriter))
+                return AbortNode(state, "Failed to write to coin database");
+        } else if (!pcoinsTip->Flush()) {
             return AbortNode(state, "Failed to write to coin database");
+        }
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2380,6 +2537,7 @@ bool static DisconnectTip(CValidationState& state, const Consensus::Params& cons
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
@@ -2396,8 +2554,23 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew, chainparams.GetConsensus()))
+        // The context-independent checks are done on the block buffer, ConnectBlock then skips them.
+        FastBlock fastBlock;
+        try {
+            fastBlock = Blocks::DB::instance()->loadBlock(pindexNew->GetBlockPos());
+            fastBlock.findTransactions();
+        } catch (const std::exception &e) {
+            return AbortNode(state, std::string("Failed to read block: ") + e.what());
+        }
+        if (fastBlock.createHash() != pindexNew->GetBlockHash())
             return AbortNode(state, "Failed to read block");
+        if (!CheckBlock(fastBlock, state)) {
+            if (state.IsInvalid())
+                InvalidBlockFound(pindexNew, state);
+            return error("ConnectTip(): CheckBlock %s failed", pindexNew->GetBlockHash().ToString());
+        }
+        block = fastBlock.createOldBlock();
+        block.fChecked = true;
         pblock = &block;
     }
 
@@ -2413,10 +2586,30 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         }
     }
 
+    int64_t nTimePrefetchStart = GetTimeMicros(); nTimeReadFromDisk += nTimePrefetchStart - nTime1;
+    LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTimePrefetchStart - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    if (nScriptCheckThreads) {
+        // Load the coins spent by this block in one parallel batch, so ConnectBlock finds them in the cache.
+        std::vector<uint256> txids;
+        std::set<uint256> createdHere;
+        for (const CTransaction &tx : pblock->vtx) {
+            if (!tx.IsCoinBase()) {
+                for (const CTxIn &in : tx.vin) {
+                    if (createdHere.find(in.prevout.hash) == createdHere.end())
+                        txids.push_back(in.prevout.hash);
+                }
+            }
+            createdHere.insert(tx.GetHash());
+        }
+        std::sort(txids.begin(), txids.end());
+        txids.erase(std::unique(txids.begin(), txids.end()), txids.end());
+        pcoinsTip->Prefetch(txids, &coinsprefetchqueue);
+    }
+
     // Apply the block atomically to the chain state.
-    int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
+    int64_t nTime2 = GetTimeMicros(); nTimePrefetch += nTime2 - nTimePrefetchStart;
     int64_t nTime3;
-    LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    LogPrint("bench", "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTime2 - nTimePrefetchStart) * 0.001, nTimePrefetch * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(*pblock, state, pindexNew, view);
@@ -2427,6 +2620,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
             return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
         mapBlockSource.erase(pindexNew->GetBlockHash());
+        ForgetBlockRelayedUnvalidated(pindexNew->GetBlockHash());
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         bool flushed = view.Flush();
@@ -3004,6 +3198,174 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     return true;
 }
 
+namespace {
+struct TxCheckResult {
+    bool isCoinBase;
+    unsigned int sigOps; // legacy sigop count
+    int nDoS;
+    std::string rejectReason; // empty when the transaction passed
+};
+
+/**
+ * FastBlock based version of CheckTransaction() that also returns the legacy sigop count and if
+ * this is a coinbase, without creating a CTransaction. The transaction is read once, the checks
+ * are then done in the order CheckTransaction() does them so the reject reason is the same.
+ */
+TxCheckResult CheckTransaction(const Tx &tx)
+{
+    TxCheckResult result;
+    result.isCoinBase = false;
+    result.sigOps = 0;
+    result.nDoS = 100;
+
+    std::set<COutPoint> inOutPoints;
+    COutPoint prevout;
+    bool hasNullPrevout = false;
+    bool hasDuplicateInput = false;
+    const char *valueError = nullptr; // the first output value problem
+    int coinbaseScriptSize = 0;
+    int inputCount = 0, outputCount = 0;
+    CAmount valueOut = 0;
+
+    Tx::Iterator iter(tx);
+    while (iter.next() != Tx::End) {
+        switch (iter.tag()) {
+        case Tx::PrevTxHash:
+            prevout.hash = iter.uint256Data();
+            break;
+        case Tx::PrevTxIndex:
+            prevout.n = iter.uintData();
+            ++inputCount;
+            if (!inOutPoints.insert(prevout).second)
+                hasDuplicateInput = true;
+            if (prevout.IsNull())
+                hasNullPrevout = true;
+            break;
+        case Tx::TxInScript:
+        case Tx::OutputScript: {
+            const Streaming::ConstBuffer data = iter.byteData();
+            const CScript script(reinterpret_cast<const unsigned char*>(data.begin()),
+                                 reinterpret_cast<const unsigned char*>(data.end()));
+            result.sigOps += script.GetSigOpCount(false);
+            if (inputCount == 1 && outputCount == 0)
+                coinbaseScriptSize = data.size();
+            break;
+        }
+        case Tx::OutputValue: {
+            ++outputCount;
+            if (valueError)
+                break;
+            const CAmount value = static_cast<CAmount>(iter.longData());
+            if (value < 0)
+                valueError = "bad-txns-vout-negative";
+            else if (value > MAX_MONEY)
+                valueError = "bad-txns-vout-toolarge";
+            else if (!MoneyRange(valueOut += value))
+                valueError = "bad-txns-txouttotal-toolarge";
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    result.isCoinBase = inputCount == 1 && hasNullPrevout;
+
+    if (inputCount == 0) {
+        result.nDoS = 10;
+        result.rejectReason = "bad-txns-vin-empty";
+    } else if (outputCount == 0) {
+        result.nDoS = 10;
+        result.rejectReason = "bad-txns-vout-empty";
+    } else if (static_cast<unsigned int>(tx.size()) > MAX_TX_SIZE) {
+        result.rejectReason = "bad-txns-oversize";
+    } else if (valueError) {
+        result.rejectReason = valueError;
+    } else if (hasDuplicateInput) {
+        result.rejectReason = "bad-txns-inputs-duplicate";
+    } else if (result.isCoinBase) {
+        if (coinbaseScriptSize < 2 || coinbaseScriptSize > 100)
+            result.rejectReason = "bad-cb-length";
+    } else if (hasNullPrevout) {
+        result.nDoS = 10;
+        result.rejectReason = "bad-txns-prevout-null";
+    }
+    return result;
+}
+
+CBlockHeader HeaderOf(const FastBlock &block)
+{
+    CBlockHeader header;
+    header.nVersion = block.blockVersion();
+    header.hashPrevBlock = block.previousBlockId();
+    header.hashMerkleRoot = block.merkleRoot();
+    header.nTime = block.timestamp();
+    header.nBits = block.bits();
+    header.nNonce = block.nonce();
+    return header;
+}
+}
+
+bool CheckBlock(const FastBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
+{
+    // The same checks, in the same order, as the CBlock based CheckBlock.
+    const CBlockHeader header = HeaderOf(block);
+    if (!CheckBlockHeader(header, state, fCheckPOW))
+        return false;
+
+    const std::vector<Tx> &transactions = block.transactions();
+    if (fCheckMerkleRoot) {
+        std::vector<uint256> leaves;
+        leaves.reserve(transactions.size());
+        for (const Tx &tx : transactions) {
+            leaves.push_back(tx.createHash());
+        }
+        bool mutated;
+        if (header.hashMerkleRoot != ComputeMerkleRoot(leaves, &mutated))
+            return state.DoS(100, error("CheckBlock(): hashMerkleRoot mismatch"),
+                             REJECT_INVALID, "bad-txnmrklroot", true);
+        if (mutated)
+            return state.DoS(100, error("CheckBlock(): duplicate transaction"),
+                             REJECT_INVALID, "bad-txns-duplicate", true);
+    }
+
+    if (transactions.empty())
+        return state.DoS(100, error("CheckBlock(): Missing coinbase tx"), REJECT_INVALID, "bad-blk-length");
+
+    std::vector<TxCheckResult> results;
+    results.reserve(transactions.size());
+    for (const Tx &tx : transactions) {
+        try {
+            results.push_back(CheckTransaction(tx));
+        } catch (const std::runtime_error &e) {
+            return state.DoS(100, error("CheckBlock(): %s", e.what()), REJECT_INVALID, "bad-txns-malformed");
+        }
+    }
+
+    if (!results[0].isCoinBase)
+        return state.DoS(100, error("CheckBlock(): first tx is not coinbase"),
+                         REJECT_INVALID, "bad-cb-missing");
+    for (size_t i = 1; i < results.size(); ++i) {
+        if (results[i].isCoinBase)
+            return state.DoS(100, error("CheckBlock(): more than one coinbase"),
+                             REJECT_INVALID, "bad-cb-multiple");
+    }
+
+    unsigned int nSigOps = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].rejectReason.empty()) {
+            state.DoS(results[i].nDoS, false, REJECT_INVALID, results[i].rejectReason);
+            return error("CheckBlock(): CheckTransaction of %s failed with %s",
+                transactions[i].createHash().ToString(), FormatStateMessage(state));
+        }
+        nSigOps += results[i].sigOps;
+    }
+    if (nSigOps > Policy::blockSigOpAcceptLimit(block.size()))
+        return state.DoS(100, error("CheckBlock(): out-of-bounds SigOpCount"),
+                         REJECT_INVALID, "bad-blk-sigops");
+
+    return true;
+}
+
 static bool CheckIndexAgainstCheckpoint(const CBlockIndex* pindexPrev, CValidationState& state, const CChainParams& chainparams, const uint256& hash)
 {
     if (*pindexPrev->phashBlock == chainparams.GetConsensus().hashGenesisBlock)
@@ -3250,11 +3612,8 @@ static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned
 }
 
 
-bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, CDiskBlockPos* dbp)
+static bool ProcessCheckedBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool checked, bool fForceProcessing, CDiskBlockPos* dbp)
 {
-    // Preliminary checks
-    bool checked = CheckBlock(*pblock, state);
-
     {
         LOCK(cs_main);
         bool fRequested = MarkBlockAsReceived(pblock->GetHash());
@@ -3280,6 +3639,26 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, c
     return true;
 }
 
+bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, CDiskBlockPos* dbp)
+{
+    // Preliminary checks
+    bool checked = CheckBlock(*pblock, state);
+    return ProcessCheckedBlock(state, chainparams, pfrom, pblock, checked, fForceProcessing, dbp);
+}
+
+bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const FastBlock &block, bool fForceProcessing, CDiskBlockPos* dbp)
+{
+    const bool checked = CheckBlock(block, state);
+    CBlock oldBlock;
+    if (checked) {
+        oldBlock = block.createOldBlock();
+        oldBlock.fChecked = true; // AcceptBlock and ConnectBlock skip the checks we just did
+    } else {
+        oldBlock = CBlock(HeaderOf(block)); // only the hash is used
+    }
+    return ProcessCheckedBlock(state, chainparams, pfrom, &oldBlock, checked, fForceProcessing, dbp);
+}
+
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     AssertLockHeld(cs_main);
@@ -3614,12 +3993,18 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
-        CBlock block;
         // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        FastBlock fastBlock;
+        try {
+            fastBlock = Blocks::DB::instance()->loadBlock(pindex->GetBlockPos());
+            fastBlock.findTransactions();
+        } catch (const std::exception &e) {
+            return error("VerifyDB(): *** loadBlock failed at %d, hash=%s (%s)", pindex->nHeight, pindex->GetBlockHash().ToString(), e.what());
+        }
+        if (fastBlock.createHash() != pindex->GetBlockHash())
+            return error("VerifyDB(): *** block hash doesn't match index at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state))
+        if (nCheckLevel >= 1 && !CheckBlock(fastBlock, state))
             return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 2: verify undo validity
         if (nCheckLevel >= 2 && pindex) {
@@ -3633,6 +4018,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
         if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
+            const CBlock block = fastBlock.createOldBlock();
             if (!DisconnectBlock(block, pindex, coins, &fClean))
                 return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
             pindexState = pindex->pprev;
@@ -3683,6 +4069,8 @@ void UnloadBlockIndex()
     nLastBlockFile = 0;
     nBlockSequenceId = 1;
     mapBlockSource.clear();
+    mapBlocksRelayedUnvalidated.clear();
+    blocksRelayedUnvalidatedOrder.clear();
     mapBlocksInFlight.clear();
     nPreferredDownload = 0;
     setDirtyBlockIndex.clear();
@@ -4063,7 +4451,25 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
                     bool sendFullBlock = true;
 
-                    if (inv.type == MSG_XTHINBLOCK) {
+                    if (inv.type == MSG_XTHINBLOCK && pfrom->nVersion >= SALTED_XTHIN_VERSION) {
+                        // A collision of short ids within the block is bound to the salt, so try another one.
+                        for (int attempt = 0; attempt < 3; ++attempt) {
+                            CXThinBlock xThinBlock(block, pfrom->pThinBlockFilter, XThinShortIdBytes());
+                            if (xThinBlock.collision)
+                                continue;
+                            CXThinBlock::Salted salted(xThinBlock);
+                            const int nSizeBlock = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+                            const int nSizeThinBlock = ::GetSerializeSize(salted, SER_NETWORK, PROTOCOL_VERSION);
+                            if (nSizeThinBlock < nSizeBlock) {
+                                pfrom->PushMessage(NetMsgType::XTHINBLOCK2, salted);
+                                sendFullBlock = false;
+                                LogPrint("thin", "Sent xthinblock2 - size: %d vs block size: %d => tx hashes: %d transactions: %d  peerid=%d\n",
+                                         nSizeThinBlock, nSizeBlock, xThinBlock.vTxHashes.size(), xThinBlock.vMissingTx.size(), pfrom->id);
+                            }
+                            break;
+                        }
+                    }
+                    else if (inv.type == MSG_XTHINBLOCK) {
                         CXThinBlock xThinBlock(block, pfrom->pThinBlockFilter);
                         if (!xThinBlock.collision) {
                             const int nSizeBlock = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
@@ -4884,7 +5290,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         pfrom->vRecvGetData.insert(pfrom->vRecvGetData.end(), inv);
         ProcessGetData(pfrom, chainparams.GetConsensus());
     }
-    else if (strCommand == NetMsgType::XTHINBLOCK  && !fImporting && !fReindex) // Ignore blocks received while importing
+    else if ((strCommand == NetMsgType::XTHINBLOCK || strCommand == NetMsgType::XTHINBLOCK2) && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         if (!xthinEnabled) {
             LOCK(cs_main);
@@ -4892,7 +5298,12 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             return false;
         }
         CXThinBlock thinBlock;
-        vRecv >> thinBlock;
+        if (strCommand == NetMsgType::XTHINBLOCK2) {
+            CXThinBlock::Salted salted(thinBlock);
+            vRecv >> salted;
+        } else {
+            vRecv >> thinBlock;
+        }
 
         // Send expedited ASAP
         CValidationState state;
@@ -4901,7 +5312,8 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             Misbehaving(pfrom->id, 20);
             return false;
         }
-        else if (!IsRecentlyExpeditedAndStore(thinBlock.header.GetHash()))
+        // Expedited blocks use the legacy short ids, an xthinblock2 is forwarded once it is reconstructed.
+        else if (thinBlock.shortIdBytes == 0 && !IsRecentlyExpeditedAndStore(thinBlock.header.GetHash()))
             SendExpeditedBlock(thinBlock, 0, pfrom);
 
         CInv inv(MSG_BLOCK, thinBlock.header.GetHash());
@@ -4946,10 +5358,13 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             return true;
         }
 
-        // Create the mapMissingTx from all the supplied tx's in the xthinblock
-        std::map<uint64_t, CTransaction> mapMissingTx;
-        BOOST_FOREACH(CTransaction tx, thinBlockTx.vMissingTx) {
-            mapMissingTx[tx.GetHash().GetCheapHash()] = tx;
+        // Index the supplied tx's in the xthinblock, they are copied only once, into the block.
+        CXThinShortIds shortIds;
+        if (pfrom->xThinBlockShortIdBytes)
+            shortIds = CXThinShortIds(pfrom->thinBlock.GetBlockHeader(), pfrom->xThinBlockShortIdNonce, pfrom->xThinBlockShortIdBytes);
+        std::map<uint64_t, const CTransaction*> mapMissingTx;
+        BOOST_FOREACH(const CTransaction &tx, thinBlockTx.vMissingTx) {
+            mapMissingTx[shortIds(tx.GetHash())] = &tx;
         }
 
         int count=0;
@@ -4957,7 +5372,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             if (pfrom->thinBlock.vtx[i].IsNull()) {
                 auto val = mapMissingTx.find(pfrom->xThinBlockHashes[i]);
                 if (val != mapMissingTx.end()) {
-                    pfrom->thinBlock.vtx[i] = val->second;
+                    pfrom->thinBlock.vtx[i] = *val->second;
                     --pfrom->thinBlockWaitingForTxns;
                 }
                 count++;
@@ -4997,7 +5412,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         }
     }
 
-    else if (strCommand == NetMsgType::GET_XBLOCKTX && !fImporting && !fReindex) // return Re-requested xthinblock transactions
+    else if ((strCommand == NetMsgType::GET_XBLOCKTX || strCommand == NetMsgType::GET_XBLOCKTX2) && !fImporting && !fReindex) // return Re-requested xthinblock transactions
     {
         if (!xthinEnabled) {
             LOCK(cs_main);
@@ -5005,9 +5420,15 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             return false;
         }
         CXRequestThinBlockTx thinRequestBlockTx;
-        vRecv >> thinRequestBlockTx;
+        CXRequestThinBlockTx2 thinRequestBlockTx2;
+        if (strCommand == NetMsgType::GET_XBLOCKTX2) {
+            vRecv >> thinRequestBlockTx2;
+            thinRequestBlockTx.blockhash = thinRequestBlockTx2.blockhash;
+        } else {
+            vRecv >> thinRequestBlockTx;
+        }
 
-        if (thinRequestBlockTx.setCheapHashesToRequest.empty()) { // empty request??
+        if (thinRequestBlockTx.setCheapHashesToRequest.empty() && thinRequestBlockTx2.indexes.empty()) { // empty request??
             LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
             return false;
@@ -5059,8 +5480,17 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         }
 
         std::vector<CTransaction> vTx;
+        for (size_t i = 0; i < thinRequestBlockTx2.indexes.size(); ++i) {
+            const uint32_t index = thinRequestBlockTx2.indexes[i];
+            // indexes have to be ascending, which also rules out asking for the same transaction many times over.
+            if (index >= block.vtx.size() || (i > 0 && index <= thinRequestBlockTx2.indexes[i - 1])) {
+                Misbehaving(pfrom->GetId(), 100);
+                return false;
+            }
+            vTx.push_back(block.vtx[index]);
+        }
         int todo = thinRequestBlockTx.setCheapHashesToRequest.size();
-        for (size_t i = 1; i < block.vtx.size(); i++) {
+        for (size_t i = 1; todo > 0 && i < block.vtx.size(); i++) {
             uint64_t cheapHash = block.vtx[i].GetHash().GetCheapHash();
             if (thinRequestBlockTx.setCheapHashesToRequest.count(cheapHash)) {
                 vTx.push_back(block.vtx[i]);
@@ -5408,8 +5838,8 @@ bool ProcessMessages(CNode* pfrom)
         //            msg.hdr.nMessageSize, msg.vRecv.size(),
         //            msg.complete() ? "Y" : "N");
 
-        // end, if an incomplete message is found
-        if (!msg.complete())
+        // end, if an incomplete message, or one still being checksummed, is found
+        if (!msg.checked())
             break;
 
         // at this point, any failure means we can delete the current message
@@ -5460,14 +5890,12 @@ bool ProcessMessages(CNode* pfrom)
         // Message size
         unsigned int nMessageSize = hdr.nMessageSize;
 
-        // Checksum
+        // Checksum, verified by the network layer when the message was completed
         CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
-        unsigned int nChecksum = ReadLE32((unsigned char*)&hash);
-        if (nChecksum != hdr.nChecksum)
+        if (!msg.checksumValid())
         {
-            LogPrintf("%s(%s, %u bytes): CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n", __func__,
-               SanitizeString(strCommand), nMessageSize, nChecksum, hdr.nChecksum);
+            LogPrintf("%s(%s, %u bytes): CHECKSUM ERROR hdr.nChecksum=%08x\n", __func__,
+               SanitizeString(strCommand), nMessageSize, hdr.nChecksum);
             continue;
         }
 
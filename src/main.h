@@ -33,14 +33,20 @@
 class CBlockIndex;
 class CBloomFilter;
 class CChainParams;
+class CCoinsViewBackgroundWriter;
+class CCoinsViewDB;
 class CInv;
+class CPubKeyParseCache;
 class CScriptCheck;
 class CTxMemPool;
 class CValidationInterface;
 class CValidationState;
+class FastBlock;
+class Tx;
 
 struct CNodeStateStats;
 struct LockPoints;
+struct PrecomputedTransactionData;
 
 /** Default for DEFAULT_WHITELISTRELAY. */
 static const bool DEFAULT_WHITELISTRELAY = true;
@@ -110,6 +116,10 @@ static const unsigned int DEFAULT_BYTES_PER_SIGOP = 20;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
+/** Misbehavior score for a peer that relayed a block ahead of validation which then failed to connect */
+static const int UNVALIDATED_RELAY_INVALID_BLOCK_SCORE = 50;
+/** The maximum number of blocks remembered as relayed to us ahead of validation */
+static const unsigned int MAX_BLOCKS_RELAYED_UNVALIDATED = 100;
 
 static const bool DEFAULT_TESTSAFEMODE = false;
 
@@ -194,6 +204,12 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
  * @return True if state.IsValid()
  */
 bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, CDiskBlockPos* dbp);
+/**
+ * Like the CBlock based ProcessNewBlock, but the context-independent checks are done on the
+ * \a block buffer and a CBlock is only created for a block that passed them.
+ * Expects block.findTransactions() to have been called.
+ */
+bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const FastBlock &block, bool fForceProcessing, CDiskBlockPos* dbp);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 /** Initialize a new block tree database + block data on disk */
@@ -212,6 +228,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread that loads the coins of a block in parallel */
+void ThreadCoinsPrefetch();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -256,6 +274,12 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
+/**
+ * Remember that the block was relayed to us by \a nodeid before it validated it, as expedited blocks are.
+ * Call this only for blocks that passed CheckBlock. Should it fail to connect that peer is punished with
+ * UNVALIDATED_RELAY_INVALID_BLOCK_SCORE instead of being banned outright.
+ */
+void MarkBlockAsRelayedUnvalidated(const uint256 &hash, NodeId nodeid);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
@@ -325,9 +349,12 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
  * instead of being performed inline.
+ * The txdata is referenced by the script checks and has to outlive them.
+ * The optional pubkeyCache is shared by all the script checks of a block and has to outlive them too.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheStore, const PrecomputedTransactionData& txdata,
+                 std::vector<CScriptCheck> *pvChecks = NULL, CPubKeyParseCache *pubkeyCache = NULL);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, int nHeight);
@@ -388,13 +415,17 @@ private:
     unsigned int nFlags;
     bool cacheStore;
     ScriptError error;
+    const PrecomputedTransactionData *txdata;
+    CPubKeyParseCache *pubkeyCache;
 
 public:
-    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
+    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(0), pubkeyCache(0) {}
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn,
+                 const PrecomputedTransactionData* txdataIn, CPubKeyParseCache *pubkeyCacheIn = 0) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
         amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn),
+        pubkeyCache(pubkeyCacheIn) { }
 
     bool operator()();
 
@@ -406,6 +437,8 @@ public:
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
+        std::swap(txdata, check.txdata);
+        std::swap(pubkeyCache, check.pubkeyCache);
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -431,6 +464,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/**
+ * Same checks as the CBlock based CheckBlock, but reads the transactions in-place from the block
+ * buffer. Expects block.findTransactions() to have been called.
+ */
+bool CheckBlock(const FastBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
@@ -526,6 +564,12 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** The base of pcoinsTip which writes it to the database in the background, may be NULL (protected by cs_main) */
+extern CCoinsViewBackgroundWriter *pcoinsWriter;
+
+/** The database at the bottom of pcoinsTip, may be NULL (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
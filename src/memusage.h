@@ -1,4 +1,5 @@
 // Copyright (c) 2015 The Bitcoin developers
+// Copyright (c) 2017 Tom Zander <tomz@freedommail.ch>
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -10,6 +11,8 @@
 #include <set>
 #include <vector>
 
+#include "support/allocators/pool.h"
+
 #include <boost/foreach.hpp>
 #include <boost/unordered_set.hpp>
 #include <boost/unordered_map.hpp>
@@ -126,6 +129,16 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+/**
+ * A map using a PoolAllocator reports what its resource holds, nodes and bucket array.
+ * Memory owned by the mapped values (like a vector member) is not part of that.
+ */
+template<typename X, typename Y, typename Z, typename E, std::size_t M, std::size_t A>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, E, PoolAllocator<std::pair<const X, Y>, M, A> >& m)
+{
+    return m.get_allocator().resource()->usage();
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -30,7 +30,10 @@
 #include "validationinterface.h"
 #include "utilstrencodings.h"
 
+#include <boost/bind.hpp>
 #include <boost/tuple/tuple.hpp>
+#include <boost/unordered_set.hpp>
+#include <limits>
 #include <queue>
 #include <script/standard.cpp>
 
@@ -93,42 +96,156 @@ void Mining::SetCoinbase(const CScript &coinbase)
 }
 
 
-CBlockTemplate* Mining::CreateNewBlock(const CChainParams& chainparams) const
+namespace {
+/**
+ * The transactions of the next block, kept up to date with the mempool.
+ *
+ * Selecting transactions walks the whole mempool, so we do that once per tip and
+ * after that append transactions as the mempool accepts them. Changes we can not
+ * follow that way (a template transaction leaving the mempool, a prioritisation,
+ * a better paying transaction that no longer fits) make the next user rebuild it.
+ *
+ * All members are protected by mempool.cs.
+ */
+class IncrementalTemplate
 {
-    // Create new block
-    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if(!pblocktemplate.get())
-        return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
-    pblock->nTime = GetAdjustedTime();
+public:
+    static IncrementalTemplate &instance();
+
+    /// returns true if the template still reflects the mempool and builds on top of \a tip
+    bool isCurrent(const CBlockIndex *tip) const;
+    /// select the transactions for a block on top of \a tip from scratch
+    void rebuild(const CBlockIndex *tip);
+
+    CBlockTemplate content; // the first transaction is a placeholder for the coinbase
+    uint64_t blockSize;
+    uint64_t blockTx;
+    unsigned int blockSigOps;
+    CAmount fees;
+    /// the coinbase the transactions in content passed TestBlockValidity with, null when they didn't.
+    uint256 validatedCoinbase;
+
+private:
+    IncrementalTemplate();
+    void entryAdded(CTxMemPool::txiter iter);
+    void entryRemoved(CTxMemPool::txiter iter);
+    void append(CTxMemPool::txiter iter);
+
+    uint256 m_tip; // null when a rebuild is needed
+    int m_height;
+    int64_t m_medianTimePast;
+    int64_t m_lockTimeCutoff;
+    uint32_t m_blockMaxSize;
+    uint32_t m_blockMinSize;
+    unsigned int m_mempoolUpdates; // the mempool.GetTransactionsUpdated() we have seen
+    double m_lowestFeeRate;
+    boost::unordered_set<uint256, SaltedTxidHasher> m_txids;
+
+    boost::signals2::scoped_connection m_addedConnection;
+    boost::signals2::scoped_connection m_removedConnection;
+};
 
-    // Create coinbase tx
-    CMutableTransaction txNew;
-    txNew.vin.resize(1);
-    txNew.vin[0].prevout.SetNull();
-    txNew.vout.resize(1);
-    {
-        std::lock_guard<std::mutex> lock(m_lock);
-        if (m_coinbase.empty())
-            throw std::runtime_error("Require coinbase to be set before mining");
-        txNew.vout[0].scriptPubKey = m_coinbase;
+const uint32_t nCoinbaseReserveSize = 1000;
+
+IncrementalTemplate::IncrementalTemplate()
+    : blockSize(0),
+    blockTx(0),
+    blockSigOps(0),
+    fees(0),
+    m_height(0),
+    m_medianTimePast(0),
+    m_lockTimeCutoff(0),
+    m_blockMaxSize(0),
+    m_blockMinSize(0),
+    m_mempoolUpdates(0),
+    m_lowestFeeRate(0),
+    m_addedConnection(mempool.NotifyEntryAdded.connect(boost::bind(&IncrementalTemplate::entryAdded, this, _1))),
+    m_removedConnection(mempool.NotifyEntryRemoved.connect(boost::bind(&IncrementalTemplate::entryRemoved, this, _1)))
+{
+}
+
+IncrementalTemplate &IncrementalTemplate::instance()
+{
+    static IncrementalTemplate s_template;
+    return s_template;
+}
+
+bool IncrementalTemplate::isCurrent(const CBlockIndex *tip) const
+{
+    return !m_tip.IsNull() && m_tip == tip->GetBlockHash() && m_height == tip->nHeight + 1
+            && m_medianTimePast == tip->GetMedianTimePast()
+            && m_mempoolUpdates == mempool.GetTransactionsUpdated();
+}
+
+void IncrementalTemplate::append(CTxMemPool::txiter iter)
+{
+    content.block.vtx.push_back(iter->GetTx());
+    content.vTxFees.push_back(iter->GetFee());
+    content.vTxSigOps.push_back(iter->GetSigOpCount());
+    blockSize += iter->GetTxSize();
+    ++blockTx;
+    blockSigOps += iter->GetSigOpCount();
+    fees += iter->GetFee();
+    m_lowestFeeRate = std::min(m_lowestFeeRate, iter->GetModFeeRate());
+    m_txids.insert(iter->GetTx().GetHash());
+}
+
+void IncrementalTemplate::entryAdded(CTxMemPool::txiter iter)
+{
+    ++m_mempoolUpdates;
+    if (m_tip.IsNull())
+        return;
+
+    BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter)) {
+        if (!m_txids.count(parent->GetTx().GetHash()))
+            return; // the parent did not make it into the block, so the child can't either
+    }
+
+    const unsigned int nTxSize = iter->GetTxSize();
+    if (iter->GetModifiedFee() < ::minRelayTxFee.GetFee(nTxSize) && blockSize >= m_blockMinSize)
+        return;
+    if (!IsFinalTx(iter->GetTx(), m_height, m_lockTimeCutoff))
+        return;
+    const uint64_t maxSigOps = Policy::blockSigOpAcceptLimit(blockSize + nTxSize - nCoinbaseReserveSize);
+    if (blockSize + nTxSize >= m_blockMaxSize || blockSigOps + iter->GetSigOpCount() >= maxSigOps) {
+        // the block is full, only worth selecting again if this pays better than what we have.
+        if (iter->GetModFeeRate() > m_lowestFeeRate)
+            m_tip.SetNull();
+        return;
     }
+    append(iter);
+    validatedCoinbase.SetNull();
+}
+
+void IncrementalTemplate::entryRemoved(CTxMemPool::txiter iter)
+{
+    ++m_mempoolUpdates;
+    if (!m_tip.IsNull() && m_txids.count(iter->GetTx().GetHash()))
+        m_tip.SetNull();
+}
+
+void IncrementalTemplate::rebuild(const CBlockIndex *pindexPrev)
+{
+    content = CBlockTemplate();
+    m_txids.clear();
+    m_lowestFeeRate = std::numeric_limits<double>::max();
+    validatedCoinbase.SetNull();
 
     // Add dummy coinbase tx as first transaction
-    pblock->vtx.push_back(CTransaction());
-    pblocktemplate->vTxFees.push_back(-1); // updated at end
-    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+    content.block.vtx.push_back(CTransaction());
+    content.vTxFees.push_back(-1); // updated by CreateNewBlock
+    content.vTxSigOps.push_back(-1); // updated by CreateNewBlock
 
     // Largest block you're willing to create (in bytes):
-    uint32_t nBlockMaxSize = std::max<uint32_t>(1000, GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE));
+    m_blockMaxSize = std::max<uint32_t>(1000, GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE));
 
     // How much of the block should be dedicated to high-priority transactions,
     // included regardless of the fees they pay
-    const uint32_t nBlockPrioritySize = std::min<uint32_t>(GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE), nBlockMaxSize);
+    const uint32_t nBlockPrioritySize = std::min<uint32_t>(GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE), m_blockMaxSize);
 
     // Minimum block size you want to create; block will be filled with free transactions
     // until there are no more or the block reaches this size:
-    uint32_t nBlockMinSize = std::min<uint32_t>(GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE), nBlockMaxSize);
+    m_blockMinSize = std::min<uint32_t>(GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE), m_blockMaxSize);
 
     // Collect memory pool transactions into the block
     CTxMemPool::setEntries inBlock;
@@ -143,176 +260,197 @@ CBlockTemplate* Mining::CreateNewBlock(const CChainParams& chainparams) const
 
     std::priority_queue<CTxMemPool::txiter, std::vector<CTxMemPool::txiter>, ScoreCompare> clearedTxs;
     bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
-    const uint32_t nCoinbaseReserveSize = 1000;
-    uint64_t nBlockSize = nCoinbaseReserveSize;
-    uint64_t nBlockTx = 0;
-    unsigned int nBlockSigOps = 100;
+    blockSize = nCoinbaseReserveSize;
+    blockTx = 0;
+    blockSigOps = 100;
+    fees = 0;
     int lastFewTxs = 0;
-    CAmount nFees = 0;
-    bool fCreatedValidBlock = false;
 
-    {
-        LOCK2(cs_main, mempool.cs);
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        assert(pindexPrev); // genesis should be present.
+    m_tip = pindexPrev->GetBlockHash();
+    m_height = pindexPrev->nHeight + 1;
+    m_medianTimePast = pindexPrev->GetMedianTimePast();
+    m_lockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                            ? m_medianTimePast
+                            : std::max(m_medianTimePast + 1, GetAdjustedTime());
+    m_mempoolUpdates = mempool.GetTransactionsUpdated();
+
+    bool fPriorityBlock = nBlockPrioritySize > 0;
+    if (fPriorityBlock) {
+        vecPriority.reserve(mempool.mapTx.size());
+        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+             mi != mempool.mapTx.end(); ++mi)
+        {
+            double dPriority = mi->GetPriority(m_height);
+            CAmount dummy;
+            mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+            vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+        }
+        std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+    }
 
-        const int nHeight = pindexPrev->nHeight + 1;
-        const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
+    CTxMemPool::indexed_transaction_set::nth_index<3>::type::iterator mi = mempool.mapTx.get<3>().begin();
+    CTxMemPool::txiter iter;
 
-        pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
-        // -regtest only: allow overriding block.nVersion with
-        // -blockversion=N to test forking scenarios
-        if (chainparams.MineBlocksOnDemand())
-            pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+    while (mi != mempool.mapTx.get<3>().end() || !clearedTxs.empty())
+    {
+        bool priorityTx = false;
+        if (fPriorityBlock && !vecPriority.empty()) { // add a tx from priority queue to fill the blockprioritysize
+            priorityTx = true;
+            iter = vecPriority.front().second;
+            actualPriority = vecPriority.front().first;
+            std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+            vecPriority.pop_back();
+        }
+        else if (clearedTxs.empty()) { // add tx with next highest score
+            iter = mempool.mapTx.project<0>(mi);
+            mi++;
+        }
+        else {  // try to add a previously postponed child tx
+            iter = clearedTxs.top();
+            clearedTxs.pop();
+        }
 
-        UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
+        if (inBlock.count(iter))
+            continue; // could have been added to the priorityBlock
 
-        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                ? nMedianTimePast
-                                : pblock->GetBlockTime();
+        const CTransaction& tx = iter->GetTx();
 
-        bool fPriorityBlock = nBlockPrioritySize > 0;
-        if (fPriorityBlock) {
-            vecPriority.reserve(mempool.mapTx.size());
-            for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-                 mi != mempool.mapTx.end(); ++mi)
-            {
-                double dPriority = mi->GetPriority(nHeight);
-                CAmount dummy;
-                mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
-                vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+        bool fOrphan = false;
+        BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
+        {
+            if (!inBlock.count(parent)) {
+                fOrphan = true;
+                break;
             }
-            std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        }
+        if (fOrphan) {
+            if (priorityTx)
+                waitPriMap.insert(std::make_pair(iter,actualPriority));
+            else
+                waitSet.insert(iter);
+            continue;
         }
 
-        CTxMemPool::indexed_transaction_set::nth_index<3>::type::iterator mi = mempool.mapTx.get<3>().begin();
-        CTxMemPool::txiter iter;
-
-        while (mi != mempool.mapTx.get<3>().end() || !clearedTxs.empty())
-        {
-            bool priorityTx = false;
-            if (fPriorityBlock && !vecPriority.empty()) { // add a tx from priority queue to fill the blockprioritysize
-                priorityTx = true;
-                iter = vecPriority.front().second;
-                actualPriority = vecPriority.front().first;
-                std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                vecPriority.pop_back();
+        unsigned int nTxSize = iter->GetTxSize();
+        if (fPriorityBlock &&
+            (blockSize + nTxSize >= nBlockPrioritySize || !AllowFree(actualPriority))) {
+            fPriorityBlock = false;
+            waitPriMap.clear();
+        }
+        if (!priorityTx &&
+            (iter->GetModifiedFee() < ::minRelayTxFee.GetFee(nTxSize) && blockSize >= m_blockMinSize)) {
+            break;
+        }
+        if (blockSize + nTxSize >= m_blockMaxSize) {
+            if (blockSize >  m_blockMaxSize - 100 || lastFewTxs > 50) {
+                break;
             }
-            else if (clearedTxs.empty()) { // add tx with next highest score
-                iter = mempool.mapTx.project<0>(mi);
-                mi++;
+            // Once we're within 1000 bytes of a full block, only look at 50 more txs
+            // to try to fill the remaining space.
+            if (blockSize > m_blockMaxSize - 1000) {
+                lastFewTxs++;
             }
-            else {  // try to add a previously postponed child tx
-                iter = clearedTxs.top();
-                clearedTxs.pop();
+            continue;
+        }
+
+        if (!IsFinalTx(tx, m_height, m_lockTimeCutoff))
+            continue;
+
+        const uint64_t maxSigOps = Policy::blockSigOpAcceptLimit(blockSize + nTxSize - nCoinbaseReserveSize);
+        unsigned int nTxSigOps = iter->GetSigOpCount();
+        if (blockSigOps + nTxSigOps >= maxSigOps) {
+            if (blockSigOps > maxSigOps - 2) {
+                break;
             }
+            continue;
+        }
 
-            if (inBlock.count(iter))
-                continue; // could have been added to the priorityBlock
+        // Added
+        append(iter);
 
-            const CTransaction& tx = iter->GetTx();
+        if (fPrintPriority)
+        {
+            double dPriority = iter->GetPriority(m_height);
+            CAmount dummy;
+            mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
+            LogPrintf("priority %.1f fee %s txid %s\n",
+                      dPriority , CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
+        }
 
-            bool fOrphan = false;
-            BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
-            {
-                if (!inBlock.count(parent)) {
-                    fOrphan = true;
-                    break;
-                }
-            }
-            if (fOrphan) {
-                if (priorityTx)
-                    waitPriMap.insert(std::make_pair(iter,actualPriority));
-                else
-                    waitSet.insert(iter);
-                continue;
-            }
+        inBlock.insert(iter);
 
-            unsigned int nTxSize = iter->GetTxSize();
-            if (fPriorityBlock &&
-                (nBlockSize + nTxSize >= nBlockPrioritySize || !AllowFree(actualPriority))) {
-                fPriorityBlock = false;
-                waitPriMap.clear();
-            }
-            if (!priorityTx &&
-                (iter->GetModifiedFee() < ::minRelayTxFee.GetFee(nTxSize) && nBlockSize >= nBlockMinSize)) {
-                break;
-            }
-            if (nBlockSize + nTxSize >= nBlockMaxSize) {
-                if (nBlockSize >  nBlockMaxSize - 100 || lastFewTxs > 50) {
-                    break;
+        // Add transactions that depend on this one to the priority queue
+        BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
+        {
+            if (fPriorityBlock) {
+                waitPriIter wpiter = waitPriMap.find(child);
+                if (wpiter != waitPriMap.end()) {
+                    vecPriority.push_back(TxCoinAgePriority(wpiter->second,child));
+                    std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                    waitPriMap.erase(wpiter);
                 }
-                // Once we're within 1000 bytes of a full block, only look at 50 more txs
-                // to try to fill the remaining space.
-                if (nBlockSize > nBlockMaxSize - 1000) {
-                    lastFewTxs++;
+            }
+            else {
+                if (waitSet.count(child)) {
+                    clearedTxs.push(child);
+                    waitSet.erase(child);
                 }
-                continue;
             }
+        }
+    }
+}
+}
 
-            if (!IsFinalTx(tx, nHeight, nLockTimeCutoff))
-                continue;
+CBlockTemplate* Mining::CreateNewBlock(const CChainParams& chainparams) const
+{
+    // Create coinbase tx
+    CMutableTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_coinbase.empty())
+            throw std::runtime_error("Require coinbase to be set before mining");
+        txNew.vout[0].scriptPubKey = m_coinbase;
+    }
 
-            const uint64_t maxSigOps = Policy::blockSigOpAcceptLimit(nBlockSize + nTxSize - nCoinbaseReserveSize);
-            unsigned int nTxSigOps = iter->GetSigOpCount();
-            if (nBlockSigOps + nTxSigOps >= maxSigOps) {
-                if (nBlockSigOps > maxSigOps - 2) {
-                    break;
-                }
-                continue;
-            }
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    bool fCreatedValidBlock = false;
 
-            CAmount nTxFees = iter->GetFee();
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority)
-            {
-                double dPriority = iter->GetPriority(nHeight);
-                CAmount dummy;
-                mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                          dPriority , CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
-            }
+    {
+        LOCK2(cs_main, mempool.cs);
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        assert(pindexPrev); // genesis should be present.
 
-            inBlock.insert(iter);
+        const int nHeight = pindexPrev->nHeight + 1;
 
-            // Add transactions that depend on this one to the priority queue
-            BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
-            {
-                if (fPriorityBlock) {
-                    waitPriIter wpiter = waitPriMap.find(child);
-                    if (wpiter != waitPriMap.end()) {
-                        vecPriority.push_back(TxCoinAgePriority(wpiter->second,child));
-                        std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                        waitPriMap.erase(wpiter);
-                    }
-                }
-                else {
-                    if (waitSet.count(child)) {
-                        clearedTxs.push(child);
-                        waitSet.erase(child);
-                    }
-                }
-            }
-        }
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-        LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOps);
+        IncrementalTemplate &cache = IncrementalTemplate::instance();
+        if (!cache.isCurrent(pindexPrev))
+            cache.rebuild(pindexPrev);
+
+        // Create new block
+        pblocktemplate.reset(new CBlockTemplate(cache.content));
+        CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+        pblock->nTime = GetAdjustedTime();
+
+        pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
+        // -regtest only: allow overriding block.nVersion with
+        // -blockversion=N to test forking scenarios
+        if (chainparams.MineBlocksOnDemand())
+            pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+
+        nLastBlockTx = cache.blockTx;
+        nLastBlockSize = cache.blockSize;
+        LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", cache.blockSize, cache.blockTx, cache.fees, cache.blockSigOps);
 
         // Compute final coinbase transaction.
         if (flexTransActive.load())
             txNew.nVersion = 4;
-        txNew.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+        txNew.vout[0].nValue = cache.fees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
         txNew.vin[0].scriptSig = CScript() << nHeight << OP_0 << m_coinbaseComment;
         pblock->vtx[0] = txNew;
-        pblocktemplate->vTxFees[0] = -nFees;
+        pblocktemplate->vTxFees[0] = -cache.fees;
 
         // Fill in header
         pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
@@ -321,9 +459,15 @@ CBlockTemplate* Mining::CreateNewBlock(const CChainParams& chainparams) const
         pblock->nNonce         = 0;
         pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
 
+        // The block is only validated when its transactions changed since the last block we handed out,
+        // or the coinbase did (a new coinbase script, comment or fees).
         CValidationState state;
-        fCreatedValidBlock = TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false);
-        if (!fCreatedValidBlock) {
+        const uint256 coinbaseHash = pblock->vtx[0].GetHash();
+        fCreatedValidBlock = cache.validatedCoinbase == coinbaseHash
+                || TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false);
+        if (fCreatedValidBlock) {
+            cache.validatedCoinbase = coinbaseHash;
+        } else {
             if (pblock->vtx.size() <= 1) {
                 // This should REALLY never happen! Empty block that is invalid.
                 throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", 
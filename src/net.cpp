@@ -31,6 +31,11 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#define USE_EPOLL
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -90,6 +95,10 @@ bool fAddressesInitialized = false;
 
 std::vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
+#ifdef USE_EPOLL
+// nodes added to vNodes whose socket ThreadSocketHandler has not registered with epoll yet, guarded by cs_vNodes.
+static std::vector<CNode*> vNodesNew;
+#endif
 std::map<CInv, CDataStream> mapRelay;
 std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
@@ -413,6 +422,9 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
         {
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
+#ifdef USE_EPOLL
+            vNodesNew.push_back(pnode);
+#endif
         }
 
         pnode->nTimeConnected = GetTime();
@@ -438,7 +450,7 @@ void CNode::CloseSocketDisconnect()
 
     // in case this fails, we'll empty the recv buffer when the CNode is deleted
     TRY_LOCK(cs_vRecvMsg, lockRecv);
-    if (lockRecv)
+    if (lockRecv && nChecksumJobs == 0)
         vRecvMsg.clear();
 }
 
@@ -685,13 +697,35 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            if (msg.hdr.nMessageSize < PARALLEL_CHECKSUM_MIN_SIZE) {
+                msg.verifyChecksum();
+                messageHandlerCondition.notify_one();
+            } else {
+                // Hashing a block sized payload takes a while, do that on the thread pool so the
+                // messages of other peers are not held up. The message stays in place in the deque
+                // and ProcessMessages() won't touch it until its checksum has been checked.
+                ++nChecksumJobs;
+                CNetMessage *pmsg = &msg;
+                Application::instance()->ioService().post([this, pmsg]() {
+                    pmsg->verifyChecksum();
+                    --nChecksumJobs;
+                    messageHandlerCondition.notify_one();
+                });
+            }
         }
     }
 
     return true;
 }
 
+void CNetMessage::verifyChecksum()
+{
+    assert(complete());
+    const uint256 hash = Hash(vRecv.begin(), vRecv.begin() + hdr.nMessageSize);
+    const bool valid = ReadLE32(hash.begin()) == hdr.nChecksum;
+    *checksumState = valid ? ChecksumValid : ChecksumInvalid;
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
@@ -975,12 +1009,14 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
+#ifndef USE_EPOLL
     if (!IsSelectableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
         return;
     }
+#endif
 
     // According to the internet TCP_NODELAY is not carried into accepted sockets
     // on all platforms.  Set it again here just to be sure.
@@ -1017,14 +1053,109 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+#ifdef USE_EPOLL
+        vNodesNew.push_back(pnode);
+#endif
+    }
+}
+
+static void CheckInactivity(CNode *pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+namespace {
+struct EpollHandle {
+    EpollHandle() : fd(epoll_create1(EPOLL_CLOEXEC)) {}
+    ~EpollHandle() {
+        if (fd >= 0)
+            close(fd);
     }
+    const int fd;
+};
+
+/**
+ * The readiness of a node is kept until it is used, so the socket thread can hold back like the
+ * select() version does: drain the send queue before receiving more and respect the receive flood size.
+ */
+bool CanReceive(CNode *pnode)
+{
+    {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (!lockSend || !pnode->vSendMsg.empty())
+            return false;
+    }
+    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+    return lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                        pnode->GetTotalRecvSize() <= ReceiveFloodSize());
+}
 }
+#endif
 
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+#ifdef USE_EPOLL
+    // Sockets are registered edge triggered once, and stay registered until they are closed, which
+    // removes them automatically. A node with events is kept in vNodesReady, holding a reference,
+    // until all its events are handled, only those nodes are serviced.
+    std::vector<CNode*> vNodesReady;
+    int64_t nLastInactivityCheck = 0;
+    EpollHandle epoll;
+    const int epollFd = epoll.fd;
+    if (epollFd < 0)
+        throw std::runtime_error("epoll_create failed");
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = const_cast<ListenSocket*>(&hListenSocket);
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0)
+            LogPrintf("epoll_ctl failed for listen socket %s\n", NetworkErrorString(WSAGetLastError()));
+    }
+#endif
     while (true)
     {
+#ifdef USE_EPOLL
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodesNew) {
+                if (pnode->hSocket == INVALID_SOCKET)
+                    continue;
+                struct epoll_event event;
+                event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                event.data.ptr = pnode;
+                if (epoll_ctl(epollFd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+                    LogPrintf("epoll_ctl failed %s\n", NetworkErrorString(WSAGetLastError()));
+                    pnode->fDisconnect = true;
+                }
+            }
+            vNodesNew.clear();
+        }
+#endif
         //
         // Disconnect nodes
         //
@@ -1066,7 +1197,7 @@ void ThreadSocketHandler()
             BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
             {
                 // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0)
+                if (pnode->GetRefCount() <= 0 && pnode->nChecksumJobs == 0)
                 {
                     bool fDelete = false;
                     {
@@ -1098,6 +1229,50 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
+#ifdef USE_EPOLL
+        struct epoll_event events[256];
+        int nEvents = epoll_wait(epollFd, events, 256, 50); // frequency to retry the nodes that could not be serviced
+        boost::this_thread::interruption_point();
+        if (nEvents < 0) {
+            if (errno != EINTR)
+                LogPrintf("socket epoll error %s\n", NetworkErrorString(WSAGetLastError()));
+            nEvents = 0;
+        }
+
+        for (int i = 0; i < nEvents; ++i) {
+            bool fListenSocket = false;
+            BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+                if (events[i].data.ptr == &hListenSocket) {
+                    AcceptConnection(hListenSocket);
+                    fListenSocket = true;
+                    break;
+                }
+            }
+            if (fListenSocket)
+                continue;
+            CNode *pnode = static_cast<CNode*>(events[i].data.ptr);
+            if (pnode->nSocketEventsReady == 0) {
+                LOCK(cs_vNodes);
+                pnode->AddRef();
+                vNodesReady.push_back(pnode);
+            }
+            pnode->nSocketEventsReady |= events[i].events;
+        }
+
+        // the timeouts are in seconds, no need to check every node on every round.
+        const int64_t nNow = GetTime();
+        if (nNow != nLastInactivityCheck) {
+            nLastInactivityCheck = nNow;
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodes) {
+                if (pnode->hSocket != INVALID_SOCKET)
+                    CheckInactivity(pnode);
+            }
+        }
+#else
+        //
+        // Find which sockets have data to receive
+        //
         struct timeval timeout;
         timeout.tv_sec  = 0;
         timeout.tv_usec = 50000; // frequency to poll pnode->vSend
@@ -1188,16 +1363,22 @@ void ThreadSocketHandler()
             }
         }
 
+#endif
+
         //
         // Service each socket
         //
         std::vector<CNode*> vNodesCopy;
+#ifdef USE_EPOLL
+        vNodesCopy.swap(vNodesReady);
+#else
         {
             LOCK(cs_vNodes);
             vNodesCopy = vNodes;
             BOOST_FOREACH(CNode* pnode, vNodesCopy)
                 pnode->AddRef();
         }
+#endif
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
             boost::this_thread::interruption_point();
@@ -1207,7 +1388,12 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
+#ifdef USE_EPOLL
+            if ((pnode->nSocketEventsReady & (EPOLLERR | EPOLLHUP))
+                    || ((pnode->nSocketEventsReady & (EPOLLIN | EPOLLRDHUP)) && CanReceive(pnode)))
+#else
             if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+#endif
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
@@ -1223,6 +1409,11 @@ void ThreadSocketHandler()
                             pnode->nLastRecv = GetTime();
                             pnode->nRecvBytes += nBytes;
                             pnode->RecordBytesRecv(nBytes);
+#ifdef USE_EPOLL
+                            // a short read emptied the socket, data arriving later triggers a new event.
+                            if (nBytes < (int) sizeof(pchBuf))
+                                pnode->nSocketEventsReady &= ~(EPOLLIN | EPOLLRDHUP);
+#endif
                         }
                         else if (nBytes == 0)
                         {
@@ -1241,6 +1432,11 @@ void ThreadSocketHandler()
                                     LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
                                 pnode->CloseSocketDisconnect();
                             }
+#ifdef USE_EPOLL
+                            else if (nErr == WSAEWOULDBLOCK) {
+                                pnode->nSocketEventsReady &= ~(EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP);
+                            }
+#endif
                         }
                     }
                 }
@@ -1251,45 +1447,42 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
+#ifdef USE_EPOLL
+            if (pnode->nSocketEventsReady & EPOLLOUT)
+#else
             if (FD_ISSET(pnode->hSocket, &fdsetSend))
+#endif
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+                if (lockSend) {
                     SocketSendData(pnode);
+#ifdef USE_EPOLL
+                    // either all was sent, or the socket buffer is full and draining it triggers a new event.
+                    pnode->nSocketEventsReady &= ~EPOLLOUT;
+#endif
+                }
             }
 
+#ifndef USE_EPOLL
             //
             // Inactivity checking
             //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+            CheckInactivity(pnode);
+#endif
         }
         {
             LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            BOOST_FOREACH(CNode* pnode, vNodesCopy) {
+#ifdef USE_EPOLL
+                // keep the nodes with events left, for instance because their receive buffer is full.
+                if (pnode->nSocketEventsReady != 0 && pnode->hSocket != INVALID_SOCKET) {
+                    vNodesReady.push_back(pnode);
+                    continue;
+                }
+                pnode->nSocketEventsReady = 0;
+#endif
                 pnode->Release();
+            }
         }
     }
 }
@@ -1820,7 +2013,7 @@ void ThreadMessageHandler()
 
                     if (pnode->nSendSize < SendBufferSize())
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].checked()))
                         {
                             fSleep = false;
                         }
@@ -2442,6 +2635,7 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nServices = 0;
     hSocket = hSocketIn;
     nRecvVersion = INIT_PROTO_VERSION;
+    nChecksumJobs = 0;
     nLastSend = 0;
     nLastRecv = 0;
     nSendBytes = 0;
@@ -2462,6 +2656,7 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fDisconnect = false;
     nRefCount = 0;
     nSendSize = 0;
+    nSocketEventsReady = 0;
     nSendOffset = 0;
     hashContinue = uint256();
     nStartingHeight = -1;
@@ -2481,6 +2676,8 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     isCashNode = false;
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
     thinBlockWaitingForTxns = -1;
+    xThinBlockShortIdNonce = 0;
+    xThinBlockShortIdBytes = 0;
 
     std::string xmledName;
     if (addrNameIn != "")
@@ -18,7 +18,9 @@
 #include "sync.h"
 #include "uint256.h"
 
+#include <atomic>
 #include <deque>
+#include <memory>
 
 #ifndef WIN32
 #include <arpa/inet.h>
@@ -67,6 +69,8 @@ static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
 static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 /** Default for blocks only*/
 static const bool DEFAULT_BLOCKSONLY = false;
+/** Messages with a payload of at least this size get their checksum verified on the thread pool */
+static const unsigned int PARALLEL_CHECKSUM_MIN_SIZE = 64 * 1024;
 
 // Force DNS seed use ahead of UAHF fork, to ensure peers are found
 // as long as seeders are working.
@@ -227,7 +231,16 @@ public:
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
+    enum ChecksumState {
+        ChecksumPending,
+        ChecksumValid,
+        ChecksumInvalid
+    };
+    // shared with the thread pool job that verifies the checksum of a large payload.
+    std::shared_ptr<std::atomic<int> > checksumState;
+
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn),
+        checksumState(std::make_shared<std::atomic<int> >(ChecksumPending)) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
@@ -242,6 +255,20 @@ public:
         return (hdr.nMessageSize == nDataPos);
     }
 
+    /// returns true when the message is complete and its checksum has been verified, valid or not.
+    bool checked() const
+    {
+        return complete() && *checksumState != ChecksumPending;
+    }
+
+    bool checksumValid() const
+    {
+        return *checksumState == ChecksumValid;
+    }
+
+    /// Hash the payload and store the outcome in checksumState, requires a complete message.
+    void verifyChecksum();
+
     void SetVersion(int nVersionIn)
     {
         hdrbuf.SetVersion(nVersionIn);
@@ -331,9 +358,13 @@ public:
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    std::atomic<int> nChecksumJobs; // checksum jobs on the thread pool that still read from vRecvMsg
     uint64_t nRecvBytes;
     int nRecvVersion;
 
+    // socket events that fired and are not handled yet, only used by ThreadSocketHandler.
+    uint32_t nSocketEventsReady;
+
     int64_t nLastSend;
     int64_t nLastRecv;
     int64_t nTimeConnected;
@@ -371,6 +402,8 @@ public:
     // Xtreme Thinblocks: begin section
     CBlock thinBlock;
     std::vector<uint64_t> xThinBlockHashes;
+    uint64_t xThinBlockShortIdNonce; // the short id salt of thinBlock, see CXThinShortIds
+    int xThinBlockShortIdBytes; // zero when thinBlock came from a legacy xthinblock
 #ifdef LOG_XTHINBLOCKS
     int nSizeThinBlock;   // Original on-wire size of the block. Just used for reporting
 #endif
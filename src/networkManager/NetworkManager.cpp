@@ -415,10 +415,14 @@ void NetworkManagerConnection::runMessageQueue()
 
                 Streaming::ConstBuffer header;
                 if (first || begin == end || !chunkHeader.isValid()) {
-                    m_sendHelperBuffer.reserve(20);
+                    m_sendHelperBuffer.reserve(40);
                     headerBuilder.add(Network::ServiceId, message.serviceId());
                     if (message.messageId() >= 0)
                         headerBuilder.add(Network::MessageId, message.messageId());
+                    for (auto item : message.headerData()) { // application defined items, like a request-id
+                        if (item.first > 10)
+                            headerBuilder.add(item.first, item.second);
+                    }
                     if (first)
                         headerBuilder.add(Network::SequenceStart, body.size());
                     headerBuilder.add(Network::LastInSequence, (begin == end));
@@ -612,6 +616,7 @@ bool NetworkManagerConnection::processPacket(const std::shared_ptr<char> &buffer
     int lastInSequence = -1;
     int sequenceSize = -1;
     bool isPing = false;
+    std::map<int, int> headerData;
     // TODO have a variable on the NetworkManger that indicates the maximum allowed combined message-size.
     bool inHeader = true;
     while (inHeader && type == Streaming::FoundTag) {
@@ -651,6 +656,10 @@ bool NetworkManagerConnection::processPacket(const std::shared_ptr<char> &buffer
         case Network::Ping:
             isPing = true;
             break;
+        default:
+            if (parser.tag() > 10 && parser.isInt()) // application defined items, like a request-id
+                headerData.insert(std::make_pair(parser.tag(), parser.intData()));
+            break;
         }
 
         type = parser.next();
@@ -722,6 +731,9 @@ bool NetworkManagerConnection::processPacket(const std::shared_ptr<char> &buffer
     }
     message.setMessageId(messageId);
     message.setServiceId(serviceId);
+    for (auto item : headerData) {
+        message.setHeaderInt(item.first, item.second);
+    }
     message.remote = m_remote.connectionId;
 
     // first copy to avoid problems if a callback removes its callback or closes the connection.
@@ -40,6 +40,8 @@ const char *XTHINBLOCK="xthinblock";
 const char *XBLOCKTX="xblocktx";
 const char *GET_XBLOCKTX="get_xblocktx";
 const char *GET_XTHIN="get_xthin";
+const char *XTHINBLOCK2="xthinblock2";
+const char *GET_XBLOCKTX2="get_xblocktx2";
 // BUIP010 Xtreme Thinblocks - end section
 const char *VERSION2="buversion"; // unfortunately the unlimited team wasn't very creative with naming.
 const char *VERACK2="buverack";
@@ -93,6 +95,8 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::XBLOCKTX,
     NetMsgType::GET_XBLOCKTX,
     NetMsgType::GET_XTHIN,
+    NetMsgType::XTHINBLOCK2,
+    NetMsgType::GET_XBLOCKTX2,
     // BUIP010 Xtreme Thinbocks - end section
     NetMsgType::VERSION2,
     NetMsgType::VERACK2,
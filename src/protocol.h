@@ -154,6 +154,18 @@ extern const char *GET_XBLOCKTX;
  * The get_xthin message transmits a single serialized get_xthin.
  */
 extern const char *GET_XTHIN;
+/**
+ * The xthinblock2 message is the xthinblock message with per-block salted
+ * short transaction ids of 6 or 8 bytes.
+ * @since protocol version 80003
+ */
+extern const char *XTHINBLOCK2;
+/**
+ * The get_xblocktx2 message requests transactions of an xthinblock2 by their
+ * position in the block. Answered with an xblocktx message.
+ * @since protocol version 80003
+ */
+extern const char *GET_XBLOCKTX2;
 
 /**
  * The getaddr message requests an addr message from the receiving node,
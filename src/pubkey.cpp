@@ -1,4 +1,5 @@
 // Copyright (c) 2009-2015 The Bitcoin Core developers
+// Copyright (c) 2017 Tom Zander <tomz@freedommail.ch>
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -7,6 +8,11 @@
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
 
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+#include <map>
+
 namespace
 {
 /* Global secp256k1_context object used for verification. */
@@ -164,17 +170,13 @@ static int ecdsa_signature_parse_der_lax(const secp256k1_context* ctx, secp256k1
     return 1;
 }
 
-bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
-    if (!IsValid())
-        return false;
-    secp256k1_pubkey pubkey;
-    secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
-        return false;
-    }
+namespace {
+bool verifySignature(const secp256k1_pubkey &pubkey, const uint256 &hash, const std::vector<unsigned char>& vchSig)
+{
     if (vchSig.size() == 0) {
         return false;
     }
+    secp256k1_ecdsa_signature sig;
     if (!ecdsa_signature_parse_der_lax(secp256k1_context_verify, &sig, &vchSig[0], vchSig.size())) {
         return false;
     }
@@ -183,6 +185,73 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     secp256k1_ecdsa_signature_normalize(secp256k1_context_verify, &sig, &sig);
     return secp256k1_ecdsa_verify(secp256k1_context_verify, &sig, hash.begin(), &pubkey);
 }
+}
+
+bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
+    if (!IsValid())
+        return false;
+    secp256k1_pubkey pubkey;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
+        return false;
+    }
+    return verifySignature(pubkey, hash, vchSig);
+}
+
+class CPubKeyParseCache::Private
+{
+public:
+    struct Entry {
+        secp256k1_pubkey pubkey;
+        bool valid;
+    };
+    // keyed on the serialized key, which is public data chosen by the transaction creators.
+    // An ordered map avoids having to worry about hash collisions.
+    std::map<CPubKey, Entry> keys;
+    mutable boost::shared_mutex lock;
+};
+
+CPubKeyParseCache::CPubKeyParseCache()
+    : d(new Private())
+{
+}
+
+CPubKeyParseCache::~CPubKeyParseCache()
+{
+    delete d;
+}
+
+bool CPubKeyParseCache::Verify(const CPubKey &key, const uint256 &hash, const std::vector<unsigned char> &vchSig)
+{
+    if (!key.IsValid())
+        return false;
+    Private::Entry entry;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(d->lock);
+        auto iter = d->keys.find(key);
+        if (iter != d->keys.end()) {
+            if (!iter->second.valid)
+                return false;
+            entry = iter->second;
+            lock.unlock();
+            return verifySignature(entry.pubkey, hash, vchSig);
+        }
+    }
+    // parse outside of the lock, a duplicate parse in a race is harmless.
+    entry.valid = secp256k1_ec_pubkey_parse(secp256k1_context_verify, &entry.pubkey, key.begin(), key.size());
+    {
+        boost::unique_lock<boost::shared_mutex> lock(d->lock);
+        d->keys.insert(std::make_pair(key, entry));
+    }
+    if (!entry.valid)
+        return false;
+    return verifySignature(entry.pubkey, hash, vchSig);
+}
+
+size_t CPubKeyParseCache::size() const
+{
+    boost::shared_lock<boost::shared_mutex> lock(d->lock);
+    return d->keys.size();
+}
 
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     if (vchSig.size() != 65)
@@ -210,6 +210,35 @@ struct CExtPubKey {
     bool Derive(CExtPubKey& out, unsigned int nChild) const;
 };
 
+/**
+ * Cache of parsed public keys, meant to live for the validation of one block.
+ *
+ * Parsing a public key (and for compressed keys decompressing it) is a noticeable
+ * part of the cost of a signature check. Blocks that spend many outputs to the
+ * same key (consolidation, exchange payouts) pay it for every input.
+ * This cache is shared between the script-check threads and remembers the parse
+ * result for every unique serialized public key it has seen.
+ */
+class CPubKeyParseCache
+{
+public:
+    CPubKeyParseCache();
+    ~CPubKeyParseCache();
+
+    /// Same as CPubKey::Verify(), but reuses the parsed \a pubkey when seen before.
+    bool Verify(const CPubKey &pubkey, const uint256 &hash, const std::vector<unsigned char>& vchSig);
+
+    /// Return the amount of unique public keys parsed.
+    size_t size() const;
+
+private:
+    CPubKeyParseCache(const CPubKeyParseCache&);
+    CPubKeyParseCache& operator=(const CPubKeyParseCache&);
+
+    class Private;
+    Private *d;
+};
+
 /** Users of this module must hold an ECCVerifyHandle. The constructor and
  *  destructor of these are not allowed to run in parallel, though. */
 class ECCVerifyHandle
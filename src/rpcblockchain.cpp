@@ -7,6 +7,7 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "clientversion.h"
 #include "coins.h"
 #include "consensus/validation.h"
 #include "main.h"
@@ -18,10 +19,13 @@
 #include "txmempool.h"
 #include "BlocksDB.h"
 #include "timedata.h"
+#include "txdb.h"
 #include "util.h"
 #include "utilstrencodings.h"
 #include "primitives/block.h"
 
+#include <boost/filesystem.hpp>
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 
@@ -431,7 +435,6 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         throw std::runtime_error(
             "gettxoutsetinfo\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -439,7 +442,7 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The hash of the set, independent of the order of the outputs\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
@@ -450,8 +453,14 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
-    FlushStateToDisk();
+    LOCK(cs_main);
+    CUtxoCommitment commitment;
+    if (!pcoinsTip->GetCommitment(commitment))
+        FlushStateToDisk(); // without a commitment the database walks the whole set
     if (pcoinsTip->GetStats(stats)) {
+        auto iter = Blocks::indexMap.find(stats.hashBlock);
+        if (iter != Blocks::indexMap.end())
+            stats.nHeight = iter->second->nHeight;
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
@@ -463,6 +472,71 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue dumputxosnapshot(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw std::runtime_error(
+            "dumputxosnapshot \"filename\"\n"
+            "\nWrites the unspent transaction output set to a file, for a new node to start from with -loadutxosnapshot.\n"
+            "The new node needs the snapshot block in its block index at startup, so it needs a copy of the blocks\n"
+            "directory of this node. Downloading the headers first is not supported.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The file to create, relative to the data directory\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\":n,                (numeric) The block height of the snapshot\n"
+            "  \"bestblock\": \"hex\",      (string) The block hash of the snapshot\n"
+            "  \"transactions\": n,         (numeric) The number of transactions\n"
+            "  \"txouts\": n,               (numeric) The number of unspent outputs\n"
+            "  \"checksum\": \"hash\",      (string) The checksum at the end of the file\n"
+            "  \"path\": \"path\"           (string) The absolute path of the file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumputxosnapshot", "\"utxo.dat\"")
+            + HelpExampleRpc("dumputxosnapshot", "\"utxo.dat\"")
+        );
+
+    const boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    const boost::filesystem::path tmpPath = path.string() + ".incomplete";
+
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        if (pcoinsdbview == NULL)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "No UTXO database");
+    }
+    // the database is read from a snapshot of its state, no need to block the node while writing.
+    CCoinsStats stats;
+    {
+        CAutoFile file(fopen(tmpPath.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unable to create " + tmpPath.string());
+        if (!pcoinsdbview->WriteSnapshot(file, stats)) {
+            file.fclose();
+            boost::filesystem::remove(tmpPath);
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Failed to write the snapshot");
+        }
+        FileCommit(file.Get());
+    }
+    boost::filesystem::rename(tmpPath, path);
+
+    UniValue ret(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        auto iter = Blocks::indexMap.find(stats.hashBlock);
+        ret.push_back(Pair("height", iter == Blocks::indexMap.end() ? -1 : iter->second->nHeight));
+    }
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("checksum", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -601,18 +675,24 @@ static UniValue SoftForkDesc(const std::string &name, int version, CBlockIndex*
     return rv;
 }
 
-static UniValue BIP9SoftForkDesc(const std::string& name, const Consensus::Params& consensusParams, Consensus::DeploymentPos id)
+static const char *BIP9StatusName(ThresholdState state)
 {
-    UniValue rv(UniValue::VOBJ);
-    rv.push_back(Pair("id", name));
-    switch (VersionBitsTipState(consensusParams, id)) {
-    case THRESHOLD_DEFINED: rv.push_back(Pair("status", "defined")); break;
-    case THRESHOLD_STARTED: rv.push_back(Pair("status", "started")); break;
-    case THRESHOLD_LOCKED_IN: rv.push_back(Pair("status", "locked_in")); break;
-    case THRESHOLD_ACTIVE: rv.push_back(Pair("status", "active")); break;
-    case THRESHOLD_FAILED: rv.push_back(Pair("status", "failed")); break;
+    switch (state) {
+    case THRESHOLD_DEFINED: return "defined";
+    case THRESHOLD_STARTED: return "started";
+    case THRESHOLD_LOCKED_IN: return "locked_in";
+    case THRESHOLD_ACTIVE: return "active";
+    case THRESHOLD_FAILED: return "failed";
     }
-    return rv;
+    return "";
+}
+
+std::vector<std::pair<std::string, std::string> > BIP9SoftForkStatuses()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    std::vector<std::pair<std::string, std::string> > answer;
+    answer.push_back(std::make_pair("csv", BIP9StatusName(VersionBitsTipState(consensusParams, Consensus::DEPLOYMENT_CSV))));
+    return answer;
 }
 
 UniValue getblockchaininfo(const UniValue& params, bool fHelp)
@@ -678,7 +758,12 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     softforks.push_back(SoftForkDesc("bip34", 2, tip, consensusParams));
     softforks.push_back(SoftForkDesc("bip66", 3, tip, consensusParams));
     softforks.push_back(SoftForkDesc("bip65", 4, tip, consensusParams));
-    bip9_softforks.push_back(BIP9SoftForkDesc("csv", consensusParams, Consensus::DEPLOYMENT_CSV));
+    for (auto fork : BIP9SoftForkStatuses()) {
+        UniValue rv(UniValue::VOBJ);
+        rv.push_back(Pair("id", fork.first));
+        rv.push_back(Pair("status", fork.second));
+        bip9_softforks.push_back(rv);
+    }
     obj.push_back(Pair("softforks",             softforks));
     obj.push_back(Pair("bip9_softforks", bip9_softforks));
 
@@ -286,6 +286,7 @@ static const CRPCCommand vRPCCommands[] =
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
     { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "dumputxosnapshot",       &dumputxosnapshot,       true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
 
     /* Mining */
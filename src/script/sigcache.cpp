@@ -5,109 +5,298 @@
 
 #include "sigcache.h"
 
-#include "memusage.h"
+#include "Logger.h"
+#include "crypto/common.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/unordered_set.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 
-namespace {
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <new>
 
-/**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
- */
-class CSignatureCacheHasher
-{
-public:
-    size_t operator()(const uint256& key) const {
-        return key.GetCheapHash();
-    }
-};
+namespace {
 
 /**
- * Valid signature cache, to avoid doing expensive ECDSA signature checking
- * twice for every transaction (once when accepted into memory pool, and
- * again when accepted into the block chain)
+ * Cache of salted hashes of things that passed validation. Used for valid
+ * signatures, to avoid doing expensive ECDSA signature checking twice for
+ * every transaction (once when accepted into memory pool, and again when
+ * accepted into the block chain), and for transactions whose scripts passed
+ * with a certain set of flags.
+ *
+ * The cache is a fixed size cuckoo hash table. Each entry can live in one of
+ * two buckets, a bucket is one cache-line holding two entries.
+ * Entries are stored as atomic words which makes lookups lock-free, only
+ * inserts are serialized.
+ * Since the entries are salted hashes it is impossible for an attacker to
+ * create an entry that matches the words of two different entries, so a
+ * reader racing with a writer can at worst miss an entry.
+ *
+ * The top byte of an entry holds the generation it was inserted in, zero
+ * meaning the slot is empty. Every time a quarter of the table has been
+ * written we start a new generation and entries that are two generations
+ * old are overwritten first.
  */
-class CSignatureCache
+class CValidityCache
 {
 private:
-     //! Entries are SHA256(nonce || signature hash || public key || signature):
+    static const uint64_t GenerationMask = 0xFFULL << 56;
+
+    struct Entry {
+        std::atomic<uint64_t> words[4];
+    };
+    struct Bucket {
+        Entry entries[2];
+    };
+    static_assert(sizeof(Bucket) == 64, "A bucket should be one cache-line");
+
+    //! Entries are SHA256(nonce || data):
     uint256 nonce;
-    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
+    const char *name;
+
+    std::unique_ptr<char[]> memory;
+    Bucket *buckets;
+    uint32_t bucketCount;
+    boost::mutex writeLock;
+    uint8_t generation;
+    uint32_t insertsInGeneration;
+
+    // statistics, reported in the Bench log section.
+    std::atomic<uint64_t> lookups;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> inserts;
+    std::atomic<uint64_t> evictions;
+
+    struct Key {
+        explicit Key(const uint256 &entry) {
+            for (int i = 0; i < 4; ++i)
+                words[i] = ReadLE64(entry.begin() + i * 8);
+            words[3] &= ~GenerationMask;
+        }
+        uint64_t words[4];
+    };
 
+    inline Bucket &bucket(const Key &key, int index) const {
+        const uint32_t hash = static_cast<uint32_t>(key.words[index] >> 16);
+        return buckets[(static_cast<uint64_t>(hash) * bucketCount) >> 32];
+    }
+
+    inline static bool matches(const Entry &entry, const Key &key, uint64_t lastWord) {
+        return (lastWord & GenerationMask) != 0
+                && (lastWord & ~GenerationMask) == key.words[3]
+                && entry.words[0].load(std::memory_order_relaxed) == key.words[0]
+                && entry.words[1].load(std::memory_order_relaxed) == key.words[1]
+                && entry.words[2].load(std::memory_order_relaxed) == key.words[2];
+    }
+
+    inline uint8_t age(uint64_t lastWord) const {
+        const uint8_t entryGeneration = lastWord >> 56;
+        return (generation + 255 - entryGeneration) % 255;
+    }
+
+    static void write(Entry &entry, const Key &key, uint8_t generation) {
+        entry.words[3].store(0, std::memory_order_relaxed); // mark empty while we write
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int i = 0; i < 3; ++i)
+            entry.words[i].store(key.words[i], std::memory_order_relaxed);
+        entry.words[3].store(key.words[3] | (static_cast<uint64_t>(generation) << 56), std::memory_order_release);
+    }
 
 public:
-    CSignatureCache()
+    CValidityCache(const char *name, size_t maxCacheSize)
+        : name(name),
+          buckets(nullptr),
+          bucketCount(0),
+          generation(1),
+          insertsInGeneration(0),
+          lookups(0),
+          hits(0),
+          inserts(0),
+          evictions(0)
     {
         GetRandBytes(nonce.begin(), 32);
+        bucketCount = std::min<size_t>(std::numeric_limits<uint32_t>::max(), maxCacheSize / sizeof(Bucket));
+        if (bucketCount == 0)
+            return;
+        memory.reset(new char[bucketCount * sizeof(Bucket) + 63]);
+        const uintptr_t aligned = (reinterpret_cast<uintptr_t>(memory.get()) + 63) & ~static_cast<uintptr_t>(63);
+        buckets = reinterpret_cast<Bucket*>(aligned);
+        for (uint32_t i = 0; i < bucketCount; ++i) {
+            new (buckets + i) Bucket();
+            for (int j = 0; j < 2; ++j) {
+                for (int k = 0; k < 4; ++k)
+                    buckets[i].entries[j].words[k].store(0, std::memory_order_relaxed);
+            }
+        }
     }
 
-    void
-    ComputeEntry(uint256& entry, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey)
+    CSHA256 EntryHasher() const
     {
-        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
+        CSHA256 hasher;
+        hasher.Write(nonce.begin(), 32);
+        return hasher;
     }
 
+    /// Lock-free lookup, when \a erase is true a found entry is removed from the cache.
     bool
-    Get(const uint256& entry)
+    Get(const uint256& entry, bool erase)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
-    }
-
-    void Erase(const uint256& entry)
-    {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
+        if (bucketCount == 0)
+            return false;
+        lookups.fetch_add(1, std::memory_order_relaxed);
+        const Key key(entry);
+        for (int i = 0; i < 2; ++i) {
+            Bucket &b = bucket(key, i);
+            for (int j = 0; j < 2; ++j) {
+                Entry &e = b.entries[j];
+                uint64_t lastWord = e.words[3].load(std::memory_order_acquire);
+                if (matches(e, key, lastWord)) {
+                    if (erase) // only mark empty when nobody replaced it in the mean time.
+                        e.words[3].compare_exchange_strong(lastWord, lastWord & ~GenerationMask, std::memory_order_relaxed);
+                    hits.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+        return false;
     }
 
     void Set(const uint256& entry)
     {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
-        {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
+        if (bucketCount == 0)
+            return;
+        inserts.fetch_add(1, std::memory_order_relaxed);
+        Key key(entry);
+        uint8_t keyGeneration;
+        boost::unique_lock<boost::mutex> lock(writeLock);
+        keyGeneration = generation;
+        if (++insertsInGeneration > bucketCount / 2) { // a quarter of the entries
+            insertsInGeneration = 0;
+            generation = generation % 255 + 1;
+        }
+
+        // Place the entry in an empty or old slot, otherwise kick out an entry
+        // to its alternative bucket and repeat for that one.
+        const int maxDepth = 12;
+        Entry *previous = nullptr;
+        for (int depth = 0; depth < maxDepth; ++depth) {
+            Entry *best = nullptr;
+            uint8_t bestAge = 0;
+            for (int i = 0; i < 2; ++i) {
+                Bucket &b = bucket(key, i);
+                for (int j = 0; j < 2; ++j) {
+                    Entry &e = b.entries[j];
+                    const uint64_t lastWord = e.words[3].load(std::memory_order_relaxed);
+                    if ((lastWord & GenerationMask) == 0) { // empty
+                        write(e, key, keyGeneration);
+                        return;
+                    }
+                    if (matches(e, key, lastWord))
+                        return;
+                    if (&e != previous && (best == nullptr || age(lastWord) > bestAge)) {
+                        best = &e;
+                        bestAge = age(lastWord);
+                    }
+                }
+            }
+            assert(best);
+            const uint64_t lastWord = best->words[3].load(std::memory_order_relaxed);
+            if (bestAge >= 2) { // just overwrite old entries
+                evictions.fetch_add(1, std::memory_order_relaxed);
+                write(*best, key, keyGeneration);
+                return;
             }
+            // swap with the one in the table and find a new place for that one.
+            Key displaced(key);
+            for (int i = 0; i < 3; ++i)
+                displaced.words[i] = best->words[i].load(std::memory_order_relaxed);
+            displaced.words[3] = lastWord & ~GenerationMask;
+            const uint8_t displacedGeneration = lastWord >> 56;
+            write(*best, key, keyGeneration);
+            key = displaced;
+            keyGeneration = displacedGeneration;
+            previous = best;
         }
+        evictions.fetch_add(1, std::memory_order_relaxed); // the last one displaced didn't find a new spot.
+    }
 
-        setValid.insert(entry);
+    void LogStats()
+    {
+        const uint64_t lookupCount = lookups.exchange(0, std::memory_order_relaxed);
+        const uint64_t hitCount = hits.exchange(0, std::memory_order_relaxed);
+        logInfo(Log::Bench).nospace() << name << " cache lookups: " << lookupCount << " hits: " << hitCount
+                            << " (" << (lookupCount == 0 ? 0 : hitCount * 100 / lookupCount) << "%)"
+                            << " inserts: " << inserts.exchange(0, std::memory_order_relaxed)
+                            << " evictions: " << evictions.exchange(0, std::memory_order_relaxed);
     }
 };
 
+CValidityCache &signatureCache()
+{
+    static CValidityCache cache("Signature", GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20));
+    return cache;
+}
+
+// An entry per transaction instead of per signature, an eighth of the memory holds more than enough.
+CValidityCache &transactionCache()
+{
+    static CValidityCache cache("Script", GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 17));
+    return cache;
+}
+
+uint256 transactionEntry(const CValidityCache &cache, const uint256 &txid, unsigned int flags)
+{
+    unsigned char flagBytes[4];
+    WriteLE32(flagBytes, flags);
+    uint256 entry;
+    cache.EntryHasher().Write(txid.begin(), 32).Write(flagBytes, sizeof(flagBytes)).Finalize(entry.begin());
+    return entry;
+}
+
+}
+
+void LogSignatureCacheStats()
+{
+    signatureCache().LogStats();
+    transactionCache().LogStats();
+}
+
+void AddValidatedTransaction(const uint256 &txid, unsigned int flags)
+{
+    CValidityCache &cache = transactionCache();
+    cache.Set(transactionEntry(cache, txid, flags));
+}
+
+bool IsValidatedTransaction(const uint256 &txid, unsigned int flags, bool erase)
+{
+    CValidityCache &cache = transactionCache();
+    return cache.Get(transactionEntry(cache, txid, flags), erase);
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CValidityCache &cache = signatureCache();
 
     uint256 entry;
-    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+    cache.EntryHasher().Write(sighash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
 
-    if (signatureCache.Get(entry)) {
-        if (!store) {
-            signatureCache.Erase(entry);
-        }
+    if (cache.Get(entry, !store))
         return true;
-    }
 
-    if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
+    if (pubkeyCache) {
+        if (!pubkeyCache->Verify(pubkey, sighash, vchSig))
+            return false;
+    } else if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash)) {
         return false;
+    }
 
     if (store) {
-        signatureCache.Set(entry);
+        cache.Set(entry);
     }
     return true;
 }
@@ -10,21 +10,33 @@
 
 #include <vector>
 
-// DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
+// DoS prevention: limit cache size to 40MB (over 1.3 million entries).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
 
 class CPubKey;
+class CPubKeyParseCache;
+class uint256;
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
+    CPubKeyParseCache *pubkeyCache;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn, amount), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn, amount), store(storeIn), pubkeyCache(0) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn, const PrecomputedTransactionData& txdataIn, CPubKeyParseCache *pubkeyCacheIn = 0) : TransactionSignatureChecker(txToIn, nInIn, amount, txdataIn), store(storeIn), pubkeyCache(pubkeyCacheIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/// Log the hit-rate of the signature and script caches since the last call to the Bench section.
+void LogSignatureCacheStats();
+
+/// Remember that the scripts of all inputs of transaction \a txid passed validation with \a flags.
+void AddValidatedTransaction(const uint256 &txid, unsigned int flags);
+/// Returns true if AddValidatedTransaction() was called for this transaction with these exact flags.
+/// When \a erase is true the entry is dropped from the cache on a hit.
+bool IsValidatedTransaction(const uint256 &txid, unsigned int flags, bool erase);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
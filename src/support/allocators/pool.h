@@ -0,0 +1,231 @@
+/*
+ * This file is part of the bitcoin-classic project
+ * Copyright (C) 2017 Tom Zander <tomz@freedommail.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * A memory arena for many small allocations of similar size, typically the nodes of a node based container.
+ *
+ * Memory is taken from the system in chunks and handed out in blocks, rounded up to a multiple
+ * of ALIGN_BYTES. The first chunk is small and every next one is twice the size of the previous,
+ * up to maxChunkSize(), so a short-lived resource with a handful of allocations stays cheap. Freed blocks go on a free-list for their size and are reused by the next allocation
+ * of that size, chunks are only returned to the system when the resource is destroyed.
+ * Requests larger than MAX_BLOCK_SIZE_BYTES (like the bucket array of a hash table) are passed to
+ * the normal allocator.
+ *
+ * Because the resource knows how much memory it holds, usage() covers everything allocated through
+ * it instead of an estimate per allocated object, and the per-allocation overhead and fragmentation
+ * of malloc is avoided.
+ *
+ * This class is not thread-safe.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+public:
+    explicit PoolResource(std::size_t maxChunkSizeBytes = 256 * 1024, std::size_t firstChunkSizeBytes = 4 * 1024)
+        : m_maxChunkSize(maxChunkSizeBytes),
+          m_nextChunkSize(std::max(std::min(firstChunkSizeBytes, maxChunkSizeBytes), MAX_BLOCK_SIZE_BYTES)),
+          m_chunkUsage(0),
+          m_freeLists(MAX_BLOCK_SIZE_BYTES / ALIGN_BYTES + 1, nullptr),
+          m_available(nullptr),
+          m_availableEnd(nullptr),
+          m_fallbackUsage(0)
+    {
+        static_assert(ALIGN_BYTES >= sizeof(ListNode), "ALIGN_BYTES has to fit a pointer");
+        static_assert((ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES has to be a power of two");
+        assert(m_maxChunkSize >= MAX_BLOCK_SIZE_BYTES);
+    }
+
+    ~PoolResource()
+    {
+        for (char *chunk : m_chunks)
+            ::operator delete(chunk);
+    }
+
+    void *allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (!usesPool(bytes, alignment)) {
+            m_fallbackUsage += mallocUsage(bytes);
+            return ::operator new(bytes);
+        }
+        const std::size_t index = sizeClass(bytes);
+        if (m_freeLists[index]) {
+            ListNode *node = m_freeLists[index];
+            m_freeLists[index] = node->next;
+            return node;
+        }
+        const std::size_t size = index * ALIGN_BYTES;
+        if (static_cast<std::size_t>(m_availableEnd - m_available) < size)
+            allocateChunk();
+        char *answer = m_available;
+        m_available += size;
+        return answer;
+    }
+
+    void deallocate(void *p, std::size_t bytes, std::size_t alignment)
+    {
+        if (!usesPool(bytes, alignment)) {
+            m_fallbackUsage -= mallocUsage(bytes);
+            ::operator delete(p);
+            return;
+        }
+        const std::size_t index = sizeClass(bytes);
+        ListNode *node = static_cast<ListNode*>(p);
+        node->next = m_freeLists[index];
+        m_freeLists[index] = node;
+    }
+
+    /// The amount of bytes this resource holds, including the allocations it passed on.
+    std::size_t usage() const {
+        return m_chunkUsage + m_fallbackUsage;
+    }
+
+    std::size_t maxChunkSize() const {
+        return m_maxChunkSize;
+    }
+
+private:
+    PoolResource(const PoolResource&);
+    PoolResource &operator=(const PoolResource&);
+
+    struct ListNode {
+        ListNode *next;
+    };
+
+    static bool usesPool(std::size_t bytes, std::size_t alignment) {
+        return bytes <= MAX_BLOCK_SIZE_BYTES && alignment <= ALIGN_BYTES;
+    }
+
+    static std::size_t sizeClass(std::size_t bytes) {
+        return (std::max<std::size_t>(bytes, 1) + ALIGN_BYTES - 1) / ALIGN_BYTES;
+    }
+
+    // same model as memusage::MallocUsage(), which we can't include here.
+    static std::size_t mallocUsage(std::size_t alloc) {
+        return ((alloc + 31) >> 4) << 4;
+    }
+
+    void allocateChunk()
+    {
+        // put the leftover of the current chunk on the free-list that fits it.
+        const std::size_t left = m_availableEnd - m_available;
+        if (left >= ALIGN_BYTES) {
+            const std::size_t index = left / ALIGN_BYTES;
+            ListNode *node = reinterpret_cast<ListNode*>(m_available);
+            node->next = m_freeLists[index];
+            m_freeLists[index] = node;
+        }
+        // operator new returns memory aligned for any fundamental type.
+        const std::size_t size = m_nextChunkSize;
+        char *chunk = static_cast<char*>(::operator new(size));
+        m_chunks.push_back(chunk);
+        m_chunkUsage += mallocUsage(size);
+        m_available = chunk;
+        m_availableEnd = chunk + (size / ALIGN_BYTES) * ALIGN_BYTES;
+        m_nextChunkSize = std::min(size * 2, m_maxChunkSize);
+    }
+
+    const std::size_t m_maxChunkSize;
+    std::size_t m_nextChunkSize;
+    std::size_t m_chunkUsage; // malloc usage of all chunks
+    std::vector<char*> m_chunks;
+    std::vector<ListNode*> m_freeLists; // indexed on size divided by ALIGN_BYTES
+    char *m_available;
+    char *m_availableEnd;
+    std::size_t m_fallbackUsage;
+};
+
+/**
+ * Allocator that takes its memory from a PoolResource, for use with node based containers.
+ * The resource has to outlive all containers using it.
+ */
+template <typename T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = sizeof(void*) * 2>
+class PoolAllocator
+{
+public:
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> Resource;
+
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator(Resource *resource) : m_resource(resource) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> &other) : m_resource(other.resource()) {}
+
+    T *allocate(std::size_t n, const void* = 0) {
+        return static_cast<T*>(m_resource->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) {
+        m_resource->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args&&... args) {
+        ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    void destroy(U *p) {
+        p->~U();
+    }
+
+    std::size_t max_size() const {
+        return std::numeric_limits<std::size_t>::max() / sizeof(T);
+    }
+
+    Resource *resource() const {
+        return m_resource;
+    }
+
+private:
+    Resource *m_resource;
+};
+
+template <typename T1, typename T2, std::size_t M, std::size_t A>
+bool operator==(const PoolAllocator<T1, M, A> &a, const PoolAllocator<T2, M, A> &b) {
+    return a.resource() == b.resource();
+}
+
+template <typename T1, typename T2, std::size_t M, std::size_t A>
+bool operator!=(const PoolAllocator<T1, M, A> &a, const PoolAllocator<T2, M, A> &b) {
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -308,4 +308,28 @@ BOOST_AUTO_TEST_CASE(CMFTypes)
     BOOST_CHECK_EQUAL(parser.next(), EndOfDocument);
 }
 
+BOOST_AUTO_TEST_CASE(CMFConstBuffer)
+{
+    BufferPool pool;
+    pool.reserve(10);
+    memcpy(pool.begin(), "blockdata", 9);
+    pool.markUsed(9);
+    ConstBuffer blob = pool.commit();
+
+    MessageBuilder builder(NoHeader);
+    builder.add(5, blob.mid(5, 4));
+    builder.add(6, blob);
+
+    MessageParser parser(builder.buffer());
+    BOOST_CHECK_EQUAL(parser.next(), FoundTag);
+    BOOST_CHECK_EQUAL(parser.tag(), (unsigned int) 5);
+    std::vector<char> data = parser.bytesData();
+    BOOST_CHECK_EQUAL(std::string(data.begin(), data.end()), std::string("data"));
+    BOOST_CHECK_EQUAL(parser.next(), FoundTag);
+    BOOST_CHECK_EQUAL(parser.tag(), (unsigned int) 6);
+    data = parser.bytesData();
+    BOOST_CHECK_EQUAL(std::string(data.begin(), data.end()), std::string("blockdata"));
+    BOOST_CHECK_EQUAL(parser.next(), EndOfDocument);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,10 @@
 #include "main.h" // For CheckBlock
 #include "primitives/block.h"
 #include "test/test_bitcoin.h"
+#include "test/transaction_utils.h"
+#include "blockchain/Block.h"
+#include "consensus/merkle.h"
+#include "random.h"
 #include "utiltime.h"
 
 #include <cstdio>
@@ -63,4 +67,104 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+static bool checkFastBlock(const CBlock &block, std::string &reason)
+{
+    FastBlock fastBlock = FastBlock::fromOldBlock(block);
+    fastBlock.findTransactions();
+    CValidationState state;
+    const bool answer = CheckBlock(fastBlock, state, false, true);
+    reason = state.GetRejectReason();
+
+    // the CBlock based one has to agree.
+    CValidationState state2;
+    BOOST_CHECK_EQUAL(CheckBlock(block, state2, false, true), answer);
+    BOOST_CHECK_EQUAL(state2.GetRejectReason(), reason);
+    return answer;
+}
+
+BOOST_AUTO_TEST_CASE(FastBlock)
+{
+    seed_insecure_rand(false);
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+
+    CBlock block;
+    block.vtx.push_back(coinbase);
+    for (int i = 0; i < 20; ++i) {
+        CMutableTransaction tx;
+        TxUtils::RandomTransaction(tx, TxUtils::AnyOutputCount);
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    std::string reason;
+    BOOST_CHECK(checkFastBlock(block, reason));
+
+    CBlock copy(block);
+    copy.hashMerkleRoot.SetNull();
+    BOOST_CHECK(!checkFastBlock(copy, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-txnmrklroot");
+
+    copy = block;
+    copy.vtx.push_back(copy.vtx.back());
+    copy.vtx.push_back(copy.vtx.back());
+    copy.hashMerkleRoot = BlockMerkleRoot(copy);
+    BOOST_CHECK(!checkFastBlock(copy, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-txns-duplicate");
+
+    copy = block;
+    copy.vtx.erase(copy.vtx.begin());
+    copy.hashMerkleRoot = BlockMerkleRoot(copy);
+    BOOST_CHECK(!checkFastBlock(copy, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-cb-missing");
+
+    copy = block;
+    copy.vtx.push_back(coinbase);
+    copy.hashMerkleRoot = BlockMerkleRoot(copy);
+    BOOST_CHECK(!checkFastBlock(copy, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-cb-multiple");
+
+    copy = block;
+    CMutableTransaction tx(copy.vtx[1]);
+    tx.vout[0].nValue = -1;
+    copy.vtx[1] = tx;
+    copy.hashMerkleRoot = BlockMerkleRoot(copy);
+    BOOST_CHECK(!checkFastBlock(copy, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-txns-vout-negative");
+
+    copy = block;
+    tx = copy.vtx[1];
+    tx.vin.push_back(tx.vin[0]);
+    copy.vtx[1] = tx;
+    copy.hashMerkleRoot = BlockMerkleRoot(copy);
+    BOOST_CHECK(!checkFastBlock(copy, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-txns-inputs-duplicate");
+
+    // several faults at once, the reported one has to be the same for both.
+    copy = block;
+    tx = copy.vtx[2];
+    tx.vin.push_back(tx.vin[0]);
+    tx.vout[0].nValue = -1;
+    copy.vtx[2] = tx;
+    copy.vtx.push_back(coinbase);
+    copy.hashMerkleRoot = BlockMerkleRoot(copy);
+    BOOST_CHECK(!checkFastBlock(copy, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-cb-multiple");
+
+    copy.vtx.pop_back();
+    copy.hashMerkleRoot = BlockMerkleRoot(copy);
+    BOOST_CHECK(!checkFastBlock(copy, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-txns-vout-negative");
+
+    tx = copy.vtx[1];
+    tx.vout.clear();
+    copy.vtx[1] = tx;
+    copy.hashMerkleRoot = BlockMerkleRoot(copy);
+    BOOST_CHECK(!checkFastBlock(copy, reason));
+    BOOST_CHECK_EQUAL(reason, "bad-txns-vout-empty");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
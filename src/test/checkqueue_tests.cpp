@@ -0,0 +1,103 @@
+/*
+ * This file is part of the bitcoin-classic project
+ * Copyright (C) 2017 Tom Zander <tomz@freedommail.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test_bitcoin.h"
+#include <checkqueue.h>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <atomic>
+
+namespace {
+struct CountingCheck {
+    CountingCheck() : counter(nullptr), result(true) {}
+    CountingCheck(std::atomic<int> *counter, bool result) : counter(counter), result(result) {}
+    bool operator()() {
+        ++*counter;
+        return result;
+    }
+    void swap(CountingCheck &other) {
+        std::swap(counter, other.counter);
+        std::swap(result, other.result);
+    }
+    std::atomic<int> *counter;
+    bool result;
+};
+
+void runChecks(CCheckQueue<CountingCheck> &queue, int workerThreads)
+{
+    boost::thread_group threads;
+    for (int i = 0; i < workerThreads; ++i)
+        threads.create_thread(std::bind(&CCheckQueue<CountingCheck>::Thread, &queue));
+
+    for (int round = 0; round < 20; ++round) {
+        std::atomic<int> counter(0);
+        CCheckQueueControl<CountingCheck> control(&queue);
+        int total = 0;
+        for (int batch = 1; batch < 60; ++batch) { // batches of varying size, like transactions in a block
+            std::vector<CountingCheck> checks;
+            for (int i = 0; i < batch % 7; ++i)
+                checks.push_back(CountingCheck(&counter, true));
+            total += checks.size();
+            control.Add(checks);
+        }
+        BOOST_CHECK(control.Wait());
+        BOOST_CHECK_EQUAL(counter, total);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    // a failing check makes Wait() return false and the queue is usable afterwards.
+    for (int round = 0; round < 5; ++round) {
+        std::atomic<int> counter(0);
+        CCheckQueueControl<CountingCheck> control(&queue);
+        std::vector<CountingCheck> checks;
+        for (int i = 0; i < 1000; ++i)
+            checks.push_back(CountingCheck(&counter, i != 500 || round % 2));
+        control.Add(checks);
+        BOOST_CHECK_EQUAL(control.Wait(), round % 2 == 1);
+        BOOST_CHECK(counter <= 1000);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(master_only)
+{
+    CCheckQueue<CountingCheck> queue(128);
+    runChecks(queue, 0);
+}
+
+BOOST_AUTO_TEST_CASE(workers)
+{
+    CCheckQueue<CountingCheck> queue(128);
+    runChecks(queue, 3);
+}
+
+BOOST_AUTO_TEST_CASE(more_workers_than_queues)
+{
+    CCheckQueue<CountingCheck> queue(16, 3);
+    runChecks(queue, 6);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
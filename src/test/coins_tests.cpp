@@ -1,4 +1,5 @@
 // Copyright (c) 2014-2015 The Bitcoin Core developers
+// Copyright (c) 2017 Tom Zander <tomz@freedommail.ch>
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -8,10 +9,16 @@
 #include "test/test_bitcoin.h"
 #include "main.h"
 #include "consensus/validation.h"
+#include "txdb.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "util.h"
 
 #include <vector>
 #include <map>
+#include <functional>
 
+#include <boost/thread.hpp>
 #include <boost/test/unit_test.hpp>
 
 namespace
@@ -44,7 +51,7 @@ public:
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CUtxoCommitment*)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -75,13 +82,60 @@ public:
         // Manually recompute the dynamic usage of the whole data, and compare it.
         size_t ret = memusage::DynamicUsage(cacheCoins);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.DynamicMemoryUsage();
         }
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
 };
 
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    // write a record in the one-entry-per-transaction layout
+    void writeOldCoins(const uint256 &txid, const CCoins &coins) {
+        db.Write(std::make_pair('c', txid), coins);
+    }
+
+    // drop the per transaction records, like a database written before they existed
+    void eraseTxRecords() {
+        boost::scoped_ptr<CDBIterator> cursor(db.NewIterator());
+        CDBBatch batch(&db.GetObfuscateKey());
+        std::pair<char, uint256> key;
+        for (cursor->Seek('T'); cursor->Valid() && cursor->GetKey(key) && key.first == 'T'; cursor->Next())
+            batch.Erase(key);
+        db.WriteBatch(batch);
+    }
+
+    bool calculate(CUtxoCommitment &commitment) {
+        uint256 bestBlock;
+        return calculateCommitment(commitment, bestBlock);
+    }
+
+    int countEntries(char type) {
+        boost::scoped_ptr<CDBIterator> cursor(db.NewIterator());
+        int count = 0;
+        std::pair<char, uint256> key;
+        for (cursor->Seek(type); cursor->Valid() && cursor->GetKey(key) && key.first == type; cursor->Next())
+            ++count;
+        return count;
+    }
+};
+
+CCoins createCoins(int outputs)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(outputs);
+    for (int i = 0; i < outputs; ++i) {
+        tx.vout[i].nValue = 1000 + i;
+        tx.vout[i].scriptPubKey.assign(insecure_rand() & 0x3F, 0);
+    }
+    return CCoins(tx, 100);
+}
+
 }
 
 BOOST_FIXTURE_TEST_SUITE(coins_tests, BasicTestingSetup)
@@ -347,4 +401,325 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
+BOOST_AUTO_TEST_CASE(coins_db_per_output)
+{
+    CCoinsViewDBTest db;
+    const uint256 txid = GetRandHash();
+    const CCoins coins = createCoins(4);
+    {
+        CCoinsViewCache cache(&db);
+        *cache.ModifyNewCoins(txid) = coins;
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(db.countEntries('C'), 4);
+    BOOST_CHECK_EQUAL(db.countEntries('T'), 1);
+    CCoins fromDb;
+    BOOST_CHECK(db.GetCoins(txid, fromDb));
+    BOOST_CHECK(fromDb == coins);
+
+    // spending one output only removes that one
+    CCoins expected = coins;
+    expected.Spend(1);
+    {
+        CCoinsViewCache cache(&db);
+        BOOST_CHECK(cache.ModifyCoins(txid)->Spend(1));
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(db.countEntries('C'), 3);
+    BOOST_CHECK(db.GetCoins(txid, fromDb));
+    BOOST_CHECK(fromDb == expected);
+
+    // the same through a stack of caches, the middle one having fetched the coins
+    {
+        CCoinsViewCache cache1(&db);
+        BOOST_CHECK(cache1.HaveCoins(txid));
+        CCoinsViewCache cache2(&cache1);
+        BOOST_CHECK(cache2.ModifyCoins(txid)->Spend(3));
+        expected.Spend(3);
+        BOOST_CHECK(cache2.Flush());
+        BOOST_CHECK(cache1.Flush());
+    }
+    BOOST_CHECK_EQUAL(db.countEntries('C'), 2);
+    BOOST_CHECK(db.GetCoins(txid, fromDb));
+    BOOST_CHECK(fromDb == expected);
+
+    // and when the middle cache did not know about it.
+    {
+        CCoinsViewCache cache1(&db);
+        CCoinsViewCache cache2(&cache1);
+        BOOST_CHECK(cache2.ModifyCoins(txid)->Spend(0));
+        cache1.Uncache(txid);
+        BOOST_CHECK(cache2.Flush());
+        BOOST_CHECK(cache1.Flush());
+    }
+    BOOST_CHECK_EQUAL(db.countEntries('C'), 1);
+
+    {
+        CCoinsViewCache cache(&db);
+        BOOST_CHECK(cache.ModifyCoins(txid)->Spend(2));
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK_EQUAL(db.countEntries('C'), 0);
+    BOOST_CHECK_EQUAL(db.countEntries('T'), 0);
+    BOOST_CHECK(!db.HaveCoins(txid));
+    BOOST_CHECK(!db.GetCoins(txid, fromDb));
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_upgrade)
+{
+    CCoinsViewDBTest db;
+    std::vector<std::pair<uint256, CCoins> > txs;
+    for (int i = 0; i < 20; ++i) {
+        CCoins coins = createCoins(1 + i % 5);
+        if (i % 3 == 0 && coins.vout.size() > 1)
+            coins.Spend(0); // a partially spent one
+        txs.push_back(std::make_pair(GetRandHash(), coins));
+        db.writeOldCoins(txs.back().first, coins);
+    }
+    BOOST_CHECK_EQUAL(db.countEntries('c'), 20);
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK_EQUAL(db.countEntries('c'), 0);
+    BOOST_CHECK_EQUAL(db.countEntries('T'), 20);
+    for (size_t i = 0; i < txs.size(); ++i) {
+        CCoins fromDb;
+        BOOST_CHECK(db.GetCoins(txs[i].first, fromDb));
+        BOOST_CHECK(fromDb == txs[i].second);
+    }
+    BOOST_CHECK(db.Upgrade()); // nothing left to do
+
+    // a per output database without the transaction records gets them added
+    db.eraseTxRecords();
+    BOOST_CHECK(!db.HaveCoins(txs[0].first));
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK_EQUAL(db.countEntries('T'), 20);
+    for (size_t i = 0; i < txs.size(); ++i) {
+        CCoins fromDb;
+        BOOST_CHECK(db.GetCoins(txs[i].first, fromDb));
+        BOOST_CHECK(fromDb == txs[i].second);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coins_background_write)
+{
+    CCoinsViewDBTest db;
+    CCoinsViewBackgroundWriter writer(&db);
+    CCoinsViewCache tip(&writer);
+    std::vector<std::pair<uint256, CCoins> > txs;
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < 50; ++i) {
+            txs.push_back(std::make_pair(GetRandHash(), createCoins(1 + i % 3)));
+            *tip.ModifyNewCoins(txs.back().first) = txs.back().second;
+        }
+        // spend an output of something that may be in the snapshot still being written
+        std::pair<uint256, CCoins> &spend = txs[insecure_rand() % txs.size()];
+        if (spend.second.IsAvailable(0)) {
+            BOOST_CHECK(tip.ModifyCoins(spend.first)->Spend(0));
+            spend.second.Spend(0);
+        }
+        const uint256 best = GetRandHash();
+        tip.SetBestBlock(best);
+        BOOST_CHECK(tip.FlushInBackground(writer));
+        BOOST_CHECK_EQUAL(tip.GetCacheSize(), 0);
+        BOOST_CHECK(writer.GetBestBlock() == best);
+
+        // everything is readable, whether it has been written yet or not.
+        for (size_t i = 0; i < txs.size(); ++i) {
+            const CCoins *coins = tip.AccessCoins(txs[i].first);
+            if (txs[i].second.IsPruned()) {
+                BOOST_CHECK(coins == NULL || coins->IsPruned());
+            } else {
+                BOOST_CHECK(coins);
+                BOOST_CHECK(coins && *coins == txs[i].second);
+            }
+        }
+        for (size_t i = 0; i < txs.size(); ++i)
+            tip.Uncache(txs[i].first);
+    }
+    BOOST_CHECK(writer.WaitForWrite());
+    BOOST_CHECK_EQUAL(writer.InFlightUsage(), 0);
+    BOOST_CHECK(!writer.IsWriting());
+    BOOST_CHECK(db.GetBestBlock() == tip.GetBestBlock());
+    for (size_t i = 0; i < txs.size(); ++i) {
+        CCoins fromDb;
+        BOOST_CHECK_EQUAL(db.GetCoins(txs[i].first, fromDb), !txs[i].second.IsPruned());
+        BOOST_CHECK(txs[i].second.IsPruned() || fromDb == txs[i].second);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coins_prefetch)
+{
+    CCoinsViewDBTest db;
+    std::vector<uint256> txids;
+    std::map<uint256, CCoins> stored;
+    {
+        CCoinsViewCache writeCache(&db);
+        for (int i = 0; i < 200; ++i) {
+            txids.push_back(GetRandHash());
+            stored[txids.back()] = createCoins(1 + i % 4);
+            *writeCache.ModifyNewCoins(txids.back()) = stored[txids.back()];
+        }
+        writeCache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(writeCache.Flush());
+    }
+    // lookups for txids that are unknown are allowed, they just don't end up in the cache.
+    for (int i = 0; i < 20; ++i)
+        txids.push_back(GetRandHash());
+
+    CCheckQueue<CCoinsLookup> queue(16);
+    boost::thread_group threads;
+    for (int i = 0; i < 3; ++i)
+        threads.create_thread(std::bind(&CCheckQueue<CCoinsLookup>::Thread, &queue));
+
+    CCoinsViewCache cache(&db);
+    CCoins *modified = &(*cache.ModifyCoins(txids[0]) = stored[txids[0]]);
+    modified->Spend(0);
+    cache.Prefetch(txids, &queue);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 200);
+    // an entry already in the cache is not replaced.
+    BOOST_CHECK(!cache.AccessCoins(txids[0])->IsAvailable(0));
+    for (int i = 1; i < 200; ++i) {
+        const CCoins *coins = cache.AccessCoins(txids[i]);
+        BOOST_CHECK(coins && *coins == stored[txids[i]]);
+    }
+    // spending from a prefetched entry is written like any other.
+    BOOST_CHECK(cache.ModifyCoins(txids[1])->Spend(0));
+    BOOST_CHECK(cache.Flush());
+    CCoins fromDb;
+    BOOST_CHECK(db.GetCoins(txids[1], fromDb));
+    BOOST_CHECK(!fromDb.IsAvailable(0));
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(coins_snapshot)
+{
+    CCoinsViewDBTest db;
+    std::map<uint256, CCoins> stored;
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 100; ++i) {
+            const uint256 txid = GetRandHash();
+            stored[txid] = createCoins(1 + i % 4);
+            if (stored[txid].vout.size() > 1)
+                stored[txid].Spend(0);
+            *cache.ModifyNewCoins(txid) = stored[txid];
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    const boost::filesystem::path path = GetTempPath() / strprintf("utxo_snapshot_%s", GetRandHash().ToString());
+    CCoinsStats stats;
+    {
+        CAutoFile file(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(db.WriteSnapshot(file, stats));
+    }
+    BOOST_CHECK(stats.hashBlock == db.GetBestBlock());
+    BOOST_CHECK_EQUAL(stats.nTransactions, 100);
+
+    CCoinsViewDBTest copy;
+    {
+        CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(copy.LoadSnapshot(file));
+    }
+    BOOST_CHECK(copy.GetBestBlock() == db.GetBestBlock());
+    BOOST_CHECK_EQUAL(copy.countEntries('C'), db.countEntries('C'));
+    BOOST_CHECK_EQUAL(copy.countEntries('T'), 100);
+    for (auto iter = stored.begin(); iter != stored.end(); ++iter) {
+        CCoins coins;
+        BOOST_CHECK(copy.GetCoins(iter->first, coins));
+        BOOST_CHECK(coins == iter->second);
+    }
+    {
+        // only an empty database can be filled.
+        CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!copy.LoadSnapshot(file));
+    }
+
+    // a damaged file is refused before anything is written.
+    {
+        FILE *file = fopen(path.string().c_str(), "r+b");
+        fseek(file, 200, SEEK_SET);
+        const char c = fgetc(file);
+        fseek(file, 200, SEEK_SET);
+        fputc(c ^ 1, file);
+        fclose(file);
+    }
+    CCoinsViewDBTest damaged;
+    {
+        CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!damaged.LoadSnapshot(file));
+    }
+    BOOST_CHECK(damaged.GetBestBlock().IsNull());
+    BOOST_CHECK_EQUAL(damaged.countEntries('C'), 0);
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(coins_commitment)
+{
+    CCoinsViewDBTest db;
+    CCoinsViewCache tip(&db);
+    std::vector<COutPoint> unspent;
+    for (int height = 1; height < 40; ++height) {
+        CCoinsViewCache view(&tip);
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << height;
+        coinbase.vout.resize(2);
+        coinbase.vout[0].nValue = 5000;
+        coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+        coinbase.vout[1].nValue = 0;
+        coinbase.vout[1].scriptPubKey = CScript() << OP_RETURN; // never stored
+        CValidationState state;
+        UpdateCoins(coinbase, state, view, height);
+        unspent.push_back(COutPoint(coinbase.GetHash(), 0));
+
+        for (int i = 0; i < 5 && unspent.size() > 1; ++i) {
+            CMutableTransaction tx;
+            for (int in = 0; in < 2 && !unspent.empty(); ++in) {
+                const size_t index = insecure_rand() % unspent.size();
+                tx.vin.push_back(CTxIn(unspent[index]));
+                unspent.erase(unspent.begin() + index);
+            }
+            tx.vout.resize(1 + insecure_rand() % 3);
+            for (size_t out = 0; out < tx.vout.size(); ++out) {
+                tx.vout[out].nValue = 100 + out;
+                tx.vout[out].scriptPubKey.assign(insecure_rand() & 0x1F, 0);
+            }
+            for (size_t out = 0; out < tx.vout.size(); ++out)
+                unspent.push_back(COutPoint(tx.GetHash(), out));
+            UpdateCoins(tx, state, view, height);
+        }
+        view.SetBestBlock(GetRandHash());
+        BOOST_CHECK(view.Flush());
+        if (height % 7 == 0) {
+            BOOST_CHECK(tip.Flush());
+            CCoinsStats fromCache, walked;
+            CUtxoCommitment commitment;
+            BOOST_CHECK(db.calculate(commitment));
+            commitment.GetStats(walked);
+            BOOST_CHECK(db.GetStats(fromCache));
+            BOOST_CHECK(fromCache.hashSerialized == walked.hashSerialized);
+            BOOST_CHECK_EQUAL(fromCache.nTransactions, walked.nTransactions);
+            BOOST_CHECK_EQUAL(fromCache.nTransactionOutputs, unspent.size());
+            BOOST_CHECK_EQUAL(fromCache.nTransactionOutputs, walked.nTransactionOutputs);
+            BOOST_CHECK_EQUAL(fromCache.nSerializedSize, walked.nSerializedSize);
+            BOOST_CHECK_EQUAL(fromCache.nTotalAmount, walked.nTotalAmount);
+        }
+    }
+
+    // a cache that stopped tracking makes the database forget its commitment.
+    CCoinsStats before;
+    BOOST_CHECK(tip.GetStats(before));
+    tip.DiscardCommitment();
+    BOOST_CHECK(tip.Flush());
+    CUtxoCommitment commitment;
+    BOOST_CHECK(!db.GetCommitment(commitment));
+    BOOST_CHECK(db.InitCommitment());
+    CCoinsStats after;
+    BOOST_CHECK(db.GetStats(after));
+    BOOST_CHECK(before.hashSerialized == after.hashSerialized);
+    BOOST_CHECK_EQUAL(before.nTotalAmount, after.nTotalAmount);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
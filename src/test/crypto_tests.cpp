@@ -9,6 +9,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -436,4 +437,57 @@ BOOST_AUTO_TEST_CASE(aes_cbc_testvectors) {
                   "b2eb05e2c39be9fcda6c19078c6a9d1b3f461796d6b0d6b2e0c2a72b4d80e644");
 }
 
+namespace {
+std::string muhashToHex(const MuHash3072 &hash)
+{
+    unsigned char out[MuHash3072::OUTPUT_SIZE];
+    hash.Finalize(out);
+    return HexStr(out, out + sizeof(out));
+}
+
+MuHash3072 &insert(MuHash3072 &hash, const std::string &data)
+{
+    return hash.Insert(reinterpret_cast<const unsigned char*>(data.c_str()), data.size());
+}
+
+MuHash3072 &remove(MuHash3072 &hash, const std::string &data)
+{
+    return hash.Remove(reinterpret_cast<const unsigned char*>(data.c_str()), data.size());
+}
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests) {
+    MuHash3072 empty;
+    BOOST_CHECK_EQUAL(muhashToHex(empty), "c85525462fdcf30a2c18d6f4b92923000974355c2477f59594d2c205a1d25add");
+    MuHash3072 a;
+    insert(a, "a");
+    BOOST_CHECK_EQUAL(muhashToHex(a), "8ecb2175cf9ebbb1691350d88675423858574e77607a64f79cf708ccc4c7d2d0");
+    MuHash3072 abc;
+    remove(insert(insert(abc, "a"), "b"), "c");
+    BOOST_CHECK_EQUAL(muhashToHex(abc), "eeea4bae3e4db299dde313d6ae930dc59cfdac4ff2b5b32a96af544c98761595");
+
+    // the order of changes does not matter.
+    MuHash3072 cba;
+    insert(insert(remove(cba, "c"), "b"), "a");
+    BOOST_CHECK_EQUAL(muhashToHex(cba), muhashToHex(abc));
+
+    // removing what was added gives the empty set.
+    remove(insert(a, "b"), "b");
+    remove(a, "a");
+    BOOST_CHECK_EQUAL(muhashToHex(a), muhashToHex(empty));
+
+    MuHash3072 b;
+    insert(b, "b");
+    MuHash3072 combined;
+    remove(insert(combined, "a"), "c");
+    combined *= b;
+    BOOST_CHECK_EQUAL(muhashToHex(combined), muhashToHex(abc));
+
+    unsigned char data[MuHash3072::SERIALIZED_SIZE];
+    abc.ToBytes(data);
+    MuHash3072 copy;
+    copy.FromBytes(data);
+    BOOST_CHECK_EQUAL(muhashToHex(copy), muhashToHex(abc));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
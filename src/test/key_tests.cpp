@@ -199,4 +199,42 @@ BOOST_AUTO_TEST_CASE(key_test2)
     BOOST_CHECK_EQUAL(convertedFromCash.ToString(), legacy.ToString());
 }
 
+BOOST_AUTO_TEST_CASE(pubkey_parse_cache)
+{
+    CBitcoinSecret bsecret1, bsecret2C;
+    BOOST_CHECK(bsecret1.SetString(strSecret1));
+    BOOST_CHECK(bsecret2C.SetString(strSecret2C));
+    const CKey key1 = bsecret1.GetKey();
+    const CKey key2C = bsecret2C.GetKey();
+    const CPubKey pubkey1 = key1.GetPubKey();
+    const CPubKey pubkey2C = key2C.GetPubKey();
+
+    CPubKeyParseCache cache;
+    for (int n = 0; n < 8; n++) {
+        std::string strMsg = strprintf("Very secret message %i: 11", n);
+        uint256 hashMsg = Hash(strMsg.begin(), strMsg.end());
+        std::vector<unsigned char> sign1, sign2C;
+        BOOST_CHECK(key1.Sign(hashMsg, sign1));
+        BOOST_CHECK(key2C.Sign(hashMsg, sign2C));
+
+        BOOST_CHECK(cache.Verify(pubkey1, hashMsg, sign1));
+        BOOST_CHECK(cache.Verify(pubkey2C, hashMsg, sign2C));
+        BOOST_CHECK(!cache.Verify(pubkey1, hashMsg, sign2C));
+        BOOST_CHECK(!cache.Verify(pubkey2C, hashMsg, sign1));
+        BOOST_CHECK(!cache.Verify(pubkey1, hashMsg, std::vector<unsigned char>()));
+    }
+    BOOST_CHECK_EQUAL(cache.size(), 2);
+
+    // a key of the right size that does not parse (x beyond the field size) is remembered as such.
+    std::vector<unsigned char> badKey(33, 0xff);
+    badKey[0] = 0x02;
+    const CPubKey pubkeyBad(badKey);
+    uint256 hashMsg = Hash(strSecret1.begin(), strSecret1.end());
+    std::vector<unsigned char> sign2C;
+    BOOST_CHECK(key2C.Sign(hashMsg, sign2C));
+    BOOST_CHECK(!cache.Verify(pubkeyBad, hashMsg, sign2C));
+    BOOST_CHECK(!cache.Verify(pubkeyBad, hashMsg, sign2C));
+    BOOST_CHECK_EQUAL(cache.size(), 3);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -318,6 +318,125 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
 }
 
 
+BOOST_AUTO_TEST_CASE(MempoolRemoveForBlockTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_1;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        txParent.vout[i].nValue = 10 * COIN;
+    }
+    // spends an output of txParent and an output that the block spends as well
+    CMutableTransaction txConflict;
+    txConflict.vin.resize(2);
+    txConflict.vin[0].prevout = COutPoint(txParent.GetHash(), 1);
+    txConflict.vin[0].scriptSig = CScript() << OP_2;
+    txConflict.vin[1].prevout = COutPoint(uint256S("0x1"), 0);
+    txConflict.vin[1].scriptSig = CScript() << OP_2;
+    txConflict.vout.resize(1);
+    txConflict.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    txConflict.vout[0].nValue = 10 * COIN;
+    CMutableTransaction txConflictChild;
+    txConflictChild.vin.resize(1);
+    txConflictChild.vin[0].prevout = COutPoint(txConflict.GetHash(), 0);
+    txConflictChild.vin[0].scriptSig = CScript() << OP_3;
+    txConflictChild.vout.resize(1);
+    txConflictChild.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    txConflictChild.vout[0].nValue = 10 * COIN;
+    // in the mempool and in the block, its child stays
+    CMutableTransaction txMined;
+    txMined.vin.resize(1);
+    txMined.vin[0].prevout = COutPoint(uint256S("0x2"), 0);
+    txMined.vin[0].scriptSig = CScript() << OP_4;
+    txMined.vout.resize(1);
+    txMined.vout[0].scriptPubKey = CScript() << OP_4 << OP_EQUAL;
+    txMined.vout[0].nValue = 10 * COIN;
+    CMutableTransaction txMinedChild;
+    txMinedChild.vin.resize(1);
+    txMinedChild.vin[0].prevout = COutPoint(txMined.GetHash(), 0);
+    txMinedChild.vin[0].scriptSig = CScript() << OP_5;
+    txMinedChild.vout.resize(1);
+    txMinedChild.vout[0].scriptPubKey = CScript() << OP_5 << OP_EQUAL;
+    txMinedChild.vout[0].nValue = 10 * COIN;
+    // only in the block
+    CMutableTransaction txBlock;
+    txBlock.vin.resize(1);
+    txBlock.vin[0].prevout = COutPoint(uint256S("0x1"), 0);
+    txBlock.vin[0].scriptSig = CScript() << OP_6;
+    txBlock.vout.resize(1);
+    txBlock.vout[0].scriptPubKey = CScript() << OP_6 << OP_EQUAL;
+    txBlock.vout[0].nValue = 10 * COIN;
+
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent, &pool));
+    pool.addUnchecked(txConflict.GetHash(), entry.Fee(2000LL).FromTx(txConflict, &pool));
+    pool.addUnchecked(txConflictChild.GetHash(), entry.Fee(3000LL).FromTx(txConflictChild, &pool));
+    pool.addUnchecked(txMined.GetHash(), entry.Fee(4000LL).FromTx(txMined, &pool));
+    pool.addUnchecked(txMinedChild.GetHash(), entry.Fee(5000LL).FromTx(txMinedChild, &pool));
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txParent.GetHash())->GetCountWithDescendants(), 3);
+
+    std::vector<CTransaction> vtx;
+    vtx.push_back(txBlock);
+    vtx.push_back(txMined);
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK_EQUAL(conflicts.size(), 2);
+    BOOST_CHECK(!pool.exists(txConflict.GetHash()));
+    BOOST_CHECK(!pool.exists(txConflictChild.GetHash()));
+    BOOST_CHECK(!pool.exists(txMined.GetHash()));
+
+    CTxMemPool::txiter parent = pool.mapTx.find(txParent.GetHash());
+    BOOST_CHECK(parent != pool.mapTx.end());
+    BOOST_CHECK_EQUAL(parent->GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(parent->GetSizeWithDescendants(), parent->GetTxSize());
+    BOOST_CHECK_EQUAL(parent->GetModFeesWithDescendants(), 1000);
+    BOOST_CHECK(pool.GetMemPoolChildren(parent).empty());
+
+    CTxMemPool::txiter child = pool.mapTx.find(txMinedChild.GetHash());
+    BOOST_CHECK(child != pool.mapTx.end());
+    BOOST_CHECK(pool.GetMemPoolParents(child).empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolCheapHashTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    LOCK(pool.cs);
+
+    std::vector<CTransaction> txs;
+    for (int i = 0; i < 10; ++i) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = COIN;
+        txs.push_back(tx);
+        pool.addUnchecked(tx.GetHash(), entry.FromTx(tx, &pool));
+    }
+
+    bool collision = false;
+    for (const CTransaction &tx : txs) {
+        CTxMemPool::txiter iter = pool.findByCheapHash(tx.GetHash().GetCheapHash(), collision);
+        BOOST_CHECK(iter != pool.mapTx.end());
+        BOOST_CHECK(iter->GetTx().GetHash() == tx.GetHash());
+    }
+    BOOST_CHECK(!collision);
+
+    // the index follows removals
+    std::list<CTransaction> removed;
+    pool.remove(txs[3], removed);
+    BOOST_CHECK(pool.findByCheapHash(txs[3].GetHash().GetCheapHash(), collision) == pool.mapTx.end());
+    BOOST_CHECK(pool.findByCheapHash(txs[4].GetHash().GetCheapHash(), collision) != pool.mapTx.end());
+}
+
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
     CTxMemPool pool(CFeeRate(1000));
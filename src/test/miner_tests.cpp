@@ -126,6 +126,36 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     BOOST_CHECK(pblocktemplate = miner.CreateNewBlock(chainparams));
     delete pblocktemplate;
 
+    // transactions arriving after a template was made are added to the next one
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 4900000000LL;
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    hash = tx.GetHash();
+    mempool.addUnchecked(hash, entry.Fee(100000000LL).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+    BOOST_CHECK(pblocktemplate = miner.CreateNewBlock(chainparams));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    delete pblocktemplate;
+    tx.vin[0].prevout.hash = hash;
+    tx.vout[0].nValue = 4800000000LL;
+    const CTransaction child(tx);
+    mempool.addUnchecked(child.GetHash(), entry.Fee(100000000LL).Time(GetTime()).SpendsCoinbase(false).FromTx(tx));
+    BOOST_CHECK(pblocktemplate = miner.CreateNewBlock(chainparams));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == child.GetHash());
+    delete pblocktemplate;
+    // and leave it again when they leave the mempool
+    std::list<CTransaction> removed;
+    mempool.remove(child, removed);
+    BOOST_CHECK(pblocktemplate = miner.CreateNewBlock(chainparams));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    delete pblocktemplate;
+    mempool.clear();
+    tx.vout[0].scriptPubKey = CScript();
+
     // block sigops > limit: 1000 CHECKMULTISIG + 1
     tx.vin.resize(1);
     // NOTE: OP_NOP is used to force 20 SigOps for the CHECKMULTISIG
@@ -0,0 +1,70 @@
+// Copyright (c) 2017 The Bitcoin Classic developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+#include "hash.h"
+#include "crypto/common.h"
+#include "streams.h"
+#include "utiltime.h"
+#include "version.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+std::vector<char> createMessage(const CNode &node, const char *command, const std::vector<char> &payload, bool corrupt = false)
+{
+    CMessageHeader header(node.magic(), command, payload.size());
+    const uint256 hash = Hash(payload.begin(), payload.end());
+    header.nChecksum = ReadLE32(hash.begin()) + (corrupt ? 1 : 0);
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << header;
+    std::vector<char> answer(stream.begin(), stream.end());
+    answer.insert(answer.end(), payload.begin(), payload.end());
+    return answer;
+}
+
+bool waitForChecksums(const CNode &node)
+{
+    for (int i = 0; i < 1000 && node.nChecksumJobs > 0; ++i)
+        MilliSleep(5);
+    return node.nChecksumJobs == 0;
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(net_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(receive_checksums)
+{
+    CAddress addr;
+    CNode node(INVALID_SOCKET, addr, "", true);
+
+    std::vector<char> small(100, 'a');
+    std::vector<char> large(PARALLEL_CHECKSUM_MIN_SIZE + 100, 'b');
+    std::vector<char> data = createMessage(node, "small", small);
+    std::vector<char> part = createMessage(node, "large", large);
+    data.insert(data.end(), part.begin(), part.end());
+    part = createMessage(node, "broken", large, true);
+    data.insert(data.end(), part.begin(), part.end());
+    part = createMessage(node, "broken2", small, true);
+    data.insert(data.end(), part.begin(), part.end());
+
+    LOCK(node.cs_vRecvMsg);
+    // feed it in chunks like the socket would
+    for (size_t pos = 0; pos < data.size(); pos += 0x10000) {
+        const size_t size = std::min<size_t>(0x10000, data.size() - pos);
+        BOOST_CHECK(node.ReceiveMsgBytes(&data[pos], size));
+    }
+    BOOST_CHECK(waitForChecksums(node));
+
+    BOOST_CHECK_EQUAL(node.vRecvMsg.size(), 4);
+    for (const CNetMessage &msg : node.vRecvMsg)
+        BOOST_CHECK(msg.checked());
+    BOOST_CHECK(node.vRecvMsg[0].checksumValid());
+    BOOST_CHECK(node.vRecvMsg[1].checksumValid());
+    BOOST_CHECK(!node.vRecvMsg[2].checksumValid());
+    BOOST_CHECK(!node.vRecvMsg[3].checksumValid());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
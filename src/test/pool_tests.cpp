@@ -0,0 +1,103 @@
+/*
+ * This file is part of the bitcoin-classic project
+ * Copyright (C) 2017 Tom Zander <tomz@freedommail.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test_bitcoin.h"
+#include <memusage.h>
+#include <support/allocators/pool.h>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/unordered_map.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(reuse_blocks)
+{
+    PoolResource<64, 16> resource(1024);
+    BOOST_CHECK_EQUAL(resource.usage(), 0);
+
+    void *a = resource.allocate(20, 8);
+    void *b = resource.allocate(20, 8);
+    BOOST_CHECK(a != b);
+    BOOST_CHECK_EQUAL(static_cast<char*>(b) - static_cast<char*>(a), 32); // rounded up to the alignment
+    const size_t oneChunk = resource.usage();
+    BOOST_CHECK(oneChunk >= 1024);
+
+    // a freed block is handed out again for the same size class
+    resource.deallocate(a, 20, 8);
+    void *c = resource.allocate(30, 8);
+    BOOST_CHECK(c == a);
+
+    // filling more than a chunk takes a new chunk
+    std::vector<void*> blocks;
+    for (int i = 0; i < 40; ++i)
+        blocks.push_back(resource.allocate(64, 8));
+    BOOST_CHECK_EQUAL(resource.usage(), oneChunk * 3);
+    for (void *p : blocks)
+        resource.deallocate(p, 64, 8);
+    BOOST_CHECK_EQUAL(resource.usage(), oneChunk * 3);
+
+    // too large goes to the normal allocator, but is counted
+    void *large = resource.allocate(1000, 8);
+    BOOST_CHECK(resource.usage() >= oneChunk * 3 + 1000);
+    resource.deallocate(large, 1000, 8);
+    BOOST_CHECK_EQUAL(resource.usage(), oneChunk * 3);
+
+    resource.deallocate(b, 20, 8);
+    resource.deallocate(c, 30, 8);
+}
+
+BOOST_AUTO_TEST_CASE(growing_chunks)
+{
+    PoolResource<64, 16> resource(4096, 256);
+    BOOST_CHECK_EQUAL(resource.usage(), 0);
+    std::vector<void*> blocks;
+    blocks.push_back(resource.allocate(64, 8));
+    const size_t firstChunk = resource.usage();
+    BOOST_CHECK(firstChunk >= 256);
+    BOOST_CHECK(firstChunk < 512);
+
+    // 256 + 512 + 1024 + 2048 + 4096 + 4096 bytes hold 188 blocks of 64 bytes
+    for (int i = 1; i < 188; ++i)
+        blocks.push_back(resource.allocate(64, 8));
+    const size_t sixChunks = resource.usage();
+    BOOST_CHECK(sixChunks >= 256 + 512 + 1024 + 2048 + 4096 * 2);
+    BOOST_CHECK(sixChunks < 256 + 512 + 1024 + 2048 + 4096 * 3);
+    for (void *p : blocks)
+        resource.deallocate(p, 64, 8);
+}
+
+BOOST_AUTO_TEST_CASE(unordered_map)
+{
+    typedef PoolAllocator<std::pair<const int, uint64_t>, 64> Allocator;
+    typedef boost::unordered_map<int, uint64_t, boost::hash<int>, std::equal_to<int>, Allocator> Map;
+    Allocator::Resource resource;
+    {
+        Map map(0, boost::hash<int>(), std::equal_to<int>(), Allocator(&resource));
+        for (int i = 0; i < 10000; ++i)
+            map[i] = i * 2;
+        for (int i = 0; i < 10000; i += 2)
+            map.erase(i);
+        BOOST_CHECK_EQUAL(map.size(), 5000);
+        for (int i = 1; i < 10000; i += 2)
+            BOOST_CHECK_EQUAL(map[i], i * 2);
+        BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), resource.usage());
+        BOOST_CHECK(resource.usage() > 10000 * sizeof(std::pair<const int, uint64_t>));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -186,4 +186,26 @@ BOOST_AUTO_TEST_CASE(sighash_from_data)
         BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
     }
 }
+
+BOOST_AUTO_TEST_CASE(sighash_forkid_precomputed)
+{
+    seed_insecure_rand(false);
+
+    for (int i = 0; i < 1000; i++) {
+        int nHashType = insecure_rand() | SIGHASH_FORKID;
+
+        CMutableTransaction mtx;
+        TxUtils::RandomTransaction(mtx, (nHashType & 0x1f) == SIGHASH_SINGLE ? TxUtils::SingleOutput: TxUtils::AnyOutputCount);
+        const CTransaction txTo(mtx);
+        CScript scriptCode;
+        TxUtils::RandomScript(scriptCode);
+        const int nIn = insecure_rand() % txTo.vin.size();
+        const CAmount amount = insecure_rand();
+
+        const PrecomputedTransactionData txdata(txTo);
+        const uint256 sh = SignatureHash(scriptCode, txTo, nIn, amount, nHashType, SCRIPT_ENABLE_SIGHASH_FORKID);
+        const uint256 shCached = SignatureHash(scriptCode, txTo, nIn, amount, nHashType, SCRIPT_ENABLE_SIGHASH_FORKID, &txdata);
+        BOOST_CHECK(sh == shCached);
+    }
+}
 BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,10 @@
 #include "serialize.h"
 #include "utilstrencodings.h"
 #include "thinblock.h"
+#include "main.h"
+#include "net.h"
+#include "txmempool.h"
+#include "test/test_bitcoin.h"
 #include <boost/test/unit_test.hpp>
 
 
@@ -66,4 +70,91 @@ BOOST_AUTO_TEST_CASE(thinblock_test) {
     BOOST_CHECK(xthinblock3.collision);
 }
 
+BOOST_FIXTURE_TEST_CASE(thinblock_process, TestingSetup) {
+    CBlock block = TestBlock();
+    CXThinBlock xthinblock(block, nullptr); // only sends the coinbase
+    BOOST_CHECK_EQUAL(1, xthinblock.vMissingTx.size());
+
+    TestMemPoolEntryHelper entry;
+    for (size_t i = 1; i < block.vtx.size(); ++i) {
+        CMutableTransaction tx(block.vtx[i]);
+        mempool.addUnchecked(block.vtx[i].GetHash(), entry.FromTx(tx));
+    }
+
+    CAddress addr;
+    CNode node(INVALID_SOCKET, addr, "", true);
+    BOOST_CHECK(xthinblock.process(&node));
+    BOOST_CHECK_EQUAL(node.thinBlockWaitingForTxns, -1);
+    BOOST_CHECK_EQUAL(node.thinBlock.vtx.size(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); ++i)
+        BOOST_CHECK(node.thinBlock.vtx[i] == block.vtx[i]);
+    BOOST_CHECK(node.thinBlock.GetHash() == block.GetHash());
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(thinblock_salted_shortids) {
+    CBlock block = TestBlock();
+    CXThinBlock legacy(block);
+    for (int bytes = 6; bytes <= 8; bytes += 2) {
+        CXThinBlock xthinblock(block, nullptr, bytes);
+        BOOST_CHECK_EQUAL(xthinblock.shortIdBytes, bytes);
+        BOOST_CHECK(!xthinblock.collision);
+        const CXThinShortIds shortIds = xthinblock.shortIds();
+        BOOST_CHECK(shortIds.isSalted());
+        for (size_t i = 0; i < block.vtx.size(); ++i) {
+            BOOST_CHECK_EQUAL(xthinblock.vTxHashes[i], shortIds(block.vtx[i].GetHash()));
+            BOOST_CHECK(xthinblock.vTxHashes[i] != legacy.vTxHashes[i]);
+            if (bytes == 6)
+                BOOST_CHECK_EQUAL(xthinblock.vTxHashes[i] >> 48, 0);
+        }
+        // another nonce gives other ids
+        CXThinBlock other(block, nullptr, bytes);
+        BOOST_CHECK(other.shortIdNonce != xthinblock.shortIdNonce);
+        BOOST_CHECK(other.vTxHashes != xthinblock.vTxHashes);
+
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << CXThinBlock::Salted(xthinblock);
+        // the nonce and the width cost 9 bytes, the ids save (8 - width) bytes each.
+        BOOST_CHECK_EQUAL(stream.size() + (8 - bytes) * block.vtx.size(), ::GetSerializeSize(legacy, SER_NETWORK, PROTOCOL_VERSION) + 9);
+
+        CXThinBlock copy;
+        CXThinBlock::Salted salted(copy);
+        stream >> salted;
+        BOOST_CHECK(copy.header.GetHash() == block.GetHash());
+        BOOST_CHECK_EQUAL(copy.shortIdNonce, xthinblock.shortIdNonce);
+        BOOST_CHECK_EQUAL(copy.shortIdBytes, bytes);
+        BOOST_CHECK(copy.vTxHashes == xthinblock.vTxHashes);
+        BOOST_CHECK_EQUAL(copy.vMissingTx.size(), 1);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(thinblock_salted_process, TestingSetup) {
+    CBlock block = TestBlock();
+    CXThinBlock xthinblock(block, nullptr, 6);
+
+    // all but one of the transactions are known
+    TestMemPoolEntryHelper entry;
+    for (size_t i = 1; i < block.vtx.size() - 1; ++i) {
+        CMutableTransaction tx(block.vtx[i]);
+        mempool.addUnchecked(block.vtx[i].GetHash(), entry.FromTx(tx));
+    }
+
+    CAddress addr;
+    CNode node(INVALID_SOCKET, addr, "", true);
+    BOOST_CHECK(!xthinblock.process(&node));
+    BOOST_CHECK_EQUAL(node.thinBlockWaitingForTxns, 1);
+    BOOST_CHECK_EQUAL(node.xThinBlockShortIdBytes, 6);
+    BOOST_CHECK_EQUAL(node.thinBlock.vtx.size(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size() - 1; ++i)
+        BOOST_CHECK(node.thinBlock.vtx[i] == block.vtx[i]);
+    BOOST_CHECK(node.thinBlock.vtx.back().IsNull());
+
+    // with the last one in the mempool too the block is complete
+    CMutableTransaction tx(block.vtx.back());
+    mempool.addUnchecked(block.vtx.back().GetHash(), entry.FromTx(tx));
+    BOOST_CHECK(xthinblock.process(&node));
+    BOOST_CHECK(node.thinBlock.GetHash() == block.GetHash());
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,103 @@
+/*
+ * This file is part of the bitcoin-classic project
+ * Copyright (C) 2017 Tom Zander <tomz@freedommail.ch>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "test_bitcoin.h"
+#include "transaction_utils.h"
+
+#include <blockchain/Block.h>
+#include <primitives/block.h>
+#include <random.h>
+#include <streaming/BufferPool.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(tx_iterator_tests, BasicTestingSetup)
+
+static void compareTransaction(const Tx &tx, const CTransaction &orig)
+{
+    Tx::Iterator iter(tx);
+    BOOST_CHECK_EQUAL(iter.next(), Tx::TxVersion);
+    BOOST_CHECK_EQUAL(iter.intData(), orig.nVersion);
+    for (const CTxIn &in : orig.vin) {
+        BOOST_CHECK_EQUAL(iter.next(), Tx::PrevTxHash);
+        BOOST_CHECK(iter.uint256Data() == in.prevout.hash);
+        BOOST_CHECK_EQUAL(iter.next(), Tx::PrevTxIndex);
+        BOOST_CHECK_EQUAL(iter.uintData(), in.prevout.n);
+        BOOST_CHECK_EQUAL(iter.next(), Tx::TxInScript);
+        Streaming::ConstBuffer script = iter.byteData();
+        BOOST_CHECK_EQUAL(script.size(), in.scriptSig.size());
+        BOOST_CHECK(CScript(reinterpret_cast<const unsigned char*>(script.begin()),
+                reinterpret_cast<const unsigned char*>(script.end())) == in.scriptSig);
+        BOOST_CHECK_EQUAL(iter.next(), Tx::Sequence);
+        BOOST_CHECK_EQUAL(iter.uintData(), in.nSequence);
+    }
+    for (const CTxOut &out : orig.vout) {
+        BOOST_CHECK_EQUAL(iter.next(), Tx::OutputValue);
+        BOOST_CHECK_EQUAL(iter.longData(), (uint64_t) out.nValue);
+        BOOST_CHECK_EQUAL(iter.next(), Tx::OutputScript);
+        Streaming::ConstBuffer script = iter.byteData();
+        BOOST_CHECK_EQUAL(script.size(), out.scriptPubKey.size());
+        BOOST_CHECK(CScript(reinterpret_cast<const unsigned char*>(script.begin()),
+                reinterpret_cast<const unsigned char*>(script.end())) == out.scriptPubKey);
+    }
+    BOOST_CHECK_EQUAL(iter.next(), Tx::LockTime);
+    BOOST_CHECK_EQUAL(iter.uintData(), orig.nLockTime);
+    BOOST_CHECK_EQUAL(iter.next(), Tx::End);
+    BOOST_CHECK_EQUAL(iter.next(), Tx::End);
+    BOOST_CHECK_EQUAL(iter.consumed(), tx.size());
+}
+
+BOOST_AUTO_TEST_CASE(iterate)
+{
+    seed_insecure_rand(false);
+    CBlock block;
+    for (int i = 0; i < 50; ++i) {
+        CMutableTransaction tx;
+        TxUtils::RandomTransaction(tx, TxUtils::AnyOutputCount);
+        block.vtx.push_back(tx);
+    }
+
+    FastBlock fastBlock = FastBlock::fromOldBlock(block);
+    fastBlock.findTransactions();
+    BOOST_CHECK_EQUAL(fastBlock.transactions().size(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); ++i) {
+        const Tx &tx = fastBlock.transactions().at(i);
+        BOOST_CHECK(tx.createHash() == block.vtx[i].GetHash());
+        compareTransaction(tx, block.vtx[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(truncated)
+{
+    seed_insecure_rand(false);
+    CMutableTransaction mtx;
+    TxUtils::RandomTransaction(mtx, TxUtils::SingleOutput);
+    CBlock block;
+    block.vtx.push_back(mtx);
+    FastBlock fastBlock = FastBlock::fromOldBlock(block);
+    fastBlock.findTransactions();
+    const Tx tx = fastBlock.transactions().front();
+
+    // cutting off any part of the transaction makes the iterator throw instead of reading beyond the end.
+    for (int length = 0; length < tx.size(); ++length) {
+        Tx::Iterator iter(Tx(fastBlock.data().mid(fastBlock.size() - tx.size(), length)));
+        BOOST_CHECK_THROW(while (iter.next() != Tx::End);, std::runtime_error);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
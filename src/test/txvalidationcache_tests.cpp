@@ -9,6 +9,7 @@
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "test/test_bitcoin.h"
 #include "utiltime.h"
@@ -73,4 +74,20 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
 }
 #endif
 
+BOOST_FIXTURE_TEST_CASE(tx_script_flags_cache, BasicTestingSetup)
+{
+    const uint256 txid = GetRandHash();
+    const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC | SCRIPT_ENABLE_SIGHASH_FORKID;
+    BOOST_CHECK(!IsValidatedTransaction(txid, flags, false));
+    AddValidatedTransaction(txid, flags);
+    BOOST_CHECK(IsValidatedTransaction(txid, flags, false));
+    // only valid for the exact flags it was checked with
+    BOOST_CHECK(!IsValidatedTransaction(txid, flags | SCRIPT_VERIFY_DERSIG, false));
+    BOOST_CHECK(!IsValidatedTransaction(txid, SCRIPT_VERIFY_P2SH, false));
+    BOOST_CHECK(!IsValidatedTransaction(GetRandHash(), flags, false));
+
+    BOOST_CHECK(IsValidatedTransaction(txid, flags, true));
+    BOOST_CHECK(!IsValidatedTransaction(txid, flags, false));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -16,28 +16,63 @@
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
 #include "policy/policy.h"
+#include "hash.h"
+#include "random.h"
 
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <limits>
 
 std::map<uint256, uint64_t> mapThinBlockTimer;
 
 std::vector<CNode*> xpeditedBlk; // Who requested expedited blocks from us
 std::vector<CNode*> xpeditedBlkUp; // Who we requested expedited blocks from
 std::vector<CNode*> xpeditedTxn;
+CCriticalSection cs_xpedited; // protects xpeditedBlk and xpeditedTxn
 
-CXThinBlock::CXThinBlock(const CBlock& block, CBloomFilter* filter)
-    : collision(false)
+CXThinShortIds::CXThinShortIds()
+    : m_k0(0), m_k1(0), m_mask(0), m_bytes(0)
+{
+}
+
+CXThinShortIds::CXThinShortIds(const CBlockHeader &header, uint64_t nonce, int bytes)
+    : m_bytes(bytes)
+{
+    assert(bytes == 6 || bytes == 8);
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << header << nonce;
+    const uint256 keys = ss.GetHash();
+    m_k0 = ReadLE64(keys.begin());
+    m_k1 = ReadLE64(keys.begin() + 8);
+    m_mask = bytes == 8 ? std::numeric_limits<uint64_t>::max() : (uint64_t(1) << (8 * bytes)) - 1;
+}
+
+uint64_t CXThinShortIds::operator()(const uint256 &txid) const
+{
+    if (m_bytes == 0)
+        return txid.GetCheapHash();
+    return SipHashUint256(m_k0, m_k1, txid) & m_mask;
+}
+
+CXThinBlock::CXThinBlock(const CBlock& block, CBloomFilter* filter, int shortIdBytes)
+    : collision(false),
+    shortIdNonce(0),
+    shortIdBytes(shortIdBytes)
 {
     header = block.GetBlockHeader();
+    if (shortIdBytes)
+        shortIdNonce = GetRand(std::numeric_limits<uint64_t>::max());
+    const CXThinShortIds shortIds = this->shortIds();
 
     unsigned int nTx = block.vtx.size();
     vTxHashes.reserve(nTx);
     std::set<uint64_t> setPartialTxHash;
     for (unsigned int i = 0; i < nTx; i++) {
         const uint256 hash256 = block.vtx[i].GetHash();
-        const uint64_t cheapHash = hash256.GetCheapHash();
+        const uint64_t cheapHash = shortIds(hash256);
         vTxHashes.push_back(cheapHash);
 
         if (collision || setPartialTxHash.count(cheapHash))
@@ -54,38 +89,31 @@ CXThinBlock::CXThinBlock(const CBlock& block, CBloomFilter* filter)
 }
 
 CXThinBlock::CXThinBlock()
-    : collision(false)
+    : collision(false),
+    shortIdNonce(0),
+    shortIdBytes(0)
+{
+}
+
+CXThinShortIds CXThinBlock::shortIds() const
 {
+    if (shortIdBytes == 0)
+        return CXThinShortIds();
+    return CXThinShortIds(header, shortIdNonce, shortIdBytes);
 }
 
 bool CXThinBlock::process(CNode* pfrom)
 {
     pfrom->thinBlock = CBlock(header);
     pfrom->xThinBlockHashes = vTxHashes;
-
-    // Create the mapMissingTx from all the supplied tx's in the xthinblock
-    std::map<uint64_t, CTransaction> mapMissingTx;
-    BOOST_FOREACH(CTransaction tx, vMissingTx) {
-        mapMissingTx[tx.GetHash().GetCheapHash()] = tx;
-    }
-
-    std::map<uint64_t, uint256> orphanLookup;
-    {
-        auto orphans = CTxOrphanCache::instance()->mapOrphanTransactions();
-        BOOST_FOREACH (auto iter, orphans) {
-            orphanLookup.insert(std::make_pair(iter.first.GetCheapHash(), iter.first));
-        }
-    }
-
-    std::map<uint64_t, uint256> mempoolLookup;
-    {
-        std::vector<uint256> memPoolHashes;
-        mempool.queryHashes(memPoolHashes);
-
-        for (size_t i = 0; i < memPoolHashes.size(); ++i) {
-            const uint256 &hash = memPoolHashes.at(i);
-            mempoolLookup.insert(std::make_pair(hash.GetCheapHash(), hash));
-        }
+    pfrom->xThinBlockShortIdNonce = shortIdNonce;
+    pfrom->xThinBlockShortIdBytes = shortIdBytes;
+    const CXThinShortIds shortIds = this->shortIds();
+
+    // Index the supplied tx's in the xthinblock, they are copied only once, into the block.
+    std::map<uint64_t, const CTransaction*> mapMissingTx;
+    BOOST_FOREACH(const CTransaction &tx, vMissingTx) {
+        mapMissingTx[shortIds(tx.GetHash())] = &tx;
     }
 
     std::vector<uint256> orphansUsed;
@@ -93,45 +121,90 @@ bool CXThinBlock::process(CNode* pfrom)
     int collisionCount = 0;
     std::uint32_t blockSize = ::GetSerializeSize(pfrom->thinBlock, SER_NETWORK, PROTOCOL_VERSION);
     const std::uint32_t blockSizeAcceptLimit = Policy::blockSizeAcceptLimit();
+    const std::uint32_t nullTxSize = ::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION);
     {
         LOCK2(cs_main, mempool.cs);
         const bool isChainTip = (header.hashPrevBlock == chainActive.Tip()->GetBlockHash()) ? true : false;
+
+        // Salted short ids differ per block, so they can't be kept in an index. Instead every mempool
+        // and orphan transaction is hashed once with this block's keys.
+        boost::unordered_map<uint64_t, CTxMemPool::txiter> saltedMempool;
+        std::map<uint64_t, uint256> saltedOrphans;
+        std::set<uint64_t> ambiguous;
+        if (shortIds.isSalted()) {
+            const boost::unordered_set<uint64_t> wanted(vTxHashes.begin(), vTxHashes.end());
+            for (auto iter = mempool.mapTx.begin(); iter != mempool.mapTx.end(); ++iter) {
+                const uint64_t shortId = shortIds(iter->GetTx().GetHash());
+                if (wanted.count(shortId) && !saltedMempool.insert(std::make_pair(shortId, iter)).second)
+                    ambiguous.insert(shortId);
+            }
+            BOOST_FOREACH (const uint256 &txid, CTxOrphanCache::instance()->fetchTransactionIds()) {
+                const uint64_t shortId = shortIds(txid);
+                if (wanted.count(shortId))
+                    saltedOrphans.insert(std::make_pair(shortId, txid));
+            }
+        }
+
+        pfrom->thinBlock.vtx.reserve(std::min<size_t>(vTxHashes.size(), blockSizeAcceptLimit / nullTxSize));
         for (size_t i = 0; i < vTxHashes.size(); ++i) {
             const uint64_t cheapHash = vTxHashes.at(i);
-            // Now we find the full transaction.
-            CTransaction tx;
+            // Now we find the full transaction, without copying it until we know it fits in the block.
+            const CTransaction *tx = nullptr;
+            std::uint32_t txSize = nullTxSize;
 
             auto foundInMissing = mapMissingTx.find(cheapHash);
             if (foundInMissing != mapMissingTx.end()) {
                 tx = foundInMissing->second;
+                txSize = ::GetSerializeSize(*tx, SER_NETWORK, PROTOCOL_VERSION);
             }
 
-            auto foundInMempool = mempoolLookup.find(cheapHash);
-            if (foundInMempool != mempoolLookup.end()) {
-                if (tx.IsNull()) {
+            bool mempoolCollision = false;
+            CTxMemPool::txiter foundInMempool = mempool.mapTx.end();
+            if (!shortIds.isSalted()) {
+                foundInMempool = mempool.findByCheapHash(cheapHash, mempoolCollision);
+            } else if (ambiguous.count(cheapHash)) {
+                // we can't tell which one the block has, it gets re-requested by position below.
+                mempoolCollision = true;
+            } else {
+                auto iter = saltedMempool.find(cheapHash);
+                if (iter != saltedMempool.end())
+                    foundInMempool = iter->second;
+            }
+            if (mempoolCollision)
+                ++collisionCount;
+            if (foundInMempool != mempool.mapTx.end()) {
+                if (tx == nullptr) {
+                    tx = &foundInMempool->GetTx();
+                    txSize = foundInMempool->GetTxSize();
                     if (isChainTip) // only skip validation if we are constructing the new chaintip
-                        setPreVerifiedTxHash.insert(foundInMempool->second);
-
-                    /*bool found =*/ mempool.lookup(foundInMempool->second, tx);
+                        setPreVerifiedTxHash.insert(tx->GetHash());
                 } else {
                     ++collisionCount;
                 }
             }
 
-            auto foundInOrphan = orphanLookup.find(cheapHash);
-            if (foundInOrphan != orphanLookup.end()) {
-                if (tx.IsNull()) {
-                    bool found = CTxOrphanCache::value(foundInOrphan->second, tx);
-                    if (found) // a race condition may have caused it to be removed from the orphans cache
-                        orphansUsed.push_back(foundInOrphan->second);
+            // Always probe the orphans, a short id that also matches one of them is a collision.
+            CTransaction orphan;
+            bool foundInOrphans = false;
+            if (!shortIds.isSalted()) {
+                foundInOrphans = CTxOrphanCache::valueByCheapHash(cheapHash, orphan);
+            } else if (!mempoolCollision) {
+                auto iter = saltedOrphans.find(cheapHash);
+                foundInOrphans = iter != saltedOrphans.end() && CTxOrphanCache::value(iter->second, orphan);
+            }
+            if (foundInOrphans) {
+                if (tx == nullptr) {
+                    tx = &orphan;
+                    txSize = ::GetSerializeSize(orphan, SER_NETWORK, PROTOCOL_VERSION);
+                    orphansUsed.push_back(orphan.GetHash());
                 } else {
                     ++collisionCount;
                 }
             }
-            blockSize += tx.GetSerializeSize(0, 0);
+            blockSize += txSize;
             if (blockSize <= blockSizeAcceptLimit)
-                pfrom->thinBlock.vtx.push_back(tx);
-            if (tx.IsNull())
+                pfrom->thinBlock.vtx.push_back(tx ? *tx : CTransaction());
+            if (tx == nullptr)
                 missingCount++;
         }
     }
@@ -161,13 +234,20 @@ bool CXThinBlock::process(CNode* pfrom)
             // like the orphans and the mempool etc.
             // With all these options we can then try different combinations and see which one gives us a proper merkle root.
 
-            // We'll wait for an INV to get this block, rejecting it for now.
             pfrom->thinBlockWaitingForTxns = -1;
+            if (shortIds.isSalted()) {
+                // One of our transactions shares a salted short id with one in the block that we don't have.
+                // The salt makes this rare and not repeatable, so just fetch the full block.
+                LogPrint("thin", "xthinblock2 short id collision, requesting full block %s peer=%d\n", header.GetHash().ToString(), pfrom->id);
+                std::vector<CInv> vGetData(1, CInv(MSG_BLOCK, header.GetHash()));
+                pfrom->PushMessage(NetMsgType::GETDATA, vGetData);
+            }
+            // Otherwise we'll wait for an INV to get this block, rejecting it for now.
             return false;
         }
     }
 
-    LogPrint("thin", "thinblock waiting for: %d, txs: %d full: %d\n", pfrom->thinBlockWaitingForTxns, pfrom->thinBlock.vtx.size(), mapMissingTx.size());
+    LogPrint("thin", "thinblock waiting for: %d, txs: %d full: %d collisions: %d\n", pfrom->thinBlockWaitingForTxns, pfrom->thinBlock.vtx.size(), mapMissingTx.size(), collisionCount);
     if (missingCount == 0) {
         // We have all the transactions now that are in this block: try to reassemble and process.
         pfrom->thinBlockWaitingForTxns = -1;
@@ -177,6 +257,16 @@ bool CXThinBlock::process(CNode* pfrom)
     }
     // This marks the end of the transactions we've received. If we get this and we have NOT been able to
     // finish reassembling the block, we need to re-request the transactions we're missing:
+    if (shortIds.isSalted()) {
+        CXRequestThinBlockTx2 request(header.GetHash());
+        for (size_t i = 0; i < pfrom->thinBlock.vtx.size(); i++) {
+            if (pfrom->thinBlock.vtx[i].IsNull())
+                request.indexes.push_back(i);
+        }
+        pfrom->PushMessage(NetMsgType::GET_XBLOCKTX2, request);
+        LogPrint("thin", "Missing %d transactions for xthinblock2, re-requesting\n", pfrom->thinBlockWaitingForTxns);
+        return false;
+    }
     std::set<uint64_t> setHashesToRequest;
     for (size_t i = 0; i < pfrom->thinBlock.vtx.size(); i++) {
         if (pfrom->thinBlock.vtx[i].IsNull())
@@ -292,6 +382,15 @@ void HandleBlockMessage(CNode *pfrom, const std::string &strCommand, const CBloc
     // conditions in AcceptBlock().
     bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
     const CChainParams& chainparams = Params();
+    if (strCommand == NetMsgType::XPEDITEDBLK) {
+        // Only a block with valid proof of work is remembered, so junk can't grow the list.
+        // CheckBlock marks the block as checked, ProcessNewBlock won't repeat it.
+        CValidationState checkState;
+        if (CheckBlock(block, checkState))
+            MarkBlockAsRelayedUnvalidated(inv.hash, pfrom->GetId());
+    } else {
+        RelayBlockBeforeValidation(block, pfrom);
+    }
     ProcessNewBlock(state, chainparams, pfrom, &block, forceProcessing, NULL);
     int nDoS;
     if (state.IsInvalid(nDoS)) {
@@ -375,6 +474,7 @@ void CheckAndRequestExpeditedBlocks(CNode* pfrom)
 
 void SendExpeditedBlock(CXThinBlock& thinBlock, unsigned char hops, const CNode* skip)
 {
+    LOCK(cs_xpedited);
     std::vector<CNode*>::iterator end = xpeditedBlk.end();
     for (std::vector<CNode*>::iterator it = xpeditedBlk.begin(); it != end; it++) {
         CNode* node = *it;
@@ -398,12 +498,51 @@ void SendExpeditedBlock(const CBlock& block,const CNode* skip)
         SendExpeditedBlock(thinBlock,0, skip);
     }
 }
+void RelayBlockBeforeValidation(const CBlock& block, const CNode* skip)
+{
+    if (!GetBoolArg("-parallelrelay", DEFAULT_PARALLEL_RELAY) || IsInitialBlockDownload())
+        return;
+
+    // The context free checks, including proof of work and the merkle root. This marks the block
+    // as checked so ProcessNewBlock doesn't repeat them.
+    CValidationState state;
+    if (!CheckBlock(block, state))
+        return;
+    {
+        LOCK(cs_main);
+        // Only a block that would become our new tip is worth hurrying, others wait for validation.
+        CBlockIndex *tip = chainActive.Tip();
+        if (tip == nullptr || block.hashPrevBlock != tip->GetBlockHash())
+            return;
+        if (!ContextualCheckBlockHeader(block, state, tip) || !ContextualCheckBlock(block, state, tip))
+            return;
+    }
+    LogPrint("thin", "Relaying block %s ahead of validation\n", block.GetHash().ToString());
+    SendExpeditedBlock(block, skip);
+
+    // Thin block peers get the announcement now. Their request for the block is answered once we
+    // are done connecting it, saving them the wait for the announcement, and not at all if it is invalid.
+    std::vector<CNode*> expedited;
+    {
+        LOCK(cs_xpedited);
+        expedited = xpeditedBlk;
+    }
+    const CInv inv(MSG_BLOCK, block.GetHash());
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes) {
+        if (pnode == skip || pnode->fDisconnect || !pnode->fSuccessfullyConnected || !pnode->ThinBlockCapable())
+            continue;
+        if (std::find(expedited.begin(), expedited.end(), pnode) == expedited.end())
+            pnode->PushInventory(inv);
+    }
+}
+
 void HandleExpeditedRequest(CDataStream& vRecv,CNode* pfrom)
 {
-    // TODO locks
     uint64_t options;
     vRecv >> options;
     bool stop = ((options & EXPEDITED_STOP) != 0);  // Are we starting or stopping expedited service?
+    LOCK(cs_xpedited);
     if (options & EXPEDITED_BLOCKS)
     {
         if (stop)  // If stopping, find the array element and clear it.
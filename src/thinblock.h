@@ -9,6 +9,7 @@
 
 #include "serialize.h"
 #include "uint256.h"
+#include "crypto/common.h"
 #include "primitives/block.h"
 #include "bloom.h"
 
@@ -20,6 +21,27 @@
 class CBlock;
 class CNode;
 
+// The short transaction ids of a thin block. The legacy xthinblock message uses the first 8 bytes
+// of the txid, which anyone can grind to collide. The xthinblock2 message uses a SipHash of the txid
+// keyed by the block header and a random nonce, truncated to 6 or 8 bytes.
+class CXThinShortIds
+{
+public:
+    /// the legacy, unsalted, short ids
+    CXThinShortIds();
+    CXThinShortIds(const CBlockHeader &header, uint64_t nonce, int bytes);
+
+    uint64_t operator()(const uint256 &txid) const;
+
+    inline bool isSalted() const {
+        return m_bytes != 0;
+    }
+
+private:
+    uint64_t m_k0, m_k1;
+    uint64_t m_mask;
+    int m_bytes;
+};
 
 class CXThinBlock
 {
@@ -28,9 +50,11 @@ public:
     std::vector<uint64_t> vTxHashes; // List of all transactions id's in the block
     std::vector<CTransaction> vMissingTx; // vector of transactions that did not match the bloom filter
     bool collision;
+    uint64_t shortIdNonce; // xthinblock2 only
+    unsigned char shortIdBytes; // the width of the salted short ids, zero for the legacy xthinblock
 
 public:
-    CXThinBlock(const CBlock& block, CBloomFilter* filter = 0); // Use the filter to determine which txns the client has
+    CXThinBlock(const CBlock& block, CBloomFilter* filter = 0, int shortIdBytes = 0); // Use the filter to determine which txns the client has
     CXThinBlock();
 
     ADD_SERIALIZE_METHODS
@@ -42,6 +66,62 @@ public:
         READWRITE(vMissingTx);
     }
 
+    /// Serializes the thin block as the xthinblock2 message, with the fixed width salted short ids.
+    class Salted
+    {
+    public:
+        explicit Salted(CXThinBlock &block) : m_block(block) {}
+
+        unsigned int GetSerializeSize(int nType, int nVersion) const {
+            return ::GetSerializeSize(m_block.header, nType, nVersion)
+                + sizeof(m_block.shortIdNonce) + sizeof(m_block.shortIdBytes)
+                + GetSizeOfCompactSize(m_block.vTxHashes.size())
+                + m_block.vTxHashes.size() * m_block.shortIdBytes
+                + ::GetSerializeSize(m_block.vMissingTx, nType, nVersion);
+        }
+
+        template<typename Stream>
+        void Serialize(Stream& s, int nType, int nVersion) const {
+            checkWidth();
+            ::Serialize(s, m_block.header, nType, nVersion);
+            ::Serialize(s, m_block.shortIdNonce, nType, nVersion);
+            ::Serialize(s, m_block.shortIdBytes, nType, nVersion);
+            WriteCompactSize(s, m_block.vTxHashes.size());
+            unsigned char buf[8];
+            for (uint64_t id : m_block.vTxHashes) {
+                WriteLE64(buf, id);
+                s.write(reinterpret_cast<const char*>(buf), m_block.shortIdBytes);
+            }
+            ::Serialize(s, m_block.vMissingTx, nType, nVersion);
+        }
+
+        template<typename Stream>
+        void Unserialize(Stream& s, int nType, int nVersion) {
+            ::Unserialize(s, m_block.header, nType, nVersion);
+            ::Unserialize(s, m_block.shortIdNonce, nType, nVersion);
+            ::Unserialize(s, m_block.shortIdBytes, nType, nVersion);
+            checkWidth();
+            const uint64_t count = ReadCompactSize(s);
+            m_block.vTxHashes.clear();
+            m_block.vTxHashes.reserve(std::min<uint64_t>(count, 100000));
+            unsigned char buf[8] = { 0 };
+            for (uint64_t i = 0; i < count; ++i) {
+                s.read(reinterpret_cast<char*>(buf), m_block.shortIdBytes);
+                m_block.vTxHashes.push_back(ReadLE64(buf));
+            }
+            ::Unserialize(s, m_block.vMissingTx, nType, nVersion);
+        }
+
+    private:
+        void checkWidth() const {
+            if (m_block.shortIdBytes != 6 && m_block.shortIdBytes != 8)
+                throw std::ios_base::failure("xthinblock2: unsupported short id width");
+        }
+
+        CXThinBlock &m_block;
+    };
+
+    CXThinShortIds shortIds() const;
     inline CInv GetInv() { return CInv(MSG_BLOCK, header.GetHash()); }
     bool process(CNode* pfrom);
 };
@@ -92,11 +172,38 @@ public:
     }
 };
 
+// Re-request transactions of an xthinblock2 by their position in the block.
+// Answered with a CXThinBlockTx.
+class CXRequestThinBlockTx2
+{
+public:
+    uint256 blockhash;
+    std::vector<uint32_t> indexes; // positions in the block of the requested transactions
+
+public:
+    CXRequestThinBlockTx2(const uint256 &blockHash) : blockhash(blockHash) {}
+    CXRequestThinBlockTx2() {}
+
+    ADD_SERIALIZE_METHODS
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(blockhash);
+        READWRITE(indexes);
+    }
+};
+
 bool HaveThinblockNodes();
 bool CheckThinblockTimer(const uint256 &hash);
 inline bool IsThinBlocksEnabled() {
     return GetBoolArg("-use-thinblocks", true);
 }
+static const bool DEFAULT_PARALLEL_RELAY = true;
+static const int DEFAULT_XTHIN_SHORTID_BYTES = 6;
+/// The width of the salted short ids we send in xthinblock2 messages, 6 or 8.
+inline int XThinShortIdBytes() {
+    return GetArg("-xthinshortidbytes", DEFAULT_XTHIN_SHORTID_BYTES) == 8 ? 8 : 6;
+}
 bool IsChainNearlySyncd();
 CBloomFilter createSeededBloomFilter(const std::vector<uint256>& vOrphanHashes);
 void LoadFilter(CNode *pfrom, CBloomFilter *filter);
@@ -109,6 +216,10 @@ void HandleBlockMessage(CNode *pfrom, const std::string &strCommand, const CBloc
 void CheckAndRequestExpeditedBlocks(CNode* pfrom);
 void SendExpeditedBlock(CXThinBlock& thinBlock, unsigned char hops, const CNode* skip = nullptr);
 void SendExpeditedBlock(const CBlock& block, const CNode* skip = nullptr);
+// Forward a block that extends our tip to the expedited peers, and announce it to the thin block peers,
+// as soon as its header, proof of work and merkle root are checked. So it propagates while we are still
+// connecting it. See -parallelrelay.
+void RelayBlockBeforeValidation(const CBlock& block, const CNode* skip = nullptr);
 void HandleExpeditedRequest(CDataStream& vRecv, CNode* pfrom);
 bool IsRecentlyExpeditedAndStore(const uint256& hash);
 // process incoming unsolicited block
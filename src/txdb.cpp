@@ -1,30 +1,172 @@
 // Copyright (c) 2009-2010 Satoshi Nakamoto
 // Copyright (c) 2009-2015 The Bitcoin Core developers
+// Copyright (c) 2017 Tom Zander <tomz@freedommail.ch>
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "txdb.h"
 
+#include "chainparams.h"
+#include "clientversion.h"
+#include "compressor.h"
 #include "hash.h"
+#include "streams.h"
 #include "sync.h"
 #include "main.h"
 #include "BlocksDB.h"
+#include "Logger.h"
+#include "ui_interface.h"
 
 #include <boost/thread.hpp>
 
-static const char DB_COINS = 'c';
+static const char DB_COIN = 'C';
+static const char DB_COINS = 'c'; // the old, one record per transaction, layout
+static const char DB_COIN_TX = 'T';
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_COMMITMENT = 'H';
+static const char DB_ADDING_TX_RECORDS = 'U';
+
+namespace {
+/// The database key of a single output.
+struct CoinKey {
+    char key;
+    uint256 txid;
+    uint32_t n;
+
+    CoinKey(const uint256 &txid = uint256(), uint32_t n = 0) : key(DB_COIN), txid(txid), n(n) {}
+
+    ADD_SERIALIZE_METHODS
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(txid);
+        READWRITE(VARINT(n));
+    }
+};
+
+/// The database value of a single output, it carries the data of its transaction that CCoins needs.
+struct CoinValue {
+    CTxOut out;
+    int nHeight;
+    int txVersion;
+    bool fCoinBase;
+
+    CoinValue() : nHeight(0), txVersion(0), fCoinBase(false) {}
+    CoinValue(const CCoins &coins, uint32_t n)
+        : out(coins.vout[n]), nHeight(coins.nHeight), txVersion(coins.nVersion), fCoinBase(coins.fCoinBase) {}
+
+    ADD_SERIALIZE_METHODS
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        uint32_t code = 0;
+        if (!ser_action.ForRead())
+            code = nHeight * 2 + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(code));
+        if (ser_action.ForRead()) {
+            nHeight = code / 2;
+            fCoinBase = code & 1;
+        }
+        READWRITE(VARINT(txVersion));
+        READWRITE(REF(CTxOutCompressor(out)));
+    }
+};
+
+/**
+ * The database key of the per transaction record, it exists as long as the transaction has
+ * unspent outputs and holds an upper bound of their indexes. Lookups start with a point read
+ * on it, which lets the bloom filters answer for transactions that are not there.
+ */
+inline std::pair<char, uint256> CoinTxKey(const uint256 &txid)
+{
+    return std::make_pair(DB_COIN_TX, txid);
+}
+
+void writeOutputs(CDBBatch &batch, const uint256 &txid, const CCoins &coins)
+{
+    for (uint32_t i = 0; i < coins.vout.size(); ++i) {
+        if (!coins.vout[i].IsNull())
+            batch.Write(CoinKey(txid, i), CoinValue(coins, i));
+    }
+    if (!coins.IsPruned())
+        batch.Write(CoinTxKey(txid), (uint32_t) coins.vout.size());
+}
+
+/*
+ * The snapshot file format:
+ *   header: "UTXO", uint32 version, genesis block hash, best block hash
+ *   per transaction, in the sort order of the database:
+ *       VARINT(number of outputs), txid, and per output VARINT(index) + CoinValue
+ *   VARINT(0), uint64 number of transactions, uint64 number of outputs
+ *   checksum: the double-sha256 of everything before it.
+ */
+const char SNAPSHOT_MAGIC[4] = { 'U', 'T', 'X', 'O' };
+const uint32_t SNAPSHOT_VERSION = 1;
+const int SNAPSHOT_BATCH_SIZE = 200000; // outputs
+
+/// Writes to a file while hashing everything that is written.
+class SnapshotWriter
+{
+public:
+    SnapshotWriter(CAutoFile &file) : file(file), hasher(SER_DISK, CLIENT_VERSION) {}
+
+    SnapshotWriter &write(const char *pch, size_t size) {
+        file.write(pch, size);
+        hasher.write(pch, size);
+        return *this;
+    }
+
+    template<typename T>
+    SnapshotWriter& operator<<(const T& obj) {
+        ::Serialize(*this, obj, SER_DISK, CLIENT_VERSION);
+        return *this;
+    }
+
+    uint256 GetHash() {
+        return hasher.GetHash();
+    }
+
+private:
+    CAutoFile &file;
+    CHashWriter hasher;
+};
+}
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, false)
 {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(std::make_pair(DB_COINS, txid), coins);
+    // the point read is answered by the bloom filters for most transactions that are not there.
+    uint32_t outputs;
+    if (!db.Read(CoinTxKey(txid), outputs))
+        return false;
+    boost::scoped_ptr<CDBIterator> cursor(db.NewLookupIterator());
+    cursor->Seek(CoinKey(txid));
+    CCoins result;
+    bool found = false;
+    CoinKey key;
+    while (cursor->Valid() && cursor->GetKey(key) && key.key == DB_COIN && key.txid == txid && key.n < outputs) {
+        CoinValue value;
+        if (!cursor->GetValue(value))
+            return error("CCoinsViewDB::GetCoins() : unable to read value");
+        if (result.vout.size() <= key.n)
+            result.vout.resize(key.n + 1);
+        result.vout[key.n] = value.out;
+        result.nHeight = value.nHeight;
+        result.nVersion = value.txVersion;
+        result.fCoinBase = value.fCoinBase;
+        found = true;
+        cursor->Next();
+    }
+    if (found)
+        coins.swap(result);
+    return found;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(std::make_pair(DB_COINS, txid));
+    return db.Exists(CoinTxKey(txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -34,71 +176,382 @@ uint256 CCoinsViewDB::GetBestBlock() const {
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::GetCommitment(CUtxoCommitment &commitment) const {
+    if (db.Read(DB_COMMITMENT, commitment))
+        return true;
+    if (GetBestBlock().IsNull()) { // a new database
+        commitment = CUtxoCommitment();
+        return true;
+    }
+    return false;
+}
+
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUtxoCommitment *commitment) {
     CDBBatch batch(&db.GetObfuscateKey());
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
-        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(std::make_pair(DB_COINS, it->first));
-            else
-                batch.Write(std::make_pair(DB_COINS, it->first), it->second.coins);
+    size_t outputsChanged = 0;
+    // mapCoins is only read, a CCoinsViewBackgroundWriter serves lookups from it while we write.
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
+        const CCoinsCacheEntry &entry = it->second;
+        if (entry.flags & CCoinsCacheEntry::DIRTY) {
+            // only touch the outputs that changed, a partly spent transaction is not rewritten.
+            const uint32_t size = std::max(entry.coins.vout.size(), entry.parentUnspent.size());
+            bool outputChanged = false;
+            for (uint32_t i = 0; i < size; ++i) {
+                if (!entry.IsOutputDirty(i))
+                    continue;
+                if (entry.coins.IsAvailable(i))
+                    batch.Write(CoinKey(it->first, i), CoinValue(entry.coins, i));
+                else
+                    batch.Erase(CoinKey(it->first, i));
+                outputChanged = true;
+                outputsChanged++;
+            }
+            // the cache holds all unspent outputs of the transaction, its size bounds their indexes.
+            if (outputChanged && entry.coins.IsPruned())
+                batch.Erase(CoinTxKey(it->first));
+            else if (outputChanged)
+                batch.Write(CoinTxKey(it->first), (uint32_t) entry.coins.vout.size());
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
+    // without a commitment InitCommitment() calculates it on the next start.
+    if (commitment)
+        batch.Write(DB_COMMITMENT, *commitment);
+    else
+        batch.Erase(DB_COMMITMENT);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed outputs of %u changed transactions (out of %u) to coin database...\n",
+             (unsigned int)outputsChanged, (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
+    CUtxoCommitment commitment;
+    if (GetCommitment(commitment)) {
+        stats.hashBlock = GetBestBlock();
+    } else if (!calculateCommitment(commitment, stats.hashBlock)) {
+        return false;
+    }
+    commitment.GetStats(stats);
+    {
+        LOCK(cs_main);
+        auto iter = Blocks::indexMap.find(stats.hashBlock);
+        if (iter != Blocks::indexMap.end())
+            stats.nHeight = iter->second->nHeight;
+    }
+    return true;
+}
+
+bool CCoinsViewDB::calculateCommitment(CUtxoCommitment &commitment, uint256 &bestBlock) const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
+    // the iterator sees a consistent snapshot, read the best block from it too.
+    pcursor->Seek(DB_BEST_BLOCK);
+    char key = 0;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key != DB_BEST_BLOCK || !pcursor->GetValue(bestBlock))
+        bestBlock.SetNull();
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
+    pcursor->Seek(DB_COIN);
+    uint256 prevTxid;
+    bool first = true;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
-            } else {
-                return error("CCoinsViewDB::GetStats() : unable to read value");
-            }
-        } else {
+        CoinKey coinKey;
+        CoinValue value;
+        if (!pcursor->GetKey(coinKey) || coinKey.key != DB_COIN)
             break;
+        if (!pcursor->GetValue(value))
+            return error("CCoinsViewDB::calculateCommitment() : unable to read value");
+        // outputs of one transaction are stored consecutively.
+        if (first || coinKey.txid != prevTxid) {
+            commitment.AddTransaction();
+            prevTxid = coinKey.txid;
+            first = false;
         }
+        commitment.AddOutput(coinKey.txid, coinKey.n, value.out, value.nHeight, value.fCoinBase, value.txVersion);
         pcursor->Next();
     }
-    {
-        LOCK(cs_main);
-        stats.nHeight = Blocks::indexMap.find(stats.hashBlock)->second->nHeight;
+    return true;
+}
+
+bool CCoinsViewDB::InitCommitment() {
+    if (db.Exists(DB_COMMITMENT) || GetBestBlock().IsNull())
+        return true;
+
+    logCritical(Log::DB) << "Calculating the UTXO set commitment. This is done only once.";
+    uiInterface.InitMessage(_("Calculating UTXO set commitment..."));
+    CUtxoCommitment commitment;
+    uint256 bestBlock;
+    if (!calculateCommitment(commitment, bestBlock))
+        return false;
+    CDBBatch batch(&db.GetObfuscateKey());
+    batch.Write(DB_COMMITMENT, commitment);
+    return db.WriteBatch(batch, true);
+}
+
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::make_pair(DB_COINS, uint256()));
+    std::pair<char, uint256> key;
+    if (pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_COINS) {
+        logCritical(Log::DB) << "Upgrading the UTXO database to one entry per output. This is done only once.";
+        uiInterface.InitMessage(_("Upgrading UTXO database"));
+        CDBBatch batch(&db.GetObfuscateKey());
+        size_t count = 0;
+        size_t batchCount = 0;
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            if (!pcursor->GetKey(key) || key.first != DB_COINS)
+                break;
+            CCoins coins;
+            if (!pcursor->GetValue(coins))
+                return error("CCoinsViewDB::Upgrade() : unable to read value");
+            // every batch replaces whole records, an interrupted upgrade just continues on the next start.
+            writeOutputs(batch, key.second, coins);
+            batch.Erase(key);
+            ++count;
+            if (++batchCount >= 100000) {
+                if (!db.WriteBatch(batch))
+                    return false;
+                batch.Clear();
+                batchCount = 0;
+                logInfo(Log::DB) << "Upgrading UTXO database:" << count << "transactions";
+            }
+            pcursor->Next();
+        }
+        if (!db.WriteBatch(batch))
+            return false;
+        logCritical(Log::DB) << "Finished upgrading the UTXO database," << count << "transactions converted";
+    }
+
+    // a database with one entry per output that was written before the per transaction records existed,
+    // an interrupted run leaves DB_ADDING_TX_RECORDS behind and starts over on the next start.
+    pcursor.reset(db.NewIterator());
+    if (!db.Exists(DB_ADDING_TX_RECORDS)) {
+        pcursor->Seek(DB_COIN_TX);
+        if (pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_COIN_TX)
+            return true;
+    }
+    pcursor->Seek(DB_COIN);
+    CoinKey coinKey;
+    if (!pcursor->Valid() || !pcursor->GetKey(coinKey) || coinKey.key != DB_COIN)
+        return true;
+
+    logCritical(Log::DB) << "Adding the transaction records to the UTXO database. This is done only once.";
+    uiInterface.InitMessage(_("Upgrading UTXO database"));
+    CDBBatch batch(&db.GetObfuscateKey());
+    batch.Write(DB_ADDING_TX_RECORDS, true);
+    size_t count = 0;
+    size_t batchCount = 0;
+    uint256 txid;
+    uint32_t outputs = 0;
+    while (true) {
+        boost::this_thread::interruption_point();
+        const bool valid = pcursor->Valid() && pcursor->GetKey(coinKey) && coinKey.key == DB_COIN;
+        if (outputs > 0 && (!valid || coinKey.txid != txid)) {
+            // outputs of one transaction are stored consecutively, the last one has the highest index.
+            batch.Write(CoinTxKey(txid), outputs);
+            ++count;
+            if (++batchCount >= 100000) {
+                if (!db.WriteBatch(batch))
+                    return false;
+                batch.Clear();
+                batchCount = 0;
+                logInfo(Log::DB) << "Upgrading UTXO database:" << count << "transactions";
+            }
+        }
+        if (!valid)
+            break;
+        txid = coinKey.txid;
+        outputs = coinKey.n + 1;
+        pcursor->Next();
+    }
+    batch.Erase(DB_ADDING_TX_RECORDS);
+    if (!db.WriteBatch(batch, true))
+        return false;
+    logCritical(Log::DB) << "Finished upgrading the UTXO database," << count << "transactions";
+    return true;
+}
+
+bool CCoinsViewDB::WriteSnapshot(CAutoFile &file, CCoinsStats &stats) const
+{
+    // the iterator reads from an implicit snapshot of the database, taken at its creation.
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(DB_BEST_BLOCK);
+    char key = 0;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key != DB_BEST_BLOCK || !pcursor->GetValue(stats.hashBlock))
+        return error("CCoinsViewDB::WriteSnapshot() : no best block in the database");
+
+    try {
+        SnapshotWriter out(file);
+        out << FLATDATA(SNAPSHOT_MAGIC) << SNAPSHOT_VERSION << Params().GetConsensus().hashGenesisBlock << stats.hashBlock;
+
+        CAmount nTotalAmount = 0;
+        std::vector<std::pair<uint32_t, CoinValue> > outputs;
+        uint256 txid;
+        pcursor->Seek(DB_COIN);
+        while (true) {
+            boost::this_thread::interruption_point();
+            CoinKey coinKey;
+            const bool valid = pcursor->Valid() && pcursor->GetKey(coinKey) && coinKey.key == DB_COIN;
+            if (!outputs.empty() && (!valid || coinKey.txid != txid)) {
+                // outputs of one transaction are stored consecutively.
+                out << VARINT(outputs.size()) << txid;
+                for (auto &output : outputs) {
+                    out << VARINT(output.first) << output.second;
+                }
+                stats.nTransactions++;
+                outputs.clear();
+            }
+            if (!valid)
+                break;
+            CoinValue value;
+            if (!pcursor->GetValue(value))
+                return error("CCoinsViewDB::WriteSnapshot() : unable to read value");
+            txid = coinKey.txid;
+            nTotalAmount += value.out.nValue;
+            stats.nTransactionOutputs++;
+            stats.nSerializedSize += pcursor->GetValueSize();
+            outputs.push_back(std::make_pair(coinKey.n, value));
+            pcursor->Next();
+        }
+        out << VARINT(0) << (uint64_t) stats.nTransactions << (uint64_t) stats.nTransactionOutputs;
+        stats.hashSerialized = out.GetHash();
+        stats.nTotalAmount = nTotalAmount;
+        file << stats.hashSerialized;
+    } catch (const std::exception &e) {
+        return error("CCoinsViewDB::WriteSnapshot() : %s", e.what());
+    }
+    return true;
+}
+
+bool CCoinsViewDB::LoadSnapshot(CAutoFile &file)
+{
+    if (!GetBestBlock().IsNull())
+        return error("CCoinsViewDB::LoadSnapshot() : the UTXO database is not empty");
+
+    try {
+        // verify the checksum first, we don't want to write half a snapshot.
+        FILE *f = file.Get();
+        if (!f || fseek(f, 0, SEEK_END) != 0)
+            return error("CCoinsViewDB::LoadSnapshot() : unable to read file");
+        const long fileSize = ftell(f);
+        if (fileSize < 32)
+            return error("CCoinsViewDB::LoadSnapshot() : file too short");
+        rewind(f);
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+        std::vector<char> buf(1 << 20);
+        for (long left = fileSize - 32; left > 0;) {
+            const size_t size = std::min<long>(left, buf.size());
+            file.read(&buf[0], size);
+            hasher.write(&buf[0], size);
+            left -= size;
+        }
+        uint256 checksum;
+        file >> checksum;
+        if (checksum != hasher.GetHash())
+            return error("CCoinsViewDB::LoadSnapshot() : checksum mismatch, the file is damaged");
+        rewind(f);
+
+        char magic[4];
+        uint32_t version;
+        uint256 genesis, bestBlock;
+        file >> FLATDATA(magic) >> version >> genesis >> bestBlock;
+        if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 || version != SNAPSHOT_VERSION)
+            return error("CCoinsViewDB::LoadSnapshot() : not a UTXO snapshot or unknown version");
+        if (genesis != Params().GetConsensus().hashGenesisBlock)
+            return error("CCoinsViewDB::LoadSnapshot() : the snapshot is for a different network");
+
+        // remove what an earlier, interrupted, load left behind.
+        CDBBatch batch(&db.GetObfuscateKey());
+        int batchCount = 0;
+        boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+        for (pcursor->Seek(DB_COIN); pcursor->Valid(); pcursor->Next()) {
+            CoinKey coinKey;
+            if (!pcursor->GetKey(coinKey) || coinKey.key != DB_COIN)
+                break;
+            batch.Erase(coinKey);
+            if (++batchCount >= SNAPSHOT_BATCH_SIZE) {
+                if (!db.WriteBatch(batch))
+                    return false;
+                batch.Clear();
+                batchCount = 0;
+            }
+        }
+        for (pcursor->Seek(DB_COIN_TX); pcursor->Valid(); pcursor->Next()) {
+            std::pair<char, uint256> txKey;
+            if (!pcursor->GetKey(txKey) || txKey.first != DB_COIN_TX)
+                break;
+            batch.Erase(txKey);
+            if (++batchCount >= SNAPSHOT_BATCH_SIZE) {
+                if (!db.WriteBatch(batch))
+                    return false;
+                batch.Clear();
+                batchCount = 0;
+            }
+        }
+        pcursor.reset();
+
+        logCritical(Log::DB) << "Loading UTXO snapshot of block" << bestBlock;
+        uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+        uint64_t txCount = 0, outputCount = 0;
+        CUtxoCommitment commitment;
+        uint256 prevTxid;
+        while (true) {
+            boost::this_thread::interruption_point();
+            uint64_t outputs;
+            file >> VARINT(outputs);
+            if (outputs == 0)
+                break;
+            uint256 txid;
+            file >> txid;
+            // the file is in database order, which keeps the leveldb writes sequential.
+            if (txCount > 0 && !(prevTxid < txid))
+                return error("CCoinsViewDB::LoadSnapshot() : transactions are not sorted");
+            prevTxid = txid;
+            int64_t prevIndex = -1;
+            for (uint64_t i = 0; i < outputs; ++i) {
+                uint32_t n;
+                CoinValue value;
+                file >> VARINT(n) >> value;
+                if (n <= prevIndex)
+                    return error("CCoinsViewDB::LoadSnapshot() : outputs are not sorted");
+                prevIndex = n;
+                batch.Write(CoinKey(txid, n), value);
+                commitment.AddOutput(txid, n, value.out, value.nHeight, value.fCoinBase, value.txVersion);
+                ++batchCount;
+            }
+            batch.Write(CoinTxKey(txid), (uint32_t) (prevIndex + 1));
+            ++txCount;
+            commitment.AddTransaction();
+            outputCount += outputs;
+            if (batchCount >= SNAPSHOT_BATCH_SIZE) {
+                if (!db.WriteBatch(batch))
+                    return false;
+                batch.Clear();
+                batchCount = 0;
+                logInfo(Log::DB) << "Loading UTXO snapshot:" << txCount << "transactions";
+            }
+        }
+        uint64_t expectedTxCount, expectedOutputCount;
+        file >> expectedTxCount >> expectedOutputCount;
+        if (txCount != expectedTxCount || outputCount != expectedOutputCount)
+            return error("CCoinsViewDB::LoadSnapshot() : the snapshot is incomplete");
+
+        batch.Write(DB_BEST_BLOCK, bestBlock);
+        batch.Write(DB_COMMITMENT, commitment);
+        if (!db.WriteBatch(batch, true))
+            return false;
+        logCritical(Log::DB) << "Finished loading the UTXO snapshot," << txCount << "transactions and" << outputCount << "outputs";
+    } catch (const std::exception &e) {
+        return error("CCoinsViewDB::LoadSnapshot() : %s", e.what());
     }
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
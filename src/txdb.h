@@ -1,5 +1,6 @@
 // Copyright (c) 2009-2010 Satoshi Nakamoto
 // Copyright (c) 2009-2015 The Bitcoin Core developers
+// Copyright (c) 2017 Tom Zander <tomz@freedommail.ch>
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -9,7 +10,17 @@
 #include "coins.h"
 #include "dbwrapper.h"
 
-/** CCoinsView backed by the coin database (chainstate/) */
+class CAutoFile;
+
+/**
+ * CCoinsView backed by the coin database (chainstate/)
+ *
+ * The database has one entry per unspent output, keyed by txid and output-index.
+ * Spending an output removes just that entry, the rest of the outputs of the
+ * transaction are left alone. Next to those every transaction with unspent outputs
+ * has a small record, so a lookup is a point read that the bloom filters answer
+ * without touching the disk when the transaction is not in the set.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
@@ -20,8 +31,41 @@ public:
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUtxoCommitment *commitment);
     bool GetStats(CCoinsStats &stats) const;
+    bool GetCommitment(CUtxoCommitment &commitment) const;
+
+    /**
+     * Convert a database that still uses one entry per transaction to one entry per output,
+     * and add the per transaction records to a database that lacks them.
+     * This does nothing when there is nothing to convert. Returns false on database failures.
+     */
+    bool Upgrade();
+
+    /**
+     * Calculate and store the commitment to the UTXO set if the database doesn't have one yet,
+     * which walks over the whole set. Afterwards it is kept up to date with every write.
+     */
+    bool InitCommitment();
+
+    /**
+     * Write the best block and all unspent outputs to \a file in a checksummed snapshot format that
+     * LoadSnapshot() reads. The database is read from a consistent view, blocks may be written to it
+     * at the same time. Fills the counters and hashBlock of \a stats, hashSerialized is set to the
+     * checksum of the file.
+     */
+    bool WriteSnapshot(CAutoFile &file, CCoinsStats &stats) const;
+
+    /**
+     * Fill an empty database from a snapshot made by WriteSnapshot(). The entire file is checked
+     * against its checksum before anything is written. The best block is written last, an
+     * interrupted load leaves the database without a best block and a next load starts over.
+     */
+    bool LoadSnapshot(CAutoFile &file);
+
+protected:
+    /// Walk over the database, reading the best block from the same snapshot.
+    bool calculateCommitment(CUtxoCommitment &commitment, uint256 &bestBlock) const;
 };
 
 #endif // BITCOIN_TXDB_H
@@ -10,6 +10,8 @@
 #include "consensus/validation.h"
 #include "main.h"
 #include "policy/fees.h"
+#include "random.h"
+#include "script/interpreter.h"
 #include "streams.h"
 #include "timedata.h"
 #include "util.h"
@@ -17,6 +19,8 @@
 #include "utiltime.h"
 #include "version.h"
 
+#include <algorithm>
+
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _entryPriority, unsigned int _entryHeight,
                                  bool poolHasNoInputsOf, CAmount _inChainInputValue,
@@ -36,6 +40,7 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
     assert(inChainInputValue <= nValueIn);
 
     feeDelta = 0;
+    UpdateScores();
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -57,6 +62,7 @@ void CTxMemPoolEntry::UpdateFeeDelta(int64_t newFeeDelta)
 {
     nModFeesWithDescendants += newFeeDelta - feeDelta;
     feeDelta = newFeeDelta;
+    UpdateScores();
 }
 
 void CTxMemPoolEntry::UpdateLockPoints(const LockPoints& lp)
@@ -64,6 +70,12 @@ void CTxMemPoolEntry::UpdateLockPoints(const LockPoints& lp)
     lockPoints = lp;
 }
 
+void CTxMemPoolEntry::UpdateScores()
+{
+    modFeeRate = (double)GetModifiedFee() / nTxSize;
+    descendantScore = std::max(modFeeRate, (double)nModFeesWithDescendants / nSizeWithDescendants);
+}
+
 // Update the given tx for any in-mempool descendants.
 // Assumes that setMemPoolChildren is correct for the given tx and all
 // descendants.
@@ -254,53 +266,94 @@ void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors
     }
 }
 
-void CTxMemPool::UpdateChildrenForRemoval(txiter it)
+void CTxMemPool::UpdateForRemoveFromMempool(const std::vector<txiter> &entriesToRemove)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
-    BOOST_FOREACH(txiter updateIt, setMemPoolChildren) {
-        UpdateParent(updateIt, it, false);
+    // Most of the transactions of a block have no in-mempool parents or children
+    // left by the time they are removed, those need no work here.
+    std::vector<txiter> linked;
+    BOOST_FOREACH(txiter removeIt, entriesToRemove) {
+        txlinksMap::const_iterator links = mapLinks.find(removeIt);
+        assert(links != mapLinks.end());
+        if (!links->second.parents.empty() || !links->second.children.empty())
+            linked.push_back(removeIt);
     }
-}
+    if (linked.empty())
+        return;
 
-void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove)
-{
-    // For each entry, walk back all ancestors and decrement size associated with this
-    // transaction
-    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
-    BOOST_FOREACH(txiter removeIt, entriesToRemove) {
-        setEntries setAncestors;
-        const CTxMemPoolEntry &entry = *removeIt;
-        std::string dummy;
-        // Since this is a tx that is already in the mempool, we can call CMPA
-        // with fSearchForParents = false.  If the mempool is in a consistent
-        // state, then using true or false should both be correct, though false
-        // should be a bit faster.
-        // However, if we happen to be in the middle of processing a reorg, then
-        // the mempool can be in an inconsistent state.  In this case, the set
-        // of ancestors reachable via mapLinks will be the same as the set of 
-        // ancestors whose packages include this transaction, because when we
-        // add a new transaction to the mempool in addUnchecked(), we assume it
-        // has no children, and in the case of a reorg where that assumption is
-        // false, the in-mempool children aren't linked to the in-block tx's
-        // until UpdateTransactionsFromBlock() is called.
-        // So if we're being called during a reorg, ie before
-        // UpdateTransactionsFromBlock() has been called, then mapLinks[] will
-        // differ from the set of mempool parents we'd calculate by searching,
-        // and it's important that we use the mapLinks[] notion of ancestor
-        // transactions as the set of things to update for removal.
-        CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
-        // Note that UpdateAncestorsOf severs the child links that point to
-        // removeIt in the entries for the parents of removeIt.  This is
-        // fine since we don't need to use the mempool children of any entries
-        // to walk back over our ancestors (but we do need the mempool
-        // parents!)
-        UpdateAncestorsOf(false, removeIt, setAncestors);
-    }
-    // After updating all the ancestor sizes, we can now sever the link between each
-    // transaction being removed and any mempool children (ie, update setMemPoolParents
-    // for each direct child of a transaction being removed).
-    BOOST_FOREACH(txiter removeIt, entriesToRemove) {
-        UpdateChildrenForRemoval(removeIt);
+    auto isRemoved = [&entriesToRemove](txiter it) {
+        return std::binary_search(entriesToRemove.begin(), entriesToRemove.end(), it, CompareIteratorByAddress());
+    };
+
+    // Collect, for every removed entry, the ancestors that stay in the mempool. Each
+    // transaction inherits them from its parents, so a chain that is removed as a
+    // whole is walked only once and a mined chain has none at all.
+    boost::unordered_map<txiter, setEntries, IteratorHasher> ancestorsThatStay;
+    BOOST_FOREACH(txiter removeIt, linked) {
+        std::vector<txiter> stack(1, removeIt);
+        while (!stack.empty()) {
+            const txiter it = stack.back();
+            if (ancestorsThatStay.count(it)) {
+                stack.pop_back();
+                continue;
+            }
+            const setEntries &parents = GetMemPoolParents(it);
+            bool parentsDone = true;
+            BOOST_FOREACH(txiter parentIt, parents) {
+                if (!ancestorsThatStay.count(parentIt)) {
+                    stack.push_back(parentIt);
+                    parentsDone = false;
+                }
+            }
+            if (!parentsDone)
+                continue;
+            setEntries &ancestors = ancestorsThatStay[it];
+            BOOST_FOREACH(txiter parentIt, parents) {
+                const setEntries &inherited = ancestorsThatStay[parentIt];
+                ancestors.insert(inherited.begin(), inherited.end());
+                if (!isRemoved(parentIt))
+                    ancestors.insert(parentIt);
+            }
+            stack.pop_back();
+        }
+    }
+
+    // Update each ancestor that stays only once, for all of its removed descendants.
+    // Note that we use the mapLinks[] notion of ancestors here and not the one we'd
+    // find by searching for parents, while processing a reorg the in-mempool children
+    // aren't linked to the in-block transactions until UpdateTransactionsFromBlock()
+    // is called and those links are exactly the packages that include the entry.
+    struct DescendantChange {
+        int64_t size;
+        CAmount fee;
+        int64_t count;
+        DescendantChange() : size(0), fee(0), count(0) {}
+    };
+    boost::unordered_map<txiter, DescendantChange, IteratorHasher> ancestorChanges;
+    BOOST_FOREACH(txiter removeIt, linked) {
+        BOOST_FOREACH(txiter ancestorIt, ancestorsThatStay[removeIt]) {
+            DescendantChange &change = ancestorChanges[ancestorIt];
+            change.size -= removeIt->GetTxSize();
+            change.fee -= removeIt->GetModifiedFee();
+            --change.count;
+        }
+    }
+    typedef boost::unordered_map<txiter, DescendantChange, IteratorHasher>::value_type Change;
+    BOOST_FOREACH(const Change &change, ancestorChanges) {
+        mapTx.modify(change.first, update_descendant_state(change.second.size, change.second.fee, change.second.count));
+    }
+
+    // After updating all the ancestor sizes, we can now sever the links between each
+    // transaction being removed and the mempool parents and children that stay.
+    // Links between two removed transactions go away with the entries themselves.
+    BOOST_FOREACH(txiter removeIt, linked) {
+        BOOST_FOREACH(txiter parentIt, GetMemPoolParents(removeIt)) {
+            if (!isRemoved(parentIt))
+                UpdateChild(parentIt, removeIt, false);
+        }
+        BOOST_FOREACH(txiter childIt, GetMemPoolChildren(removeIt)) {
+            if (!isRemoved(childIt))
+                UpdateParent(childIt, removeIt, false);
+        }
     }
 }
 
@@ -309,6 +362,7 @@ void CTxMemPoolEntry::SetDirty()
     nCountWithDescendants = 0;
     nSizeWithDescendants = nTxSize;
     nModFeesWithDescendants = GetModifiedFee();
+    UpdateScores();
 }
 
 void CTxMemPoolEntry::UpdateState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
@@ -319,9 +373,27 @@ void CTxMemPoolEntry::UpdateState(int64_t modifySize, CAmount modifyFee, int64_t
         nModFeesWithDescendants += modifyFee;
         nCountWithDescendants += modifyCount;
         assert(int64_t(nCountWithDescendants) > 0);
+        UpdateScores();
     }
 }
 
+SaltedTxidHasher::SaltedTxidHasher()
+    : salt(GetRandHash())
+{
+}
+
+SaltedCheapHashHasher::SaltedCheapHashHasher()
+    : salt(GetRandHash())
+{
+}
+
+size_t SaltedCheapHashHasher::operator()(uint64_t cheapHash) const
+{
+    uint256 key;
+    WriteLE64(key.begin(), cheapHash);
+    return key.GetHash(salt);
+}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
     nTransactionsUpdated(0)
 {
@@ -416,23 +488,28 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     minerPolicyEstimator->processTransaction(entry, fCurrentEstimate);
+    NotifyEntryAdded(newit);
 
     return true;
 }
 
-void CTxMemPool::removeUnchecked(txiter it)
+void CTxMemPool::removeUnchecked(txiter it, bool updateEstimator)
 {
+    NotifyEntryRemoved(it);
     const uint256 hash = it->GetTx().GetHash();
     BOOST_FOREACH(const CTxIn& txin, it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
-    mapLinks.erase(it);
+    txlinksMap::iterator links = mapLinks.find(it);
+    assert(links != mapLinks.end());
+    cachedInnerUsage -= memusage::DynamicUsage(links->second.parents) + memusage::DynamicUsage(links->second.children);
+    mapLinks.erase(links);
     mapTx.erase(it);
     nTransactionsUpdated++;
-    minerPolicyEstimator->removeTx(hash);
+    if (updateEstimator)
+        minerPolicyEstimator->removeTx(hash);
 }
 
 // Calculates descendants of entry that are not already in setDescendants, and adds to
@@ -558,29 +635,57 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
 
 /**
  * Called when a block is connected. Removes from mempool and updates the miner fee estimator.
+ *
+ * The block transactions and everything that conflicts with them are collected first and
+ * removed as one set, so the ancestors of the removed transactions are updated only once.
  */
 void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight,
                                 std::list<CTransaction>& conflicts, bool fCurrentEstimate)
 {
     LOCK(cs);
-    std::vector<CTxMemPoolEntry> entries;
+    std::vector<txiter> toRemove;
+    toRemove.reserve(vtx.size());
+    std::vector<const CTxMemPoolEntry*> entries;
+    entries.reserve(vtx.size());
     BOOST_FOREACH(const CTransaction& tx, vtx)
     {
-        uint256 hash = tx.GetHash();
-
-        indexed_transaction_set::iterator i = mapTx.find(hash);
-        if (i != mapTx.end())
-            entries.push_back(*i);
+        const uint256 hash = tx.GetHash();
+        txiter i = mapTx.find(hash);
+        if (i != mapTx.end()) {
+            entries.push_back(&*i);
+            toRemove.push_back(i);
+        }
+        ClearPrioritisation(hash);
     }
+
+    setEntries setConflicts;
     BOOST_FOREACH(const CTransaction& tx, vtx)
     {
-        std::list<CTransaction> dummy;
-        remove(tx, dummy, false);
-        removeConflicts(tx, conflicts);
-        ClearPrioritisation(tx.GetHash());
+        BOOST_FOREACH(const CTxIn &txin, tx.vin) {
+            std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(txin.prevout);
+            if (it == mapNextTx.end() || *it->second.ptx == tx)
+                continue;
+            txiter conflictIt = mapTx.find(it->second.ptx->GetHash());
+            assert(conflictIt != mapTx.end());
+            ClearPrioritisation(conflictIt->GetTx().GetHash());
+            CalculateDescendants(conflictIt, setConflicts);
+        }
+    }
+    BOOST_FOREACH(txiter it, setConflicts) {
+        conflicts.push_back(it->GetTx());
+        toRemove.push_back(it);
+    }
+    std::sort(toRemove.begin(), toRemove.end(), CompareIteratorByAddress());
+    toRemove.erase(std::unique(toRemove.begin(), toRemove.end()), toRemove.end());
+
+    // The estimator has to forget the removed transactions before it processes the block,
+    // do both while the block entries are still alive so they don't need to be copied.
+    BOOST_FOREACH(txiter it, toRemove) {
+        minerPolicyEstimator->removeTx(it->GetTx().GetHash());
     }
-    // After the txs in the new block have been removed from the mempool, update policy estimates
     minerPolicyEstimator->processBlock(nBlockHeight, entries, fCurrentEstimate);
+    RemoveSorted(toRemove, false);
+
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = true;
 }
@@ -679,7 +784,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             waitingOnDependants.push_back(&(*it));
         else {
             CValidationState state;
-            assert(CheckInputs(tx, state, mempoolDuplicate, false, 0, false, NULL));
+            PrecomputedTransactionData txdata(tx);
+            assert(CheckInputs(tx, state, mempoolDuplicate, false, 0, false, txdata, NULL));
             UpdateCoins(tx, state, mempoolDuplicate, 1000000);
         }
     }
@@ -693,7 +799,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             stepsSinceLastRemove++;
             assert(stepsSinceLastRemove < waitingOnDependants.size());
         } else {
-            assert(CheckInputs(entry->GetTx(), state, mempoolDuplicate, false, 0, false, NULL));
+            PrecomputedTransactionData txdata(entry->GetTx());
+            assert(CheckInputs(entry->GetTx(), state, mempoolDuplicate, false, 0, false, txdata, NULL));
             UpdateCoins(entry->GetTx(), state, mempoolDuplicate, 1000000);
             stepsSinceLastRemove = 0;
         }
@@ -731,6 +838,17 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     return true;
 }
 
+CTxMemPool::txiter CTxMemPool::findByCheapHash(uint64_t cheapHash, bool &collision) const
+{
+    AssertLockHeld(cs);
+    const indexed_transaction_set::nth_index<4>::type &index = mapTx.get<4>();
+    indexed_transaction_set::nth_index<4>::type::const_iterator iter = index.find(cheapHash);
+    if (iter == index.end())
+        return mapTx.end();
+    collision = index.count(cheapHash) > 1;
+    return mapTx.project<0>(iter);
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
     LOCK(cs);
@@ -794,6 +912,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
         std::pair<double, CAmount> &deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        ++nTransactionsUpdated;
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
             mapTx.modify(it, update_fee_delta(deltas.second));
@@ -855,15 +974,24 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + cachedInnerUsage;
+    // Estimate the overhead of mapTx to be 14 pointers + an allocation plus the bucket array of the txid index,
+    // as no exact formula for boost::multi_index_contained is implemented. The short-id index keeps its bucket
+    // array at about one pointer per entry, which is included in the 14.
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 14 * sizeof(void*)) * mapTx.size() + memusage::MallocUsage(sizeof(void*) * mapTx.bucket_count())
+            + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage) {
+    std::vector<txiter> entries(stage.begin(), stage.end());
+    std::sort(entries.begin(), entries.end(), CompareIteratorByAddress());
+    RemoveSorted(entries, true);
+}
+
+void CTxMemPool::RemoveSorted(const std::vector<txiter> &entries, bool updateEstimator) {
     AssertLockHeld(cs);
-    UpdateForRemoveFromMempool(stage);
-    BOOST_FOREACH(const txiter& it, stage) {
-        removeUnchecked(it);
+    UpdateForRemoveFromMempool(entries);
+    BOOST_FOREACH(const txiter& it, entries) {
+        removeUnchecked(it, updateEstimator);
     }
 }
 
@@ -966,7 +1094,7 @@ void CTxMemPool::TrimToSize(size_t sizelimit, std::vector<uint256>* pvNoSpendsRe
 
     unsigned nTxnRemoved = 0;
     CFeeRate maxFeeRateRemoved(0);
-    while (DynamicMemoryUsage() > sizelimit) {
+    while (!mapTx.empty() && DynamicMemoryUsage() > sizelimit) {
         indexed_transaction_set::nth_index<1>::type::iterator it = mapTx.get<1>().begin();
 
         // We set the new mempool min fee to the feerate of the removed set, plus the
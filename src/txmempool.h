@@ -16,7 +16,10 @@
 
 #undef foreach
 #include "boost/multi_index_container.hpp"
+#include "boost/multi_index/hashed_index.hpp"
 #include "boost/multi_index/ordered_index.hpp"
+#include <boost/signals2/signal.hpp>
+#include <boost/unordered_map.hpp>
 
 class CAutoFile;
 class CBlockIndex;
@@ -97,6 +100,13 @@ private:
     uint64_t nSizeWithDescendants;  //! ... and size
     CAmount nModFeesWithDescendants;  //! ... and total fees (all including us)
 
+    // The sort keys of the mempool indexes, recalculated whenever the fees or
+    // sizes change so that comparing two entries is cheap.
+    double modFeeRate; //! modified fee per byte
+    double descendantScore; //! the highest of modFeeRate and the fee rate with descendants
+
+    void UpdateScores();
+
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                     int64_t _nTime, double _entryPriority, unsigned int _entryHeight,
@@ -140,6 +150,9 @@ public:
     CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
 
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
+
+    double GetModFeeRate() const { return modFeeRate; }
+    double GetDescendantScore() const { return descendantScore; }
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -194,6 +207,16 @@ struct mempoolentry_txid
     }
 };
 
+// extracts the short transaction id that xthin blocks use, see uint256::GetCheapHash()
+struct mempoolentry_cheaphash
+{
+    typedef uint64_t result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        return entry.GetTx().GetHash().GetCheapHash();
+    }
+};
+
 /** \class CompareTxMemPoolEntryByDescendantScore
  *
  *  Sort an entry by max(score/size of entry's tx, score/size with all descendants).
@@ -201,33 +224,11 @@ struct mempoolentry_txid
 class CompareTxMemPoolEntryByDescendantScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
-        bool fUseADescendants = UseDescendantScore(a);
-        bool fUseBDescendants = UseDescendantScore(b);
-
-        double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
-        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
-
-        double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
-        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
-
-        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
-        double f1 = aModFee * bSize;
-        double f2 = aSize * bModFee;
-
-        if (f1 == f2) {
+        if (a.GetDescendantScore() == b.GetDescendantScore())
             return a.GetTime() >= b.GetTime();
-        }
-        return f1 < f2;
-    }
-
-    // Calculate which score to use for an entry (avoiding division).
-    bool UseDescendantScore(const CTxMemPoolEntry &a)
-    {
-        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
-        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
-        return f2 > f1;
+        return a.GetDescendantScore() < b.GetDescendantScore();
     }
 };
 
@@ -238,26 +239,51 @@ public:
 class CompareTxMemPoolEntryByScore
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
-        double f1 = (double)a.GetModifiedFee() * b.GetTxSize();
-        double f2 = (double)b.GetModifiedFee() * a.GetTxSize();
-        if (f1 == f2) {
+        if (a.GetModFeeRate() == b.GetModFeeRate())
             return b.GetTx().GetHash() < a.GetTx().GetHash();
-        }
-        return f1 > f2;
+        return a.GetModFeeRate() > b.GetModFeeRate();
     }
 };
 
 class CompareTxMemPoolEntryByEntryTime
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         return a.GetTime() < b.GetTime();
     }
 };
 
+/**
+ * Hashes txids for the mempool's hashed index. The salt is random per mempool so
+ * peers can't pick txids that all land in the same bucket.
+ */
+struct SaltedTxidHasher
+{
+    SaltedTxidHasher();
+    size_t operator()(const uint256& txid) const {
+        return txid.GetHash(salt);
+    }
+
+private:
+    uint256 salt;
+};
+
+/**
+ * Hashes the short ids of the mempool's short id index. These are picked by
+ * the sender of a transaction, so they are salted just like the txids.
+ */
+struct SaltedCheapHashHasher
+{
+    SaltedCheapHashHasher();
+    size_t operator()(uint64_t cheapHash) const;
+
+private:
+    uint256 salt;
+};
+
 class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -376,8 +402,8 @@ public:
     typedef boost::multi_index_container<
         CTxMemPoolEntry,
         boost::multi_index::indexed_by<
-            // sorted by txid
-            boost::multi_index::ordered_unique<mempoolentry_txid>,
+            // hashed by txid
+            boost::multi_index::hashed_unique<mempoolentry_txid, SaltedTxidHasher>,
             // sorted by fee rate
             boost::multi_index::ordered_non_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
@@ -392,7 +418,9 @@ public:
             boost::multi_index::ordered_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByScore
-            >
+            >,
+            // hashed by short id (for thin block reconstruction)
+            boost::multi_index::hashed_non_unique<mempoolentry_cheaphash, SaltedCheapHashHasher>
         >
     > indexed_transaction_set;
 
@@ -416,7 +444,17 @@ private:
         setEntries children;
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    struct CompareIteratorByAddress {
+        bool operator()(const txiter &a, const txiter &b) const {
+            return &*a < &*b;
+        }
+    };
+    struct IteratorHasher {
+        size_t operator()(const txiter &it) const {
+            return boost::hash<const CTxMemPoolEntry*>()(&*it);
+        }
+    };
+    typedef boost::unordered_map<txiter, TxLinks, IteratorHasher> txlinksMap;
     txlinksMap mapLinks;
 
     void UpdateParent(txiter entry, txiter parent, bool add);
@@ -472,6 +510,11 @@ public:
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta) const;
     void ClearPrioritisation(const uint256 hash);
 
+    /** Emitted with cs held after an entry has been added to the pool. */
+    boost::signals2::signal<void (txiter)> NotifyEntryAdded;
+    /** Emitted with cs held just before an entry is removed from the pool. */
+    boost::signals2::signal<void (txiter)> NotifyEntryRemoved;
+
 public:
     /** Remove a set of transactions from the mempool.
      *  If a transaction is in this set, then all in-mempool descendants must
@@ -538,6 +581,14 @@ public:
 
     bool lookup(uint256 hash, CTransaction& result) const;
 
+    /**
+     * Finds a transaction by the first 64 bits of its txid, see uint256::GetCheapHash().
+     * Returns mapTx.end() if there is none. When more than one matches an arbitrary one is
+     * returned and \a collision is set to true.
+     * Requires cs to be held.
+     */
+    txiter findByCheapHash(uint64_t cheapHash, bool &collision) const;
+
     /** Estimate fee rate needed to get into the next nBlocks
      *  If no answer can be given at nBlocks, return an estimate
      *  at the lowest number of blocks where one can be given
@@ -585,10 +636,12 @@ private:
             const std::set<uint256> &setExclude);
     /** Update ancestors of hash to add/remove it as a descendant transaction. */
     void UpdateAncestorsOf(bool add, txiter hash, setEntries &setAncestors);
-    /** For each transaction being removed, update ancestors and any direct children. */
-    void UpdateForRemoveFromMempool(const setEntries &entriesToRemove);
-    /** Sever link between specified transaction and direct children. */
-    void UpdateChildrenForRemoval(txiter entry);
+    /** For each transaction being removed, update ancestors and any direct children.
+     *  The entries have to be sorted with CompareIteratorByAddress. */
+    void UpdateForRemoveFromMempool(const std::vector<txiter> &entriesToRemove);
+    /** RemoveStaged() for entries sorted with CompareIteratorByAddress.
+     *  Pass updateEstimator false if the caller already told the fee estimator. */
+    void RemoveSorted(const std::vector<txiter> &entries, bool updateEstimator);
 
     /** Populate setDescendants with all in-mempool descendants of hash.
      *  Assumes that setDescendants includes all in-mempool descendants of anything
@@ -603,7 +656,7 @@ private:
      *  transactions in a chain before we've updated all the state for the
      *  removal.
      */
-    void removeUnchecked(txiter entry);
+    void removeUnchecked(txiter entry, bool updateEstimator = true);
 };
 
 /** 
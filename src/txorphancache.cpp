@@ -63,6 +63,7 @@ bool CTxOrphanCache::AddOrphanTx(const CTransaction& tx, NodeId peer)
     BOOST_FOREACH(const CTxIn& txin, tx.vin) {
         m_mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
     }
+    m_orphansByCheapHash.insert(std::make_pair(hash.GetCheapHash(), hash));
 
     logDebug(Log::Mempool) << "stored orphan tx" << hash << "(mapsz"
         << m_mapOrphanTransactions.size() << "prevsz " << m_mapOrphanTransactionsByPrev.size() << ')';
@@ -82,6 +83,13 @@ void CTxOrphanCache::EraseOrphanTx(uint256 hash)
         if (itPrev->second.empty())
             m_mapOrphanTransactionsByPrev.erase(itPrev);
     }
+    auto range = m_orphansByCheapHash.equal_range(hash.GetCheapHash());
+    for (auto itCheap = range.first; itCheap != range.second; ++itCheap) {
+        if (itCheap->second == hash) {
+            m_orphansByCheapHash.erase(itCheap);
+            break;
+        }
+    }
     m_mapOrphanTransactions.erase(it);
 }
 
@@ -136,6 +144,7 @@ void CTxOrphanCache::clear()
         LOCK(s_instance->m_lock);
         s_instance->m_mapOrphanTransactions.clear();
         s_instance->m_mapOrphanTransactionsByPrev.clear();
+        s_instance->m_orphansByCheapHash.clear();
     }
 }
 
@@ -150,6 +159,17 @@ bool CTxOrphanCache::value(const uint256 &txid, CTransaction &output)
     return true;
 }
 
+bool CTxOrphanCache::valueByCheapHash(uint64_t cheapHash, CTransaction &output)
+{
+    CTxOrphanCache *s = instance();
+    LOCK(s->m_lock);
+    auto iter = s->m_orphansByCheapHash.find(cheapHash);
+    if (iter == s->m_orphansByCheapHash.end())
+        return false;
+    output = s->m_mapOrphanTransactions.at(iter->second).tx;
+    return true;
+}
+
 bool CTxOrphanCache::contains(const uint256 &txid)
 {
     CTxOrphanCache *s = instance();
@@ -190,18 +210,6 @@ void CTxOrphanCache::EraseOrphans(const std::vector<uint256> &txIds)
 {
     LOCK(m_lock);
     for (auto hashIter = txIds.begin(); hashIter != txIds.end(); ++hashIter) {
-        auto it = m_mapOrphanTransactions.find(*hashIter);
-        if (it == m_mapOrphanTransactions.end())
-            continue;
-
-        BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin) {
-            auto itPrev = m_mapOrphanTransactionsByPrev.find(txin.prevout.hash);
-            if (itPrev == m_mapOrphanTransactionsByPrev.end())
-                continue;
-            itPrev->second.erase(*hashIter);
-            if (itPrev->second.empty())
-                m_mapOrphanTransactionsByPrev.erase(itPrev);
-        }
-        m_mapOrphanTransactions.erase(it);
+        EraseOrphanTx(*hashIter);
     }
 }
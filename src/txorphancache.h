@@ -44,6 +44,9 @@ public:
 
     static void clear();
     static bool value(const uint256 &txid, CTransaction &output);
+    /// like value(), finds an orphan by the first 64 bits of its txid, see uint256::GetCheapHash().
+    /// When several orphans share those bits any one of them is returned.
+    static bool valueByCheapHash(uint64_t cheapHash, CTransaction &output);
     static bool contains(const uint256 &txid);
 
     std::vector<uint256> fetchTransactionIds() const;
@@ -58,6 +61,7 @@ protected:
     mutable CCriticalSection m_lock;
     std::map<uint256, COrphanTx> m_mapOrphanTransactions;
     std::map<uint256, std::set<uint256> > m_mapOrphanTransactionsByPrev;
+    std::multimap<uint64_t, uint256> m_orphansByCheapHash; // orphans can share a cheap hash
 
     static CTxOrphanCache *s_instance;
 
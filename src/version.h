@@ -9,7 +9,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 80002;
+static const int PROTOCOL_VERSION = 80003;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -40,4 +40,7 @@ static const int SENDHEADERS_VERSION = 70012;
 //! Expedited Relay enabled in this version
 static const int EXPEDITED_VERSION = 80002;
 
+//! "xthinblock2" and "get_xblocktx2", thin blocks with salted short ids, start with this version
+static const int SALTED_XTHIN_VERSION = 80003;
+
 #endif // BITCOIN_VERSION_H